@@ -0,0 +1,30 @@
+#include "allocations.hpp"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation in the process goes through here so the parse
+// benchmark can report how many the tree costs. They are in a file of their
+// own so GCC never inlines this malloc and free next to a new expression,
+// where -Wmismatched-new-delete takes them for a mismatched pair.
+namespace {
+std::size_t allocations = 0;
+} // namespace
+
+void *operator new(std::size_t size) {
+  allocations++;
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t /*size*/) noexcept {
+  std::free(ptr);
+}
+
+namespace Bench {
+
+std::size_t Allocations() { return allocations; }
+
+} // namespace Bench
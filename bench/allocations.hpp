@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+namespace Bench {
+
+// How many times operator new has been called in the process so far
+std::size_t Allocations();
+
+} // namespace Bench
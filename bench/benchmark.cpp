@@ -0,0 +1,399 @@
+#include "allocations.hpp"
+#include "ast.hpp"
+#include "compiler.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Bench::Allocations;
+
+struct Benchmark {
+  std::string name;
+  std::string input;
+};
+
+const std::vector<Benchmark> benchmarks = {
+  {.name = "fib(25)",
+   .input = "let fibonacci = fn(x) { if (x < 2) { x } else { fibonacci(x - 1) "
+            "+ fibonacci(x - 2) } }; fibonacci(25);"},
+  {.name = "array walk (rest, 500 x 40)",
+   .input = "let build = fn(n, acc) { if (n == 0) { acc } else { build(n - 1, "
+            "push(acc, n)) } };"
+            "let sum = fn(arr, acc) { if (len(arr) == 0) { acc } else { "
+            "sum(rest(arr), acc + first(arr)) } };"
+            "let arr = build(500, []);"
+            "let repeat = fn(n, acc) { if (n == 0) { acc } else { repeat(n - "
+            "1, acc + sum(arr, 0)) } };"
+            "repeat(40, 0);"},
+  {.name = "string build (500 x 80)",
+   .input = "let build = fn(n, acc) { if (n == 0) { acc } else { build(n - 1, "
+            "acc + \"a report fragment, \") } };"
+            "let repeat = fn(n, acc) { if (n == 0) { acc } else { repeat(n - "
+            "1, acc + len(build(500, \"\"))) } };"
+            "repeat(80, 0);"},
+  {.name = "constants (500 x 40)",
+   .input = "let timeout = fn(n) { if (2 > 1) { n * (2 * 60 * 60) + 30 * 60 } "
+            "else { 0 } };"
+            "let label = fn(n) { if (n == 0) { \"slow \" + \"path\" } else "
+            "{ -(-5) * (1 + 2) } };"
+            "let run = fn(n, acc) { if (n == 0) { acc } else { run(n - 1, acc "
+            "+ timeout(n) + label(n)) } };"
+            "let repeat = fn(n, acc) { if (n == 0) { acc } else { repeat(n - "
+            "1, acc + run(500, 0)) } };"
+            "repeat(40, 0);"},
+};
+
+Ast::Program parse(const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  return p.ParseProgram();
+}
+
+std::string runEvaluator(const std::string &input, bool optimize = false) {
+  auto program = parse(input);
+  if (optimize) {
+    Optimizer::Optimizer().Optimize(&program);
+  }
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&program, env);
+  return result != nullptr ? result->Inspect() : "";
+}
+
+std::string runVm(const std::string &input) {
+  auto program = parse(input);
+  Compiler::Compiler compiler;
+  if (!compiler.Compile(&program)) {
+    return compiler.Errors()[0];
+  }
+  Vm::Vm vm(compiler.GetBytecode());
+  if (auto err = vm.Run()) {
+    return err->Inspect();
+  }
+  auto result = vm.LastPoppedStackElem();
+  return result != nullptr ? result->Inspect() : "";
+}
+
+// identifiers can't contain digits, so number them with letters instead
+std::string letters(int i) {
+  std::string out;
+  do {
+    out += static_cast<char>('a' + i % 26);
+    i /= 26;
+  } while (i > 0);
+  return out;
+}
+
+// Lots of small functions, calls, arrays and conditionals, roughly what a
+// generated script looks like
+std::string generateScript(int functions) {
+  std::string out;
+  for (int i = 0; i < functions; i++) {
+    out += std::format(
+      "let fun{1} = fn(a, b) {{ if (a < b) {{ return [a, b, a * {0}]; }} "
+      "else {{ let c = a - b; c + {0} }} }};\n"
+      "let res{1} = fun{1}({0}, len([1, 2, 3]) + -{0})[0];\n",
+      i, letters(i));
+  }
+  return out;
+}
+
+struct ParseStats {
+  double parseMs;
+  double freeMs;
+  std::size_t allocations;
+};
+
+ParseStats measureParse(const std::string &input, bool useArena) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l, useArena);
+  std::size_t before = Allocations();
+  auto start = std::chrono::steady_clock::now();
+  auto program = std::make_unique<Ast::Program>(p.ParseProgram());
+  auto parsed = std::chrono::steady_clock::now();
+  std::size_t count = Allocations() - before;
+  program.reset();
+  auto freed = std::chrono::steady_clock::now();
+  return {
+    .parseMs =
+      std::chrono::duration<double, std::milli>(parsed - start).count(),
+    .freeMs = std::chrono::duration<double, std::milli>(freed - parsed).count(),
+    .allocations = count};
+}
+
+void parseBenchmark() {
+  auto input = generateScript(5000);
+  std::cout << std::format("\nparse {} KiB of generated script\n",
+                           input.size() / 1024);
+  std::cout << std::format("{:<30} {:>12} {:>12} {:>12} {:>12}\n", "",
+                           "parse (ms)", "MiB/s", "free (ms)", "allocations");
+  double mib = static_cast<double>(input.size()) / (1024 * 1024);
+  for (bool useArena : {false, true}) {
+    auto stats = measureParse(input, useArena);
+    std::cout << std::format("{:<30} {:>12.2f} {:>12.1f} {:>12.2f} {:>12}\n",
+                             useArena ? "arena" : "heap", stats.parseMs,
+                             mib / (stats.parseMs / 1000), stats.freeMs,
+                             stats.allocations);
+  }
+}
+
+// Tokens only point into the source, so lexing should cost next to no
+// allocations however big the script is
+void lexBenchmark() {
+  auto input = generateScript(20000);
+  Lexer::Lexer l(input);
+  std::size_t before = Allocations();
+  std::size_t tokens = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (l.NextToken().Type != Token::EOF_) {
+    tokens++;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ms = std::chrono::duration<double, std::milli>(end - start).count();
+  std::cout << std::format(
+    "\nlex {} KiB: {} tokens in {:.2f} ms ({:.0f} MiB/s), {} allocations\n",
+    input.size() / 1024, tokens, ms,
+    static_cast<double>(input.size()) / (1024 * 1024) / (ms / 1000),
+    Allocations() - before);
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// The whole input lexed up front into the token buffer, on one thread and
+// on as many as it gets cut into, then parsed from it by index
+void tokenBufferBenchmark() {
+  auto source = std::make_shared<Token::Source>();
+  for (int i = 0; i < 8; i++) {
+    source->Owned += generateScript(20000);
+  }
+  source->Text = source->Owned;
+  double mib = static_cast<double>(source->Text.size()) / (1024 * 1024);
+  std::cout << std::format("\ntoken buffer for {:.1f} MiB\n", mib);
+  for (std::size_t parts : {std::size_t{1}, std::size_t{0}}) {
+    auto start = std::chrono::steady_clock::now();
+    auto buffer = Lexer::TokenBuffer::Tokenize(source, parts);
+    double ms = msSince(start);
+    std::cout << std::format("{:<30} {:>9.2f} ms {:>9.0f} MiB/s\n",
+                             std::format("lex, {} parts", buffer.Parts()), ms,
+                             mib / (ms / 1000));
+    source->Decoded.clear();
+  }
+  auto buffer = Lexer::TokenBuffer::Tokenize(source);
+  auto parse = [&](bool buffered) {
+    auto start = std::chrono::steady_clock::now();
+    Lexer::Lexer l(source);
+    auto p = buffered ? Parser::Parser(buffer) : Parser::Parser(l);
+    p.ParseProgram();
+    return msSince(start);
+  };
+  // the first parse pays for faulting in the heap
+  parse(false);
+  double buffered = parse(true);
+  double pulled = parse(false);
+  std::cout << std::format("{:<30} {:>9.2f} ms\n{:<30} {:>9.2f} ms\n",
+                           "parse from the buffer", buffered,
+                           "lex and parse as it goes", pulled);
+}
+
+// String() walks the whole tree through the static visitor. The downcasts
+// compare the tag check the visitor does per node with the dynamic_cast it
+// replaced.
+void treeBenchmark() {
+  auto program = parse(generateScript(5000));
+  auto start = std::chrono::steady_clock::now();
+  auto printed = program.String();
+  double printMs = msSince(start);
+
+  const int rounds = 200;
+  std::size_t tagged = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    for (const auto &stmt : program.m_statements) {
+      if (Ast::As<Ast::LetStatement>(stmt.get()) != nullptr) {
+        tagged++;
+      }
+    }
+  }
+  double tagMs = msSince(start);
+  std::size_t rtti = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    for (const auto &stmt : program.m_statements) {
+      if (dynamic_cast<Ast::LetStatement *>(stmt.get()) != nullptr) {
+        rtti++;
+      }
+    }
+  }
+  double rttiMs = msSince(start);
+  std::cout << std::format(
+    "\nprint tree: {} KiB in {:.2f} ms\n"
+    "{} downcasts: tag {:.2f} ms, dynamic_cast {:.2f} ms\n",
+    printed.size() / 1024, printMs, tagged + rtti, tagMs, rttiMs);
+}
+
+// Heap allocations a call costs once the function exists, fib(20) makes
+// 21891 calls. Then the same for a call that makes a closure, which
+// captures the call's environment so it can't be reused.
+void callBenchmark() {
+  const std::string define =
+    "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };";
+  const double calls = 21891;
+
+  auto definition = parse(define);
+  auto call = parse("fib(20)");
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  evaluator.Eval(&definition, env);
+  std::size_t before = Allocations();
+  evaluator.Eval(&call, env);
+  double evalPerCall = static_cast<double>(Allocations() - before) / calls;
+
+  auto program = parse(define + "fib(20)");
+  Compiler::Compiler compiler;
+  compiler.Compile(&program);
+  Vm::Vm vm(compiler.GetBytecode());
+  before = Allocations();
+  vm.Run();
+  double vmPerCall = static_cast<double>(Allocations() - before) / calls;
+
+  auto closures = parse("let make = fn(n, f) { if (n == 0) { f() } else { "
+                        "make(n - 1, fn() { n }) } };");
+  auto makeCall = parse("make(10000, fn() { 0 });");
+  evaluator.Eval(&closures, env);
+  before = Allocations();
+  evaluator.Eval(&makeCall, env);
+  double perClosure = static_cast<double>(Allocations() - before) / 10000;
+
+  std::cout << std::format(
+    "\nallocations per call: eval {:.2f}, vm {:.2f}\n"
+    "allocations per call making a closure: eval {:.2f}\n",
+    evalPerCall, vmPerCall, perClosure);
+}
+
+double timeIt(const std::function<std::string()> &fn, std::string &result) {
+  auto start = std::chrono::steady_clock::now();
+  result = fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// The evaluator on every benchmark program with and without the optimizer
+// pass, only the constants one has much for it to fold
+void optimizerBenchmark() {
+  std::cout << std::format("\n{:<30} {:>12} {:>12} {:>9}\n", "optimizer",
+                           "eval (ms)", "folded (ms)", "speedup");
+  for (const auto &bench : benchmarks) {
+    std::string plainResult;
+    std::string optimizedResult;
+    double plainMs = timeIt([&] { return runEvaluator(bench.input); },
+                            plainResult);
+    double optimizedMs =
+      timeIt([&] { return runEvaluator(bench.input, true); }, optimizedResult);
+    std::cout << std::format("{:<30} {:>12.2f} {:>12.2f} {:>8.2f}x\n",
+                             bench.name, plainMs, optimizedMs,
+                             plainMs / optimizedMs);
+    if (plainResult != optimizedResult) {
+      std::cout << std::format("  result mismatch: eval={} optimized={}\n",
+                               plainResult, optimizedResult);
+    }
+  }
+}
+
+// What the collector did over all of the runs above
+void gcStats() {
+  const auto &stats = Gc::Heap::Current().Statistics();
+  std::cout << std::format(
+    "\ngc: {} collections, {:.2f} ms total pause, {:.2f} ms max pause\n"
+    "    {} objects ({} KiB) allocated, {} freed, {} KiB live\n",
+    stats.m_collections,
+    std::chrono::duration<double, std::milli>(stats.m_totalPause).count(),
+    std::chrono::duration<double, std::milli>(stats.m_maxPause).count(),
+    stats.m_allocatedObjects, stats.m_allocatedBytes / 1024,
+    stats.m_freedObjects, stats.m_liveBytes / 1024);
+}
+
+// Lines entered one at a time as in the repl, so run refers to names the
+// resolver hasn't seen yet and looks them up by name on every call
+void cacheBenchmark() {
+  const std::vector<std::string> lines = {
+    "let run = fn(n, acc) { if (n == 0) { acc } else { run(n - 1, acc + "
+    "step(n) + len(tag)) } };",
+    "let step = fn(n) { n * 2 };",
+    "let tag = \"late\";",
+    "let repeat = fn(n, acc) { if (n == 0) { acc } else { repeat(n - 1, acc "
+    "+ run(500, 0)) } };",
+    "repeat(40, 0);",
+  };
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  std::vector<Ast::Program> programs;
+  auto before = Evaluator::Evaluator::CacheStatistics();
+  std::string result;
+  double ms = timeIt(
+    [&] {
+      Object::Value last;
+      for (const auto &line : lines) {
+        programs.push_back(parse(line));
+        last = evaluator.Eval(&programs.back(), env);
+      }
+      return last != nullptr ? last->Inspect() : "";
+    },
+    result);
+  std::cout << std::format("\nlate bound lines (500 x 40): {} in {:.2f} ms\n",
+                           result, ms);
+  if constexpr (Evaluator::Evaluator::CountsCaches) {
+    const auto &stats = Evaluator::Evaluator::CacheStatistics();
+    std::cout << std::format(
+      "inline caches: lookups {} hits, {} misses; calls {} hits, {} misses\n",
+      stats.m_lookupHits - before.m_lookupHits,
+      stats.m_lookupMisses - before.m_lookupMisses,
+      stats.m_callHits - before.m_callHits,
+      stats.m_callMisses - before.m_callMisses);
+  }
+}
+
+} // namespace
+
+int main() {
+  std::cout << std::format("{:<30} {:>12} {:>12} {:>9}\n", "benchmark",
+                           "eval (ms)", "vm (ms)", "speedup");
+  for (const auto &bench : benchmarks) {
+    std::string evalResult;
+    std::string vmResult;
+    double evalMs = timeIt([&] { return runEvaluator(bench.input); },
+                           evalResult);
+    double vmMs = timeIt([&] { return runVm(bench.input); }, vmResult);
+    std::cout << std::format("{:<30} {:>12.2f} {:>12.2f} {:>8.1f}x\n",
+                             bench.name, evalMs, vmMs, evalMs / vmMs);
+    if (evalResult != vmResult) {
+      std::cout << std::format("  result mismatch: eval={} vm={}\n",
+                               evalResult, vmResult);
+    }
+  }
+  parseBenchmark();
+  lexBenchmark();
+  tokenBufferBenchmark();
+  treeBenchmark();
+  callBenchmark();
+  optimizerBenchmark();
+  cacheBenchmark();
+  gcStats();
+  return 0;
+}
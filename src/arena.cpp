@@ -0,0 +1,41 @@
+#include "arena.hpp"
+#include <cstdint>
+namespace Ast {
+
+static thread_local Arena *currentArena = nullptr;
+
+static std::byte *alignUp(std::byte *ptr, std::size_t align) {
+  auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+  return reinterpret_cast<std::byte *>((addr + align - 1) & ~(align - 1));
+}
+
+void *Arena::Allocate(std::size_t size, std::size_t align) {
+  std::byte *ptr = alignUp(m_cur, align);
+  if (m_cur == nullptr || ptr + size > m_end) {
+    if (size + align > ChunkSize / 4) {
+      // big requests get a chunk of their own so they don't waste the rest
+      // of the current one
+      m_chunks.push_back(
+        std::make_unique_for_overwrite<std::byte[]>(size + align));
+      m_bytes += size;
+      return alignUp(m_chunks.back().get(), align);
+    }
+    m_chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(ChunkSize));
+    m_cur = m_chunks.back().get();
+    m_end = m_cur + ChunkSize;
+    ptr = alignUp(m_cur, align);
+  }
+  m_cur = ptr + size;
+  m_bytes += size;
+  return ptr;
+}
+
+Arena *Arena::Current() { return currentArena; }
+
+Arena::Scope::Scope(Arena *arena) : m_prev(currentArena) {
+  currentArena = arena;
+}
+
+Arena::Scope::~Scope() { currentArena = m_prev; }
+
+} // namespace Ast
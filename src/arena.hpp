@@ -0,0 +1,100 @@
+#pragma once
+#include "token.hpp"
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+namespace Ast {
+
+// Bump allocator the parser builds the tree in. Nothing is freed one at a
+// time, the chunks all go at once when the last owner (the Program, or a
+// Function that still uses part of the tree) lets go of the arena.
+class Arena : public std::enable_shared_from_this<Arena> {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  Arena(Arena &&) = delete;
+  Arena &operator=(Arena &&) = delete;
+  ~Arena() = default;
+
+  void *Allocate(std::size_t size, std::size_t align);
+  // Keeps something the nodes point into (the source text) alive for as
+  // long as the arena is
+  void Retain(std::shared_ptr<const void> owner) {
+    m_retained.push_back(std::move(owner));
+  }
+  // The text the nodes were parsed from, their offsets are into it
+  void SetSource(std::shared_ptr<const Token::Source> source) {
+    Retain(source);
+    m_source = std::move(source);
+  }
+  [[nodiscard]] const std::shared_ptr<const Token::Source> &Source() const {
+    return m_source;
+  }
+
+  [[nodiscard]] std::size_t BytesAllocated() const { return m_bytes; }
+  [[nodiscard]] std::size_t Chunks() const { return m_chunks.size(); }
+
+  // The arena new nodes are placed in, nullptr means the normal heap
+  static Arena *Current();
+
+  // Makes an arena current for as long as the scope lives
+  class Scope {
+  public:
+    explicit Scope(Arena *arena);
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    Scope(Scope &&) = delete;
+    Scope &operator=(Scope &&) = delete;
+    ~Scope();
+
+  private:
+    Arena *m_prev;
+  };
+
+private:
+  static constexpr std::size_t ChunkSize = 64 * 1024;
+
+  std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+  std::byte *m_cur = nullptr;
+  std::byte *m_end = nullptr;
+  std::size_t m_bytes = 0;
+  std::vector<std::shared_ptr<const void>> m_retained;
+  std::shared_ptr<const Token::Source> m_source;
+};
+
+// Allocator for the child lists of nodes. It picks up the current arena
+// when the list is created and falls back to the heap outside of one.
+template <typename T> struct ArenaAllocator {
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  Arena *m_arena;
+
+  ArenaAllocator() noexcept : m_arena(Arena::Current()) {}
+  template <typename U>
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+    : m_arena(other.m_arena) {}
+
+  T *allocate(std::size_t n) {
+    if (m_arena != nullptr) {
+      return static_cast<T *>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *ptr, std::size_t n) noexcept {
+    if (m_arena == nullptr) {
+      std::allocator<T>().deallocate(ptr, n);
+    }
+  }
+
+  friend bool operator==(const ArenaAllocator &a, const ArenaAllocator &b) {
+    return a.m_arena == b.m_arena;
+  }
+};
+
+} // namespace Ast
@@ -1,33 +1,131 @@
 #include "ast.hpp"
 #include "helpers.hpp"
+#include <cstddef>
 #include <format>
 #include <memory>
+#include <new>
 #include <utility>
 
 namespace Ast {
 
-// All the type stuff in the same place
-Type INode::Type() { return Type::INODE; }
-Type IExpression::Type() { return Type::IEXPRESSION; }
-Type Program::Type() { return Type::PROGRAM; }
-Type Identifier::Type() { return Type::IDENTIFIER; }
-Type IntegerLiteral::Type() { return Type::INTEGER_LITERAL; }
-Type PrefixExpression::Type() { return Type::PREFIX_EXPRESSION; }
-Type InfixExpression::Type() { return Type::INFIX_EXPRESSION; }
-Type Boolean::Type() { return Type::BOOLEAN; }
-Type BlockStatement::Type() { return Type::BLOCK_STATEMENT; }
-Type IfExpression::Type() { return Type::IF_EXPRESSION; }
-Type LetStatement::Type() { return Type::LET_STATEMENT; }
-Type ReturnStatement::Type() { return Type::RETURN_STATEMENT; }
-Type ExpressionStatement::Type() { return Type::EXPRESSION_STATEMENT; }
-Type FunctionLiteral::Type() { return Type::FUNCTION_LITERAL; }
-Type CallExpression::Type() { return Type::CALL_EXPRESSION; }
-Type StringLiteral::Type() { return Type::STRING_LITERAL; }
-Type ArrayLiteral::Type() { return Type::ARRAY_LITERAL; }
-Type IndexExpression::Type() { return Type::INDEX_EXPRESSION; }
-Type HashLiteral::Type() { return Type::HASH_EXPRESSION; }
+// Every node is prefixed with the arena it lives in so delete and ArenaOf
+// can tell the two kinds apart
+namespace {
+struct alignas(std::max_align_t) NodeHeader {
+  Arena *arena;
+};
+} // namespace
+
+void *INode::operator new(std::size_t size) {
+  Arena *arena = Arena::Current();
+  std::size_t total = sizeof(NodeHeader) + size;
+  void *mem = arena != nullptr ? arena->Allocate(total, alignof(NodeHeader))
+                               : ::operator new(total);
+  auto *header = new (mem) NodeHeader{.arena = arena};
+  return header + 1;
+}
+
+void INode::operator delete(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  auto *header = static_cast<NodeHeader *>(ptr) - 1;
+  if (header->arena == nullptr) {
+    ::operator delete(header);
+  }
+}
+
+std::shared_ptr<Arena> ArenaOf(const INode *node) {
+  const auto *header = reinterpret_cast<const NodeHeader *>(node) - 1;
+  if (header->arena == nullptr) {
+    return nullptr;
+  }
+  return header->arena->weak_from_this().lock();
+}
+
+std::shared_ptr<const Token::Source> SourceOf(const INode *node) {
+  const auto *header = reinterpret_cast<const NodeHeader *>(node) - 1;
+  return header->arena != nullptr ? header->arena->Source() : nullptr;
+}
+
+Operator OperatorOf(Token::TokenType type) {
+  switch (type) {
+  case Token::PLUS:
+    return Operator::PLUS;
+  case Token::MINUS:
+    return Operator::MINUS;
+  case Token::BANG:
+    return Operator::BANG;
+  case Token::ASTERISK:
+    return Operator::ASTERISK;
+  case Token::SLASH:
+    return Operator::SLASH;
+  case Token::LT:
+    return Operator::LT;
+  case Token::GT:
+    return Operator::GT;
+  case Token::EQ:
+    return Operator::EQ;
+  case Token::NOT_EQ:
+    return Operator::NOT_EQ;
+  default:
+    return Operator::ILLEGAL;
+  }
+}
+
+std::string_view OperatorString(Operator op) {
+  switch (op) {
+  case Operator::PLUS:
+    return "+";
+  case Operator::MINUS:
+    return "-";
+  case Operator::BANG:
+    return "!";
+  case Operator::ASTERISK:
+    return "*";
+  case Operator::SLASH:
+    return "/";
+  case Operator::LT:
+    return "<";
+  case Operator::GT:
+    return ">";
+  case Operator::EQ:
+    return "==";
+  case Operator::NOT_EQ:
+    return "!=";
+  default:
+    return "ILLEGAL";
+  }
+}
+
+// Scope layout stuff
+namespace {
+thread_local std::size_t generation = 1;
+} // namespace
+
+std::size_t ScopeLayout::Generation() { return generation; }
+
+int ScopeLayout::Declare(Symbols::Symbol name) {
+  if (auto search = m_slots.find(name); search != m_slots.end()) {
+    return search->second;
+  }
+  generation++;
+  int slot = static_cast<int>(m_names.size());
+  m_names.push_back(name);
+  m_slots[name] = slot;
+  return slot;
+}
+
+int ScopeLayout::Find(Symbols::Symbol name) const {
+  if (auto search = m_slots.find(name); search != m_slots.end()) {
+    return search->second;
+  }
+  return -1;
+}
 
 // Program stuff
+Program::Program() : INode(StaticType) {}
+
 std::string Program::TokenLiteral() {
   if (m_statements.size() > 0) {
     return m_statements[0]->TokenLiteral();
@@ -36,238 +134,313 @@ std::string Program::TokenLiteral() {
   }
 }
 
-std::string Program::String() {
-  std::string out;
-  for (auto const &s : m_statements) {
-    out.append(s->String());
-  }
-  return out;
-}
-
 // Identifier stuff
-Identifier::Identifier(Token::Token token, std::string value)
-  : m_token(std::move(token)), m_value(std::move(value)) {};
-std::string Identifier::TokenLiteral() { return m_token.Literal; }
-
-std::string Identifier::String() { return m_value; }
+Identifier::Identifier(Token::Token token, Symbols::Symbol symbol)
+  : IExpression(StaticType), m_token(std::move(token)), m_symbol(symbol) {};
+std::string Identifier::TokenLiteral() { return std::string(m_token.Literal); }
 
 // Integer Literal stuff
 IntegerLiteral::IntegerLiteral(Token::Token token, long int value)
-  : m_token(std::move(token)), m_value(value) {}
-std::string IntegerLiteral::String() { return m_token.Literal; }
+  : IExpression(StaticType), m_token(std::move(token)), m_value(value) {}
 
-std::string IntegerLiteral::TokenLiteral() { return m_token.Literal; }
+std::string IntegerLiteral::TokenLiteral() {
+  return std::string(m_token.Literal);
+}
 
 // PrefixExpression stuff
 PrefixExpression::PrefixExpression(Token::Token t, std::string op)
-  : m_token(std::move(t)), m_op(std::move(op)) {}
-
-std::string PrefixExpression::TokenLiteral() { return m_token.Literal; }
+  : IExpression(StaticType), m_token(std::move(t)), m_op(std::move(op)),
+    m_operator(OperatorOf(m_token.Type)) {}
 
-std::string PrefixExpression::String() {
-  std::string out;
-  out.append("(");
-  out.append(m_op);
-  out.append(m_right->String());
-  out.append(")");
-  return out;
+std::string PrefixExpression::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // InfixExpression stuff
 InfixExpression::InfixExpression(Token::Token t,
                                  std::unique_ptr<IExpression> left,
                                  std::string op)
-  : m_token(std::move(t)), m_left(std::move(left)), m_op(std::move(op)) {}
-std::string InfixExpression::TokenLiteral() { return m_token.Literal; }
-
-std::string InfixExpression::String() {
-  std::string out;
-  out.append("(");
-  out.append(m_left->String());
-  out.append(" " + m_op + " ");
-  out.append(m_right->String());
-  out.append(")");
-  return out;
+  : IExpression(StaticType), m_token(std::move(t)), m_left(std::move(left)),
+    m_op(std::move(op)), m_operator(OperatorOf(m_token.Type)) {}
+std::string InfixExpression::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Boolean Stuff
 Boolean::Boolean(Token::Token token, bool value)
-  : m_token(std::move(token)), m_value(value) {};
-std::string Boolean::String() { return m_token.Literal; }
-std::string Boolean::TokenLiteral() { return m_token.Literal; }
+  : IExpression(StaticType), m_token(std::move(token)), m_value(value) {};
+std::string Boolean::TokenLiteral() { return std::string(m_token.Literal); }
 
 // If Expression Stuff
-IfExpression::IfExpression(Token::Token token) : m_token(std::move(token)) {};
-
-std::string IfExpression::String() {
-  std::string out;
-  out.append("if");
-  out.append(this->m_condition->String());
-  out.append(" ");
-  out.append(this->m_consequence->String());
-  if (this->m_alternative != nullptr) {
-    out.append("else");
-    out.append(this->m_alternative->String());
-  }
-  return out;
-}
+IfExpression::IfExpression(Token::Token token)
+  : IExpression(StaticType), m_token(std::move(token)) {};
 
-std::string IfExpression::TokenLiteral() { return m_token.Literal; }
+std::string IfExpression::TokenLiteral() {
+  return std::string(m_token.Literal);
+}
 
 // LetStatement stuff
-LetStatement::LetStatement(Token::Token token) : m_token(std::move(token)) {};
-
-std::string LetStatement::TokenLiteral() { return m_token.Literal; }
-
-std::string LetStatement::String() {
-  std::string out;
-  out.append(TokenLiteral());
-  out.append(" ");
-  out.append(m_name->String());
-  out.append(" = ");
-  if (m_expression != nullptr) {
-    out.append(m_expression->String());
-  }
-  out.append(";");
-  return out;
+LetStatement::LetStatement(Token::Token token)
+  : IStatement(StaticType), m_token(std::move(token)) {};
+
+std::string LetStatement::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Return Statement Stuff
 ReturnStatement::ReturnStatement(Token::Token token)
-  : m_token(std::move(token)) {};
-std::string ReturnStatement::TokenLiteral() { return m_token.Literal; }
-
-std::string ReturnStatement::String() {
-  std::string out;
-  out.append(TokenLiteral());
-  out.append(" ");
-  if (m_returnValue != nullptr) {
-    out.append(m_returnValue->String());
-  }
-  out.append(";");
-  return out;
+  : IStatement(StaticType), m_token(std::move(token)) {};
+std::string ReturnStatement::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Expression Statement Stuff
 ExpressionStatement::ExpressionStatement(Token::Token token)
-  : m_token(std::move(token)) {};
-std::string ExpressionStatement::TokenLiteral() { return m_token.Literal; }
-
-std::string ExpressionStatement::String() {
-  if (m_expression != nullptr) {
-    return m_expression->String();
-  }
-  return "";
+  : IStatement(StaticType), m_token(std::move(token)) {};
+std::string ExpressionStatement::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Block Statement Stuff
 BlockStatement::BlockStatement(Token::Token token)
-  : m_token(std::move(token)) {};
-
-std::string BlockStatement::TokenLiteral() { return m_token.Literal; }
+  : IStatement(StaticType), m_token(std::move(token)) {};
 
-std::string BlockStatement::String() {
-  std::string out;
-  for (auto &statement : this->m_statements) {
-    out.append(statement->String());
-  }
-  return out;
+std::string BlockStatement::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Function Literal Stuff
 FunctionLiteral::FunctionLiteral(Token::Token token)
-  : m_token(std::move(token)) {};
-
-std::string FunctionLiteral::String() {
-  std::string out;
-  std::vector<std::string> params;
-  params.reserve(this->m_parameters.size());
-  for (auto &str : this->m_parameters) {
-    params.push_back(str->String());
-  }
-  out.append(this->TokenLiteral());
-  out.append("(");
-  out.append(Helpers::combineVecStrWithDelim(params, ", "));
-  out.append(") ");
-  out.append(this->m_body->String());
-  return out;
-}
+  : IExpression(StaticType), m_token(std::move(token)) {};
 
-std::string FunctionLiteral::TokenLiteral() { return m_token.Literal; }
+std::string FunctionLiteral::TokenLiteral() {
+  return std::string(m_token.Literal);
+}
 
 // Call Expression Stuff
 CallExpression::CallExpression(Token::Token token,
                                std::unique_ptr<IExpression> function)
-  : m_token(std::move(token)), m_function(std::move(function)) {}
-
-std::string CallExpression::String() {
-  std::string out;
-  std::vector<std::string> arguments;
-  arguments.reserve(this->m_arguments.size());
-  for (auto &str : this->m_arguments) {
-    arguments.push_back(str->String());
-  }
-  out.append(this->m_function->String());
-  out.append("(");
-  out.append(Helpers::combineVecStrWithDelim(arguments, ", "));
-  out.append(")");
-  return out;
-}
+  : IExpression(StaticType), m_token(std::move(token)),
+    m_function(std::move(function)) {}
 
-std::string CallExpression::TokenLiteral() { return m_token.Literal; }
+std::string CallExpression::TokenLiteral() {
+  return std::string(m_token.Literal);
+}
 
 // String Expression stuff
 StringLiteral::StringLiteral(Token::Token token, std::string value)
-  : m_token(std::move(token)), m_value(std::move(value)) {}
-std::string StringLiteral::TokenLiteral() { return this->m_token.Literal; }
-std::string StringLiteral::String() { return this->m_token.Literal; }
+  : IExpression(StaticType), m_token(std::move(token)),
+    m_value(std::move(value)) {}
+std::string StringLiteral::TokenLiteral() {
+  return std::string(m_token.Literal);
+}
 
 // ArrayLiteral stuff
-ArrayLiteral::ArrayLiteral(Token::Token token) : m_token(std::move(token)) {}
-std::string ArrayLiteral::TokenLiteral() { return this->m_token.Literal; }
-std::string ArrayLiteral::String() {
-  std::string out;
-  std::vector<std::string> elements;
-  elements.reserve(this->m_elements.size());
-  for (auto &str : this->m_elements) {
-    elements.push_back(str->String());
-  }
-  out.append("[");
-  out.append(Helpers::combineVecStrWithDelim(elements, ", "));
-  out.append("]");
-  return out;
+ArrayLiteral::ArrayLiteral(Token::Token token)
+  : IExpression(StaticType), m_token(std::move(token)) {}
+std::string ArrayLiteral::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // Hash Stuff
-HashLiteral::HashLiteral(Token::Token token) : m_token(std::move(token)) {}
-std::string HashLiteral::TokenLiteral() { return this->m_token.Literal; };
-std::string HashLiteral::String() {
-  std::string out;
-  std::vector<std::string> pairs;
-  pairs.reserve(this->m_pairs.size());
-  for (const auto &pair : this->m_pairs) {
-    pairs.emplace_back(std::format("{}:{}", pair.first.get()->String(),
-                                   pair.second.get()->String()));
-  }
-
-  out.append("{");
-  out.append(Helpers::combineVecStrWithDelim(pairs, ","));
-  out.append("}");
-  return out;
+HashLiteral::HashLiteral(Token::Token token)
+  : IExpression(StaticType), m_token(std::move(token)) {}
+std::string HashLiteral::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
 
 // IndexExpression Stuff
 IndexExpression::IndexExpression(Token::Token token,
                                  std::unique_ptr<IExpression> left)
-  : m_token(std::move(token)), m_left(std::move(left)) {}
-std::string IndexExpression::TokenLiteral() { return this->m_token.Literal; }
-std::string IndexExpression::String() {
-  std::string out;
-  out.append("(");
-  out.append(this->m_left.get()->String());
-  out.append("[");
-  out.append(this->m_index.get()->String());
-  out.append("])");
-  return out;
+  : IExpression(StaticType), m_token(std::move(token)),
+    m_left(std::move(left)) {}
+std::string IndexExpression::TokenLiteral() {
+  return std::string(m_token.Literal);
 }
+
+// Printing stuff
+namespace {
+class Printer : public Visitor<Printer, std::string> {
+public:
+  std::string Visit(Program *program) {
+    std::string out;
+    for (auto const &s : program->m_statements) {
+      out.append(Dispatch(s.get()));
+    }
+    return out;
+  }
+
+  static std::string Visit(Identifier *ident) {
+    return std::string(ident->Name());
+  }
+
+  static std::string Visit(IntegerLiteral *integer) {
+    return std::string(integer->m_token.Literal);
+  }
+
+  std::string Visit(PrefixExpression *prefix) {
+    std::string out;
+    out.append("(");
+    out.append(prefix->m_op);
+    out.append(Dispatch(prefix->m_right.get()));
+    out.append(")");
+    return out;
+  }
+
+  std::string Visit(InfixExpression *infix) {
+    std::string out;
+    out.append("(");
+    out.append(Dispatch(infix->m_left.get()));
+    out.append(" " + infix->m_op + " ");
+    out.append(Dispatch(infix->m_right.get()));
+    out.append(")");
+    return out;
+  }
+
+  static std::string Visit(Boolean *boolean) {
+    return std::string(boolean->m_token.Literal);
+  }
+
+  std::string Visit(IfExpression *ifExpr) {
+    std::string out;
+    out.append("if");
+    out.append(Dispatch(ifExpr->m_condition.get()));
+    out.append(" ");
+    out.append(Dispatch(ifExpr->m_consequence.get()));
+    if (ifExpr->m_alternative != nullptr) {
+      out.append("else");
+      out.append(Dispatch(ifExpr->m_alternative.get()));
+    }
+    return out;
+  }
+
+  std::string Visit(LetStatement *letStmt) {
+    std::string out;
+    out.append(letStmt->TokenLiteral());
+    out.append(" ");
+    out.append(Dispatch(letStmt->m_name.get()));
+    out.append(" = ");
+    if (letStmt->m_expression != nullptr) {
+      out.append(Dispatch(letStmt->m_expression.get()));
+    }
+    out.append(";");
+    return out;
+  }
+
+  std::string Visit(ReturnStatement *returnStmt) {
+    std::string out;
+    out.append(returnStmt->TokenLiteral());
+    out.append(" ");
+    if (returnStmt->m_returnValue != nullptr) {
+      out.append(Dispatch(returnStmt->m_returnValue.get()));
+    }
+    out.append(";");
+    return out;
+  }
+
+  std::string Visit(ExpressionStatement *exprStmt) {
+    if (exprStmt->m_expression != nullptr) {
+      return Dispatch(exprStmt->m_expression.get());
+    }
+    return "";
+  }
+
+  std::string Visit(BlockStatement *block) {
+    std::string out;
+    for (auto &statement : block->m_statements) {
+      out.append(Dispatch(statement.get()));
+    }
+    return out;
+  }
+
+  std::string Visit(FunctionLiteral *fun) {
+    std::string out;
+    std::vector<std::string> params;
+    params.reserve(fun->m_parameters.size());
+    for (auto &param : fun->m_parameters) {
+      params.push_back(Dispatch(param.get()));
+    }
+    out.append(fun->TokenLiteral());
+    out.append("(");
+    out.append(Helpers::combineVecStrWithDelim(params, ", "));
+    out.append(") ");
+    out.append(Dispatch(fun->m_body.get()));
+    return out;
+  }
+
+  std::string Visit(CallExpression *callExpr) {
+    std::string out;
+    std::vector<std::string> arguments;
+    arguments.reserve(callExpr->m_arguments.size());
+    for (auto &arg : callExpr->m_arguments) {
+      arguments.push_back(Dispatch(arg.get()));
+    }
+    out.append(Dispatch(callExpr->m_function.get()));
+    out.append("(");
+    out.append(Helpers::combineVecStrWithDelim(arguments, ", "));
+    out.append(")");
+    return out;
+  }
+
+  static std::string Visit(StringLiteral *strLit) {
+    return std::string(strLit->m_token.Literal);
+  }
+
+  std::string Visit(ArrayLiteral *arrLit) {
+    std::string out;
+    std::vector<std::string> elements;
+    elements.reserve(arrLit->m_elements.size());
+    for (auto &element : arrLit->m_elements) {
+      elements.push_back(Dispatch(element.get()));
+    }
+    out.append("[");
+    out.append(Helpers::combineVecStrWithDelim(elements, ", "));
+    out.append("]");
+    return out;
+  }
+
+  std::string Visit(HashLiteral *hashLit) {
+    std::string out;
+    std::vector<std::string> pairs;
+    pairs.reserve(hashLit->m_pairs.size());
+    for (const auto &pair : hashLit->m_pairs) {
+      pairs.emplace_back(std::format("{}:{}", Dispatch(pair.first.get()),
+                                     Dispatch(pair.second.get())));
+    }
+
+    out.append("{");
+    out.append(Helpers::combineVecStrWithDelim(pairs, ","));
+    out.append("}");
+    return out;
+  }
+
+  std::string Visit(IndexExpression *idxExp) {
+    std::string out;
+    out.append("(");
+    out.append(Dispatch(idxExp->m_left.get()));
+    out.append("[");
+    out.append(Dispatch(idxExp->m_index.get()));
+    out.append("])");
+    return out;
+  }
+};
+} // namespace
+
+std::string INode::String() { return Printer().Dispatch(this); }
+
+namespace {
+class Locator : public Visitor<Locator, Token::Offset> {
+public:
+  Token::Offset Visit(Program *program) {
+    return program->m_statements.empty()
+             ? 0
+             : Dispatch(program->m_statements.front().get());
+  }
+  template <typename Node> Token::Offset Visit(Node *node) {
+    return node->m_token.Start;
+  }
+};
+} // namespace
+
+Token::Offset OffsetOf(INode *node) { return Locator().Dispatch(node); }
 } // namespace Ast
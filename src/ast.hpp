@@ -1,8 +1,16 @@
 #pragma once
+#include "arena.hpp"
+#include "symbols.hpp"
 #include "token.hpp"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace Ast {
@@ -30,107 +38,193 @@ enum class Type : std::uint8_t {
   HASH_EXPRESSION
 };
 
+// Operators of prefix and infix expressions, resolved by the parser so
+// nothing has to look at the operator's text again
+enum class Operator : std::uint8_t {
+  ILLEGAL,
+  PLUS,
+  MINUS,
+  BANG,
+  ASTERISK,
+  SLASH,
+  LT,
+  GT,
+  EQ,
+  NOT_EQ,
+};
+
+// for tables indexed by Operator, NOT_EQ has to stay the last one
+constexpr std::size_t OperatorCount =
+  static_cast<std::size_t>(Operator::NOT_EQ) + 1;
+
+Operator OperatorOf(Token::TokenType type);
+std::string_view OperatorString(Operator op);
+
+// The variables of one scope in slot order. Filled in by the resolver and
+// shared with every Environment created for that scope.
+struct ScopeLayout {
+  std::vector<Symbols::Symbol> m_names;
+  std::unordered_map<Symbols::Symbol, int> m_slots;
+  // a function literal is nested in this scope, so environments made for it
+  // can outlive their call
+  bool m_captured = false;
+
+  int Declare(Symbols::Symbol name);
+  // -1 if the name is not declared in this scope
+  [[nodiscard]] int Find(Symbols::Symbol name) const;
+
+  // Goes up whenever a name is declared in any scope on this thread, never
+  // 0. Inline caches that depend on no closer binding of a name appearing
+  // are only good for the generation they were filled in.
+  static std::size_t Generation();
+};
+
+// Where an identifier the resolver couldn't give a usable address was last
+// found at runtime, filled in and used by Evaluator::lookupIdentifier
+struct LookupCache {
+  std::size_t m_generation = 0;
+  // the scope of the environment the lookup started in
+  const ScopeLayout *m_origin = nullptr;
+  // the scope of the environment it was bound in, m_depth up the chain
+  const ScopeLayout *m_layout = nullptr;
+  int m_depth = -1;
+  int m_slot = -1;
+  // index into Builtins::builtinList when it was a builtin
+  int m_builtin = -1;
+};
+
+// Child lists live in the same arena as the nodes that own them
+template <typename T>
+using NodeList =
+  std::vector<std::unique_ptr<T>, ArenaAllocator<std::unique_ptr<T>>>;
+
 struct INode {
+  // Nodes are placed in the current arena while a program is being parsed
+  // and on the heap otherwise. Deleting an arena node only runs its
+  // destructor, the memory goes back with the arena.
+  static void *operator new(std::size_t size);
+  static void operator delete(void *ptr);
+
+  explicit INode(enum Type type) : m_type(type) {}
   virtual ~INode() = default;
   virtual std::string TokenLiteral() = 0;
-  virtual std::string String() = 0;
-  virtual Type Type() = 0;
+  // printed by a visitor, see Visitor
+  std::string String();
+  // A plain tag rather than a virtual call or RTTI, As and Cast downcast
+  // by it
+  [[nodiscard]] enum Type Type() const { return m_type; }
+
+private:
+  enum Type m_type;
 };
 
 struct IStatement : public INode {
+  using INode::INode;
   virtual void statementNode() = 0;
   ~IStatement() override = default;
-  enum Type Type() override = 0;
 };
 
 struct IExpression : public INode {
+  using INode::INode;
   virtual void expressionNode() = 0;
   ~IExpression() override = default;
-  enum Type Type() override = 0;
 };
 
 struct Program : public INode {
+  static constexpr enum Type StaticType = Ast::Type::PROGRAM;
+  // the text the tokens in the tree point into
+  std::shared_ptr<const Token::Source> m_source;
+  // declared first so it outlives the nodes it holds
+  std::shared_ptr<Arena> m_arena;
   std::vector<std::unique_ptr<IStatement>> m_statements;
+
+  Program();
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 // the x in "let x = 5;". also the x in "let a = x;:"
 struct Identifier : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::IDENTIFIER;
   Token::Token m_token;
-  std::string m_value;
-
-  Identifier(Token::Token token, std::string value);
+  Symbols::Symbol m_symbol;
+  // Lexical address set by the resolver, m_depth is -1 when unresolved
+  int m_depth = -1;
+  int m_slot = -1;
+  // Index into Builtins::builtinList when no scope declared the name as it
+  // was resolved, -1 otherwise. A let run later (the next line in the REPL)
+  // can still shadow the builtin, so the scopes are searched first.
+  int m_builtin = -1;
+  LookupCache m_cache;
+
+  Identifier(Token::Token token, Symbols::Symbol symbol);
   std::string TokenLiteral() override;
+  [[nodiscard]] std::string_view Name() const {
+    return Symbols::Name(m_symbol);
+  }
   void expressionNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct IntegerLiteral : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::INTEGER_LITERAL;
   Token::Token m_token;
   long int m_value;
 
   IntegerLiteral(Token::Token token, long int value);
   std::string TokenLiteral() override;
   void expressionNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct PrefixExpression : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::PREFIX_EXPRESSION;
   Token::Token m_token;
   std::string m_op;
+  Operator m_operator;
   std::unique_ptr<IExpression> m_right;
 
   PrefixExpression(Token::Token t, std::string op);
   std::string TokenLiteral() override;
   void expressionNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct InfixExpression : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::INFIX_EXPRESSION;
   Token::Token m_token;
   std::unique_ptr<IExpression> m_left;
   std::string m_op;
+  Operator m_operator;
   std::unique_ptr<IExpression> m_right;
 
   InfixExpression(Token::Token t, std::unique_ptr<IExpression> left,
                   std::string op);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct Boolean : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::BOOLEAN;
   Token::Token m_token;
   bool m_value;
 
   Boolean(Token::Token token, bool value);
   std::string TokenLiteral() override;
   void expressionNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 // Unhappy I need to order this way. Might be better to have seperate files for
 // each class, but I am trying to follow the example to the best of my
 // abilities.
 struct BlockStatement : public IStatement {
+  static constexpr enum Type StaticType = Ast::Type::BLOCK_STATEMENT;
   Token::Token m_token;
-  std::vector<std::unique_ptr<IStatement>> m_statements;
+  NodeList<IStatement> m_statements;
 
   explicit BlockStatement(Token::Token token);
   std::string TokenLiteral() override;
   void statementNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct IfExpression : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::IF_EXPRESSION;
   Token::Token m_token;
   std::unique_ptr<IExpression> m_condition;
   std::unique_ptr<BlockStatement> m_consequence;
@@ -139,11 +233,10 @@ struct IfExpression : public IExpression {
   explicit IfExpression(Token::Token token);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct LetStatement : public IStatement {
+  static constexpr enum Type StaticType = Ast::Type::LET_STATEMENT;
   Token::Token m_token;
   std::unique_ptr<Identifier> m_name;
   std::unique_ptr<IExpression> m_expression;
@@ -152,22 +245,20 @@ struct LetStatement : public IStatement {
 
   std::string TokenLiteral() override;
   void statementNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct ReturnStatement : public IStatement {
+  static constexpr enum Type StaticType = Ast::Type::RETURN_STATEMENT;
   Token::Token m_token;
   std::unique_ptr<IExpression> m_returnValue;
 
   explicit ReturnStatement(Token::Token token);
   std::string TokenLiteral() override;
   void statementNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct ExpressionStatement : public IStatement {
+  static constexpr enum Type StaticType = Ast::Type::EXPRESSION_STATEMENT;
   Token::Token m_token;
   std::unique_ptr<IExpression> m_expression;
 
@@ -175,57 +266,60 @@ struct ExpressionStatement : public IStatement {
 
   std::string TokenLiteral() override;
   void statementNode() override {};
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct FunctionLiteral : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::FUNCTION_LITERAL;
   Token::Token m_token;
-  std::vector<std::unique_ptr<Identifier>> m_parameters;
-  std::unique_ptr<BlockStatement> m_body;
+  NodeList<Identifier> m_parameters;
+  // shared with the functions made from the literal, which can outlive the
+  // Program. Nodes are destroyed with their owner even when the memory is
+  // in an arena.
+  std::shared_ptr<BlockStatement> m_body;
+  // parameters first, then every let in the body. Set by the resolver
+  std::shared_ptr<ScopeLayout> m_layout;
 
   explicit FunctionLiteral(Token::Token token);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct CallExpression : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::CALL_EXPRESSION;
   Token::Token m_token;                    // the '(' token
   std::unique_ptr<IExpression> m_function; // Identifier or FunctionLiteral
-  std::vector<std::unique_ptr<IExpression>> m_arguments;
+  NodeList<IExpression> m_arguments;
+  // Object::FunctionPrototype::m_id of the function the last call here went
+  // to, 0 before one did. Its arity was checked then, see applyFunction.
+  std::uint64_t m_callee = 0;
 
   CallExpression(Token::Token token, std::unique_ptr<IExpression> function);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct StringLiteral : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::STRING_LITERAL;
   Token::Token m_token;
   std::string m_value;
 
   explicit StringLiteral(Token::Token token, std::string m_value);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct ArrayLiteral : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::ARRAY_LITERAL;
   Token::Token m_token;
-  std::vector<std::unique_ptr<IExpression>> m_elements;
+  NodeList<IExpression> m_elements;
 
   explicit ArrayLiteral(Token::Token token);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct IndexExpression : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::INDEX_EXPRESSION;
   Token::Token m_token;
   std::unique_ptr<IExpression> m_left;
   std::unique_ptr<IExpression> m_index;
@@ -234,20 +328,100 @@ struct IndexExpression : public IExpression {
                            std::unique_ptr<Ast::IExpression> left);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
 };
 
 struct HashLiteral : public IExpression {
+  static constexpr enum Type StaticType = Ast::Type::HASH_EXPRESSION;
+  using Pair =
+    std::pair<std::unique_ptr<IExpression>, std::unique_ptr<IExpression>>;
   Token::Token m_token;
-  std::unordered_map<std::unique_ptr<IExpression>, std::unique_ptr<IExpression>>
-    m_pairs;
+  // in the order they were written
+  std::vector<Pair, ArenaAllocator<Pair>> m_pairs;
 
   explicit HashLiteral(Token::Token token);
   void expressionNode() override {};
   std::string TokenLiteral() override;
-  std::string String() override;
-  enum Type Type() override;
+};
+
+// The arena a node was parsed into, nullptr for nodes built on the heap.
+// Anything that keeps part of the tree after the Program is gone has to
+// hold on to this.
+std::shared_ptr<Arena> ArenaOf(const INode *node);
+
+// Where the node's token starts in the program's Source, for an infix or
+// call that's its operator or (
+Token::Offset OffsetOf(INode *node);
+
+// The Source OffsetOf(node) is in, which outlives the Program for a node in
+// a function body. nullptr for a node that isn't in an arena.
+std::shared_ptr<const Token::Source> SourceOf(const INode *node);
+
+// Downcasts checked against the type tag instead of with dynamic_cast. As
+// gives nullptr when node is not a T, Cast is for callers that already
+// switched on Type().
+template <typename T> T *As(INode *node) {
+  if (node == nullptr || node->Type() != T::StaticType) {
+    return nullptr;
+  }
+  return static_cast<T *>(node);
+}
+
+template <typename T> T *Cast(INode *node) {
+  assert(node != nullptr && node->Type() == T::StaticType);
+  return static_cast<T *>(node);
+}
+
+// Static visitor. Derived has a Visit overload for every concrete node and
+// Dispatch calls it straight from the type tag, without virtual calls.
+//
+//   struct Counter : Ast::Visitor<Counter, int> {
+//     int Visit(Ast::IntegerLiteral *node) { return 1; }
+//     ...
+//   };
+template <typename Derived, typename Result> class Visitor {
+public:
+  Result Dispatch(INode *node) {
+    auto &self = static_cast<Derived &>(*this);
+    switch (node->Type()) {
+    case Type::PROGRAM:
+      return self.Visit(Cast<Program>(node));
+    case Type::IDENTIFIER:
+      return self.Visit(Cast<Identifier>(node));
+    case Type::INTEGER_LITERAL:
+      return self.Visit(Cast<IntegerLiteral>(node));
+    case Type::PREFIX_EXPRESSION:
+      return self.Visit(Cast<PrefixExpression>(node));
+    case Type::INFIX_EXPRESSION:
+      return self.Visit(Cast<InfixExpression>(node));
+    case Type::BOOLEAN:
+      return self.Visit(Cast<Boolean>(node));
+    case Type::BLOCK_STATEMENT:
+      return self.Visit(Cast<BlockStatement>(node));
+    case Type::IF_EXPRESSION:
+      return self.Visit(Cast<IfExpression>(node));
+    case Type::LET_STATEMENT:
+      return self.Visit(Cast<LetStatement>(node));
+    case Type::RETURN_STATEMENT:
+      return self.Visit(Cast<ReturnStatement>(node));
+    case Type::EXPRESSION_STATEMENT:
+      return self.Visit(Cast<ExpressionStatement>(node));
+    case Type::FUNCTION_LITERAL:
+      return self.Visit(Cast<FunctionLiteral>(node));
+    case Type::CALL_EXPRESSION:
+      return self.Visit(Cast<CallExpression>(node));
+    case Type::STRING_LITERAL:
+      return self.Visit(Cast<StringLiteral>(node));
+    case Type::ARRAY_LITERAL:
+      return self.Visit(Cast<ArrayLiteral>(node));
+    case Type::INDEX_EXPRESSION:
+      return self.Visit(Cast<IndexExpression>(node));
+    case Type::HASH_EXPRESSION:
+      return self.Visit(Cast<HashLiteral>(node));
+    default:
+      // only the concrete nodes above are ever constructed
+      std::abort();
+    }
+  }
 };
 
 } // namespace Ast
@@ -1,10 +1,10 @@
 #include "builtins.hpp"
 #include "evaluator.hpp"
 #include "format"
+#include <span>
 namespace Builtins {
 
-static std::shared_ptr<Object::IObject>
-len(const std::vector<std::shared_ptr<Object::IObject>> &args) {
+static Object::Value len(std::span<const Object::Value> args) {
   if (std::ssize(args) != 1) {
     return Evaluator::Evaluator::newError(std::format(
       "wrong number of arguments. got={}. want=1", std::ssize(args)));
@@ -12,12 +12,12 @@ len(const std::vector<std::shared_ptr<Object::IObject>> &args) {
 
   switch (args[0].get()->Type()) {
   case Object::ObjectType::STRING_OBJ: {
-    auto *strObj = dynamic_cast<Object::String *>(args[0].get());
-    return std::make_shared<Object::Integer>(std::ssize(strObj->m_value));
+    auto *strObj = static_cast<Object::String *>(args[0].get());
+    return Object::Value::Int(static_cast<long>(strObj->Length()));
   }
   case Object::ObjectType::ARRAY_OBJ: {
-    auto *arrObj = dynamic_cast<Object::Array *>(args[0].get());
-    return std::make_shared<Object::Integer>(std::ssize(arrObj->m_elements));
+    auto *arrObj = static_cast<Object::Array *>(args[0].get());
+    return Object::Value::Int(std::ssize(arrObj->m_elements));
   }
   default: {
     return Evaluator::Evaluator::newError(
@@ -27,8 +27,7 @@ len(const std::vector<std::shared_ptr<Object::IObject>> &args) {
   }
 }
 
-static std::shared_ptr<Object::IObject>
-first(const std::vector<std::shared_ptr<Object::IObject>> &args) {
+static Object::Value first(std::span<const Object::Value> args) {
   if (std::ssize(args) != 1) {
     return Evaluator::Evaluator::newError(std::format(
       "wrong number of arguments. got={}. want=1", std::ssize(args)));
@@ -38,7 +37,7 @@ first(const std::vector<std::shared_ptr<Object::IObject>> &args) {
       std::format("argument to first must be an ARRAY, got {}",
                   Object::objectTypeToStr(args[0].get()->Type())));
   }
-  auto arr = dynamic_cast<Object::Array *>(args[0].get());
+  auto arr = static_cast<Object::Array *>(args[0].get());
   auto length = std::ssize(arr->m_elements);
   if (length > 0) {
     return arr->m_elements[0];
@@ -46,8 +45,7 @@ first(const std::vector<std::shared_ptr<Object::IObject>> &args) {
   return Evaluator::NULL_O;
 }
 
-static std::shared_ptr<Object::IObject>
-last(const std::vector<std::shared_ptr<Object::IObject>> &args) {
+static Object::Value last(std::span<const Object::Value> args) {
   if (std::ssize(args) != 1) {
     return Evaluator::Evaluator::newError(std::format(
       "wrong number of arguments. got={}. want=1", std::ssize(args)));
@@ -57,7 +55,7 @@ last(const std::vector<std::shared_ptr<Object::IObject>> &args) {
       std::format("argument to first must be an ARRAY, got {}",
                   Object::objectTypeToStr(args[0].get()->Type())));
   }
-  auto arr = dynamic_cast<Object::Array *>(args[0].get());
+  auto arr = static_cast<Object::Array *>(args[0].get());
   auto length = std::ssize(arr->m_elements);
   if (length > 0) {
     return arr->m_elements[static_cast<unsigned long>(length - 1)];
@@ -65,8 +63,7 @@ last(const std::vector<std::shared_ptr<Object::IObject>> &args) {
   return Evaluator::NULL_O;
 }
 
-static std::shared_ptr<Object::IObject>
-rest(const std::vector<std::shared_ptr<Object::IObject>> &args) {
+static Object::Value rest(std::span<const Object::Value> args) {
   if (std::ssize(args) != 1) {
     return Evaluator::Evaluator::newError(std::format(
       "wrong number of arguments. got={}. want=1", std::ssize(args)));
@@ -77,17 +74,14 @@ rest(const std::vector<std::shared_ptr<Object::IObject>> &args) {
                   Object::objectTypeToStr(args[0].get()->Type())));
   }
 
-  auto arr = dynamic_cast<Object::Array *>(args[0].get());
-  if (std::ssize(arr->m_elements) > 0) {
-    std::vector<std::shared_ptr<Object::IObject>> deepCopy(
-      arr->m_elements.begin() + 1, arr->m_elements.end());
-    return std::make_shared<Object::Array>(deepCopy);
+  auto arr = static_cast<Object::Array *>(args[0].get());
+  if (!arr->m_elements.empty()) {
+    return Object::New<Object::Array>(arr->m_elements.Rest());
   }
   return Evaluator::NULL_O;
 }
 
-static std::shared_ptr<Object::IObject>
-push(const std::vector<std::shared_ptr<Object::IObject>> &args) {
+static Object::Value push(std::span<const Object::Value> args) {
   if (std::ssize(args) != 2) {
     return Evaluator::Evaluator::newError(std::format(
       "wrong number of arguments. got={}. want=1", std::ssize(args)));
@@ -98,19 +92,33 @@ push(const std::vector<std::shared_ptr<Object::IObject>> &args) {
                   Object::objectTypeToStr(args[0].get()->Type())));
   }
 
-  auto arr = dynamic_cast<Object::Array *>(args[0].get());
+  auto arr = static_cast<Object::Array *>(args[0].get());
 
-  std::vector<std::shared_ptr<Object::IObject>> deepCopy(
-    arr->m_elements.begin(), arr->m_elements.end());
-  deepCopy.push_back(args[1]);
-  return std::make_shared<Object::Array>(deepCopy);
+  return Object::New<Object::Array>(arr->m_elements.Push(args[1]));
 }
 
-std::unordered_map<std::string, std::shared_ptr<Object::Builtin>> builtins = {
-  {"len", std::make_shared<Object::Builtin>(len)},
-  {"first", std::make_shared<Object::Builtin>(first)},
-  {"last", std::make_shared<Object::Builtin>(last)},
-  {"rest", std::make_shared<Object::Builtin>(rest)},
-  {"push", std::make_shared<Object::Builtin>(push)},
+const std::vector<BuiltinDef> builtinList = {
+  {.name = Symbols::Intern("len"),
+   .builtin = std::make_shared<Object::Builtin>(len)},
+  {.name = Symbols::Intern("first"),
+   .builtin = std::make_shared<Object::Builtin>(first)},
+  {.name = Symbols::Intern("last"),
+   .builtin = std::make_shared<Object::Builtin>(last)},
+  {.name = Symbols::Intern("rest"),
+   .builtin = std::make_shared<Object::Builtin>(rest)},
+  {.name = Symbols::Intern("push"),
+   .builtin = std::make_shared<Object::Builtin>(push)},
 };
+
+static std::unordered_map<Symbols::Symbol, std::shared_ptr<Object::Builtin>>
+vecToBuiltinMap() {
+  std::unordered_map<Symbols::Symbol, std::shared_ptr<Object::Builtin>> map;
+  for (const auto &def : builtinList) {
+    map[def.name] = def.builtin;
+  }
+  return map;
+}
+
+std::unordered_map<Symbols::Symbol, std::shared_ptr<Object::Builtin>>
+  builtins = vecToBuiltinMap();
 } // namespace Builtins
@@ -1,7 +1,16 @@
 #pragma once
 #include "object.hpp"
 #include <unordered_map>
+#include <vector>
 namespace Builtins {
-extern std::unordered_map<std::string, std::shared_ptr<Object::Builtin>>
+struct BuiltinDef {
+  Symbols::Symbol name;
+  std::shared_ptr<Object::Builtin> builtin;
+};
+
+// Ordered so the compiler can refer to builtins by index
+extern const std::vector<BuiltinDef> builtinList;
+
+extern std::unordered_map<Symbols::Symbol, std::shared_ptr<Object::Builtin>>
   builtins;
-}
+} // namespace Builtins
@@ -0,0 +1,79 @@
+#include "code.hpp"
+#include <format>
+namespace Code {
+
+const Definition *Lookup(std::uint8_t op) {
+  if (op >= definitions.size()) {
+    return nullptr;
+  }
+  return &definitions[op];
+}
+
+Instructions Make(Opcode op, const std::vector<int> &operands) {
+  const Definition *def = Lookup(op);
+  if (def == nullptr) {
+    return {};
+  }
+
+  Instructions instruction;
+  instruction.push_back(op);
+  for (size_t i = 0; i < def->OperandWidths.size() && i < operands.size();
+       i++) {
+    auto operand = static_cast<unsigned int>(operands[i]);
+    switch (def->OperandWidths[i]) {
+    case 2:
+      instruction.push_back(static_cast<std::uint8_t>((operand >> 8) & 0xFF));
+      instruction.push_back(static_cast<std::uint8_t>(operand & 0xFF));
+      break;
+    case 1:
+      instruction.push_back(static_cast<std::uint8_t>(operand & 0xFF));
+      break;
+    default:
+      break;
+    }
+  }
+  return instruction;
+}
+
+ReadResult ReadOperands(const Definition &def, const Instructions &ins,
+                        size_t offset) {
+  ReadResult result{.operands = {}, .bytesRead = 0};
+  for (int width : def.OperandWidths) {
+    auto at = offset + static_cast<size_t>(result.bytesRead);
+    switch (width) {
+    case 2:
+      result.operands.push_back(ReadUint16(ins, at));
+      break;
+    case 1:
+      result.operands.push_back(ReadUint8(ins, at));
+      break;
+    default:
+      break;
+    }
+    result.bytesRead += width;
+  }
+  return result;
+}
+
+std::string String(const Instructions &ins) {
+  std::string out;
+  size_t i = 0;
+  while (i < ins.size()) {
+    const Definition *def = Lookup(ins[i]);
+    if (def == nullptr) {
+      out.append(std::format("ERROR: unknown opcode {}\n", ins[i]));
+      i++;
+      continue;
+    }
+    auto read = ReadOperands(*def, ins, i + 1);
+    out.append(std::format("{:04} {}", i, def->Name));
+    for (int operand : read.operands) {
+      out.append(std::format(" {}", operand));
+    }
+    out.append("\n");
+    i += 1 + static_cast<size_t>(read.bytesRead);
+  }
+  return out;
+}
+
+} // namespace Code
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+namespace Code {
+
+using Instructions = std::vector<std::uint8_t>;
+
+enum Opcode : std::uint8_t {
+  OpConstant,
+  OpAdd,
+  OpSub,
+  OpMul,
+  OpDiv,
+  OpPop,
+  OpTrue,
+  OpFalse,
+  OpNull,
+  OpEqual,
+  OpNotEqual,
+  OpGreaterThan,
+  OpLessThan,
+  OpMinus,
+  OpBang,
+  OpJumpNotTruthy,
+  OpJump,
+  OpGetGlobal,
+  OpSetGlobal,
+  OpGetLocal,
+  OpSetLocal,
+  OpGetFree,
+  OpCurrentClosure,
+  OpArray,
+  OpHash,
+  OpIndex,
+  OpCall,
+  OpReturnValue,
+  OpReturn,
+  OpClosure,
+  // a call whose value the function returns right away, see Compiler
+  OpTailCall,
+};
+
+struct Definition {
+  std::string Name;
+  std::vector<int> OperandWidths;
+};
+
+// Indexed by Opcode
+const std::vector<Definition> definitions = {
+  {.Name = "OpConstant", .OperandWidths = {2}},
+  {.Name = "OpAdd", .OperandWidths = {}},
+  {.Name = "OpSub", .OperandWidths = {}},
+  {.Name = "OpMul", .OperandWidths = {}},
+  {.Name = "OpDiv", .OperandWidths = {}},
+  {.Name = "OpPop", .OperandWidths = {}},
+  {.Name = "OpTrue", .OperandWidths = {}},
+  {.Name = "OpFalse", .OperandWidths = {}},
+  {.Name = "OpNull", .OperandWidths = {}},
+  {.Name = "OpEqual", .OperandWidths = {}},
+  {.Name = "OpNotEqual", .OperandWidths = {}},
+  {.Name = "OpGreaterThan", .OperandWidths = {}},
+  {.Name = "OpLessThan", .OperandWidths = {}},
+  {.Name = "OpMinus", .OperandWidths = {}},
+  {.Name = "OpBang", .OperandWidths = {}},
+  {.Name = "OpJumpNotTruthy", .OperandWidths = {2}},
+  {.Name = "OpJump", .OperandWidths = {2}},
+  {.Name = "OpGetGlobal", .OperandWidths = {2}},
+  {.Name = "OpSetGlobal", .OperandWidths = {2}},
+  {.Name = "OpGetLocal", .OperandWidths = {1}},
+  {.Name = "OpSetLocal", .OperandWidths = {1}},
+  {.Name = "OpGetFree", .OperandWidths = {1}},
+  {.Name = "OpCurrentClosure", .OperandWidths = {}},
+  {.Name = "OpArray", .OperandWidths = {2}},
+  {.Name = "OpHash", .OperandWidths = {2}},
+  {.Name = "OpIndex", .OperandWidths = {}},
+  {.Name = "OpCall", .OperandWidths = {1}},
+  {.Name = "OpReturnValue", .OperandWidths = {}},
+  {.Name = "OpReturn", .OperandWidths = {}},
+  {.Name = "OpClosure", .OperandWidths = {2, 1}},
+  {.Name = "OpTailCall", .OperandWidths = {1}},
+};
+
+const Definition *Lookup(std::uint8_t op);
+
+// Encode a single instruction. Operands are stored big endian.
+Instructions Make(Opcode op, const std::vector<int> &operands = {});
+
+struct ReadResult {
+  std::vector<int> operands;
+  int bytesRead;
+};
+ReadResult ReadOperands(const Definition &def, const Instructions &ins,
+                        size_t offset);
+
+inline int ReadUint16(const Instructions &ins, size_t offset) {
+  return (ins[offset] << 8) | ins[offset + 1];
+}
+
+inline int ReadUint8(const Instructions &ins, size_t offset) {
+  return ins[offset];
+}
+
+// Human readable disassembly, one instruction per line
+std::string String(const Instructions &ins);
+
+} // namespace Code
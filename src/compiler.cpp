@@ -0,0 +1,447 @@
+#include "compiler.hpp"
+#include "ast.hpp"
+#include "code.hpp"
+#include "object.hpp"
+#include <format>
+#include <memory>
+#include <utility>
+namespace Compiler {
+
+State NewState() {
+  return {.symbolTable = std::make_shared<SymbolTable>(), .constants = {}};
+}
+
+Compiler::Compiler() : Compiler(NewState()) {}
+
+Compiler::Compiler(State state)
+  : m_constants(std::move(state.constants)),
+    m_symbolTable(std::move(state.symbolTable)) {
+  m_scopes.push_back({});
+}
+
+bool Compiler::Compile(Ast::INode *node) {
+  if (node == nullptr) {
+    return true;
+  }
+
+  switch (node->Type()) {
+  case Ast::Type::PROGRAM: {
+    auto *program = Ast::Cast<Ast::Program>(node);
+    predeclareGlobals(program);
+    return compileStatements(program->m_statements);
+  }
+  case Ast::Type::EXPRESSION_STATEMENT: {
+    auto *exprStmt = Ast::Cast<Ast::ExpressionStatement>(node);
+    if (!Compile(exprStmt->m_expression.get())) {
+      return false;
+    }
+    emit(Code::OpPop);
+    return true;
+  }
+  case Ast::Type::BLOCK_STATEMENT: {
+    auto *block = Ast::Cast<Ast::BlockStatement>(node);
+    return compileStatements(block->m_statements);
+  }
+  case Ast::Type::INTEGER_LITERAL: {
+    auto *integer = Ast::Cast<Ast::IntegerLiteral>(node);
+    emit(Code::OpConstant, {addConstant(Object::Value::Int(integer->m_value))});
+    return true;
+  }
+  case Ast::Type::STRING_LITERAL: {
+    auto *strLit = Ast::Cast<Ast::StringLiteral>(node);
+    emit(Code::OpConstant,
+         {addConstant(std::make_shared<Object::String>(strLit->m_value))});
+    return true;
+  }
+  case Ast::Type::BOOLEAN: {
+    auto *boolean = Ast::Cast<Ast::Boolean>(node);
+    emit(boolean->m_value ? Code::OpTrue : Code::OpFalse);
+    return true;
+  }
+  case Ast::Type::PREFIX_EXPRESSION: {
+    return compilePrefix(Ast::Cast<Ast::PrefixExpression>(node));
+  }
+  case Ast::Type::INFIX_EXPRESSION: {
+    return compileInfix(Ast::Cast<Ast::InfixExpression>(node));
+  }
+  case Ast::Type::IF_EXPRESSION: {
+    return compileIf(Ast::Cast<Ast::IfExpression>(node));
+  }
+  case Ast::Type::LET_STATEMENT: {
+    return compileLet(Ast::Cast<Ast::LetStatement>(node));
+  }
+  case Ast::Type::RETURN_STATEMENT: {
+    auto *returnStmt = Ast::Cast<Ast::ReturnStatement>(node);
+    if (!Compile(returnStmt->m_returnValue.get())) {
+      return false;
+    }
+    emit(Code::OpReturnValue);
+    return true;
+  }
+  case Ast::Type::IDENTIFIER: {
+    auto *ident = Ast::Cast<Ast::Identifier>(node);
+    // A name nothing defines yet is a global a later let (the next line in
+    // the repl) can still bind. Builtins are found that way too, so they
+    // can be shadowed the same as in the evaluator.
+    auto resolved = m_symbolTable->Resolve(ident->m_symbol);
+    loadSymbol(resolved.ok ? resolved.symbol
+                           : m_symbolTable->DefineGlobal(ident->m_symbol));
+    return true;
+  }
+  case Ast::Type::FUNCTION_LITERAL: {
+    return compileFunction(Ast::Cast<Ast::FunctionLiteral>(node),
+                           Symbols::NoSymbol);
+  }
+  case Ast::Type::CALL_EXPRESSION: {
+    auto *callExpr = Ast::Cast<Ast::CallExpression>(node);
+    if (!Compile(callExpr->m_function.get())) {
+      return false;
+    }
+    for (const auto &arg : callExpr->m_arguments) {
+      if (!Compile(arg.get())) {
+        return false;
+      }
+    }
+    emit(Code::OpCall, {static_cast<int>(callExpr->m_arguments.size())});
+    return true;
+  }
+  case Ast::Type::ARRAY_LITERAL: {
+    auto *arrLit = Ast::Cast<Ast::ArrayLiteral>(node);
+    for (const auto &element : arrLit->m_elements) {
+      if (!Compile(element.get())) {
+        return false;
+      }
+    }
+    emit(Code::OpArray, {static_cast<int>(arrLit->m_elements.size())});
+    return true;
+  }
+  case Ast::Type::HASH_EXPRESSION: {
+    // keys and values alternate on the stack, in source order
+    auto *hashLit = Ast::Cast<Ast::HashLiteral>(node);
+    for (const auto &[key, value] : hashLit->m_pairs) {
+      if (!Compile(key.get()) || !Compile(value.get())) {
+        return false;
+      }
+    }
+    emit(Code::OpHash, {static_cast<int>(hashLit->m_pairs.size() * 2)});
+    return true;
+  }
+  case Ast::Type::INDEX_EXPRESSION: {
+    auto *idxExp = Ast::Cast<Ast::IndexExpression>(node);
+    if (!Compile(idxExp->m_left.get()) || !Compile(idxExp->m_index.get())) {
+      return false;
+    }
+    emit(Code::OpIndex);
+    return true;
+  }
+  default:
+    return error(std::format("can not compile node: {}", node->String()));
+  }
+}
+
+bool Compiler::compileStatements(
+  std::span<std::unique_ptr<Ast::IStatement>> stmts) {
+  for (auto &statement : stmts) {
+    if (!Compile(statement.get())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Blocks used as expressions have to leave exactly one value on the stack
+bool Compiler::compileBlock(Ast::BlockStatement *block) {
+  if (!Compile(block)) {
+    return false;
+  }
+  if (lastInstructionIs(Code::OpPop)) {
+    removeLastPop();
+  } else {
+    emit(Code::OpNull);
+  }
+  return true;
+}
+
+bool Compiler::compilePrefix(Ast::PrefixExpression *prefix) {
+  if (!Compile(prefix->m_right.get())) {
+    return false;
+  }
+  switch (prefix->m_operator) {
+  case Ast::Operator::BANG:
+    emit(Code::OpBang);
+    break;
+  case Ast::Operator::MINUS:
+    emit(Code::OpMinus);
+    break;
+  default:
+    return error(std::format("unknown operator: {}", prefix->m_op));
+  }
+  return true;
+}
+
+bool Compiler::compileInfix(Ast::InfixExpression *infix) {
+  if (!Compile(infix->m_left.get()) || !Compile(infix->m_right.get())) {
+    return false;
+  }
+  switch (infix->m_operator) {
+  case Ast::Operator::PLUS:
+    emit(Code::OpAdd);
+    break;
+  case Ast::Operator::MINUS:
+    emit(Code::OpSub);
+    break;
+  case Ast::Operator::ASTERISK:
+    emit(Code::OpMul);
+    break;
+  case Ast::Operator::SLASH:
+    emit(Code::OpDiv);
+    break;
+  case Ast::Operator::GT:
+    emit(Code::OpGreaterThan);
+    break;
+  case Ast::Operator::LT:
+    emit(Code::OpLessThan);
+    break;
+  case Ast::Operator::EQ:
+    emit(Code::OpEqual);
+    break;
+  case Ast::Operator::NOT_EQ:
+    emit(Code::OpNotEqual);
+    break;
+  default:
+    return error(std::format("unknown operator: {}", infix->m_op));
+  }
+  return true;
+}
+
+bool Compiler::compileIf(Ast::IfExpression *ifExpr) {
+  if (!Compile(ifExpr->m_condition.get())) {
+    return false;
+  }
+  // placeholder offsets, patched once the branches are emitted
+  auto jumpNotTruthyPos = emit(Code::OpJumpNotTruthy, {9999});
+  if (!compileBlock(ifExpr->m_consequence.get())) {
+    return false;
+  }
+  auto jumpPos = emit(Code::OpJump, {9999});
+  changeOperand(jumpNotTruthyPos,
+                static_cast<int>(currentInstructions().size()));
+
+  if (ifExpr->m_alternative == nullptr) {
+    emit(Code::OpNull);
+  } else if (!compileBlock(ifExpr->m_alternative.get())) {
+    return false;
+  }
+  changeOperand(jumpPos, static_cast<int>(currentInstructions().size()));
+  return true;
+}
+
+bool Compiler::compileLet(Ast::LetStatement *letStmt) {
+  auto name = letStmt->m_name->m_symbol;
+  bool ok = false;
+  if (letStmt->m_expression != nullptr &&
+      letStmt->m_expression->Type() == Ast::Type::FUNCTION_LITERAL) {
+    ok = compileFunction(
+      Ast::Cast<Ast::FunctionLiteral>(letStmt->m_expression.get()), name);
+  } else {
+    ok = Compile(letStmt->m_expression.get());
+  }
+  if (!ok) {
+    return false;
+  }
+
+  // Defined after the value is compiled so "let x = x + 1" sees the outer x
+  auto symbol = m_symbolTable->Define(name);
+  if (symbol.scope == SymbolScope::GLOBAL) {
+    emit(Code::OpSetGlobal, {symbol.index});
+  } else {
+    emit(Code::OpSetLocal, {symbol.index});
+  }
+  return true;
+}
+
+bool Compiler::compileFunction(Ast::FunctionLiteral *fun,
+                               Symbols::Symbol name) {
+  enterScope();
+  if (name != Symbols::NoSymbol) {
+    m_symbolTable->DefineFunctionName(name);
+  }
+  for (const auto &param : fun->m_parameters) {
+    m_symbolTable->Define(param->m_symbol);
+  }
+  if (!Compile(fun->m_body.get())) {
+    leaveScope();
+    return false;
+  }
+  if (lastInstructionIs(Code::OpPop)) {
+    auto lastPos = m_scopes.back().lastInstruction.position;
+    replaceInstruction(lastPos, Code::Make(Code::OpReturnValue));
+    m_scopes.back().lastInstruction.opcode = Code::OpReturnValue;
+  }
+  if (!lastInstructionIs(Code::OpReturnValue)) {
+    emit(Code::OpReturn);
+  }
+  markTailCalls(currentInstructions());
+
+  auto freeSymbols = m_symbolTable->m_freeSymbols;
+  int numLocals = m_symbolTable->m_numDefinitions;
+  auto instructions = leaveScope();
+
+  for (const auto &symbol : freeSymbols) {
+    loadSymbol(symbol);
+  }
+  auto compiledFn = std::make_shared<Object::CompiledFunction>(
+    std::move(instructions), numLocals,
+    static_cast<int>(fun->m_parameters.size()));
+  emit(Code::OpClosure, {addConstant(compiledFn),
+                         static_cast<int>(freeSymbols.size())});
+  return true;
+}
+
+// Whether what runs from pos on returns the value on top of the stack
+// without touching it, maybe after jumping out of an if
+static bool returnsAt(const Code::Instructions &ins, size_t pos) {
+  // the compiler only jumps forward, so this ends
+  while (pos < ins.size() && ins[pos] == Code::OpJump) {
+    auto target = static_cast<size_t>(Code::ReadUint16(ins, pos + 1));
+    if (target <= pos) {
+      return false;
+    }
+    pos = target;
+  }
+  return pos < ins.size() && ins[pos] == Code::OpReturnValue;
+}
+
+// A call the function returns the value of is made a tail call, the vm runs
+// it in the caller's frame instead of on top of it. Tail recursive loops
+// take one frame however long they run, as they do in the evaluator.
+void Compiler::markTailCalls(Code::Instructions &ins) {
+  size_t pos = 0;
+  while (pos < ins.size()) {
+    auto op = static_cast<Code::Opcode>(ins[pos]);
+    auto next = pos + 1;
+    for (int width : Code::Lookup(op)->OperandWidths) {
+      next += static_cast<size_t>(width);
+    }
+    if (op == Code::OpCall && returnsAt(ins, next)) {
+      ins[pos] = Code::OpTailCall;
+    }
+    pos = next;
+  }
+}
+
+// Top level lets are known up front so functions can refer to globals that
+// are defined further down, the same way the evaluator resolves them lazily.
+void Compiler::predeclareGlobals(Ast::Program *program) {
+  if (m_symbolTable->m_outer != nullptr) {
+    return;
+  }
+  for (const auto &statement : program->m_statements) {
+    if (statement->Type() == Ast::Type::LET_STATEMENT) {
+      auto *letStmt = Ast::Cast<Ast::LetStatement>(statement.get());
+      m_symbolTable->Define(letStmt->m_name->m_symbol);
+    }
+  }
+}
+
+void Compiler::loadSymbol(const Symbol &symbol) {
+  switch (symbol.scope) {
+  case SymbolScope::GLOBAL:
+    emit(Code::OpGetGlobal, {symbol.index});
+    break;
+  case SymbolScope::LOCAL:
+    emit(Code::OpGetLocal, {symbol.index});
+    break;
+  case SymbolScope::FREE:
+    emit(Code::OpGetFree, {symbol.index});
+    break;
+  case SymbolScope::FUNCTION:
+    emit(Code::OpCurrentClosure);
+    break;
+  }
+}
+
+bool Compiler::error(const std::string &msg) {
+  m_errors.push_back(msg);
+  return false;
+}
+
+int Compiler::addConstant(Object::Value obj) {
+  m_constants.push_back(std::move(obj));
+  return static_cast<int>(m_constants.size()) - 1;
+}
+
+size_t Compiler::emit(Code::Opcode op, const std::vector<int> &operands) {
+  auto pos = addInstruction(Code::Make(op, operands));
+  setLastInstruction(op, pos);
+  return pos;
+}
+
+size_t Compiler::addInstruction(const Code::Instructions &ins) {
+  auto &current = currentInstructions();
+  auto pos = current.size();
+  current.insert(current.end(), ins.begin(), ins.end());
+  return pos;
+}
+
+void Compiler::setLastInstruction(Code::Opcode op, size_t pos) {
+  auto &scope = m_scopes.back();
+  scope.previousInstruction = scope.lastInstruction;
+  scope.lastInstruction = {.opcode = op, .position = pos};
+}
+
+bool Compiler::lastInstructionIs(Code::Opcode op) {
+  if (currentInstructions().empty()) {
+    return false;
+  }
+  return m_scopes.back().lastInstruction.opcode == op;
+}
+
+void Compiler::removeLastPop() {
+  auto &scope = m_scopes.back();
+  scope.instructions.resize(scope.lastInstruction.position);
+  scope.lastInstruction = scope.previousInstruction;
+}
+
+void Compiler::replaceInstruction(size_t pos,
+                                  const Code::Instructions &newIns) {
+  auto &ins = currentInstructions();
+  for (size_t i = 0; i < newIns.size(); i++) {
+    ins[pos + i] = newIns[i];
+  }
+}
+
+void Compiler::changeOperand(size_t opPos, int operand) {
+  auto op = static_cast<Code::Opcode>(currentInstructions()[opPos]);
+  replaceInstruction(opPos, Code::Make(op, {operand}));
+}
+
+Code::Instructions &Compiler::currentInstructions() {
+  return m_scopes.back().instructions;
+}
+
+void Compiler::enterScope() {
+  m_scopes.push_back({});
+  m_symbolTable = std::make_shared<SymbolTable>(m_symbolTable);
+}
+
+Code::Instructions Compiler::leaveScope() {
+  auto instructions = std::move(m_scopes.back().instructions);
+  m_scopes.pop_back();
+  m_symbolTable = m_symbolTable->m_outer;
+  return instructions;
+}
+
+Bytecode Compiler::GetBytecode() {
+  return {.instructions = currentInstructions(),
+          .constants = m_constants,
+          .globalNames = m_symbolTable->DefinedNames()};
+}
+
+State Compiler::GetState() {
+  return {.symbolTable = m_symbolTable, .constants = m_constants};
+}
+
+const std::vector<std::string> &Compiler::Errors() const { return m_errors; }
+
+} // namespace Compiler
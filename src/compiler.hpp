@@ -0,0 +1,84 @@
+#pragma once
+#include "ast.hpp"
+#include "code.hpp"
+#include "object.hpp"
+#include "symbol_table.hpp"
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+namespace Compiler {
+
+struct Bytecode {
+  Code::Instructions instructions;
+  std::vector<Object::Value> constants;
+  // for reads of globals that were never assigned, to fall back to the
+  // builtin of that name or report it
+  std::vector<std::string> globalNames;
+};
+
+struct EmittedInstruction {
+  Code::Opcode opcode;
+  size_t position;
+};
+
+struct CompilationScope {
+  Code::Instructions instructions;
+  EmittedInstruction lastInstruction;
+  EmittedInstruction previousInstruction;
+};
+
+// Constants and globals that have to survive between compilations, so the
+// repl can keep its definitions from one line to the next.
+struct State {
+  std::shared_ptr<SymbolTable> symbolTable;
+  std::vector<Object::Value> constants;
+};
+State NewState();
+
+class Compiler {
+public:
+  Compiler();
+  explicit Compiler(State state);
+
+  // Returns false on error, the reason can be found with Errors()
+  bool Compile(Ast::INode *node);
+  Bytecode GetBytecode();
+  State GetState();
+  const std::vector<std::string> &Errors() const;
+
+private:
+  std::vector<Object::Value> m_constants;
+  std::shared_ptr<SymbolTable> m_symbolTable;
+  std::vector<CompilationScope> m_scopes;
+  std::vector<std::string> m_errors;
+
+  // the program and blocks keep their statements in different containers
+  bool compileStatements(std::span<std::unique_ptr<Ast::IStatement>> stmts);
+  bool compileBlock(Ast::BlockStatement *block);
+  bool compileInfix(Ast::InfixExpression *infix);
+  bool compilePrefix(Ast::PrefixExpression *prefix);
+  bool compileIf(Ast::IfExpression *ifExpr);
+  bool compileLet(Ast::LetStatement *letStmt);
+  // name is NoSymbol for a literal that isn't bound by a let
+  bool compileFunction(Ast::FunctionLiteral *fun, Symbols::Symbol name);
+  void predeclareGlobals(Ast::Program *program);
+  static void markTailCalls(Code::Instructions &ins);
+  bool error(const std::string &msg);
+
+  int addConstant(Object::Value obj);
+  size_t emit(Code::Opcode op, const std::vector<int> &operands = {});
+  size_t addInstruction(const Code::Instructions &ins);
+  void setLastInstruction(Code::Opcode op, size_t pos);
+  bool lastInstructionIs(Code::Opcode op);
+  void removeLastPop();
+  void replaceInstruction(size_t pos, const Code::Instructions &newIns);
+  void changeOperand(size_t opPos, int operand);
+  void loadSymbol(const Symbol &symbol);
+
+  Code::Instructions &currentInstructions();
+  void enterScope();
+  Code::Instructions leaveScope();
+};
+
+} // namespace Compiler
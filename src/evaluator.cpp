@@ -2,156 +2,605 @@
 #include "ast.hpp"
 #include "builtins.hpp"
 #include "object.hpp"
-#include "token.hpp"
+#include "resolver.hpp"
+#include <array>
 #include <cassert>
+#include <cstddef>
 #include <format>
 #include <iostream>
 #include <memory>
+#include <span>
 #include <vector>
 namespace Evaluator {
-std::shared_ptr<Object::Boolean> FALSE =
-  std::make_shared<Object::Boolean>(false);
-std::shared_ptr<Object::Boolean> TRUE = std::make_shared<Object::Boolean>(true);
-std::shared_ptr<Object::Null> NULL_O = std::make_shared<Object::Null>();
+const Object::Value FALSE = Object::Value::Bool(false);
+const Object::Value TRUE = Object::Value::Bool(true);
+const Object::Value NULL_O = Object::Value::Null();
 
-static std::shared_ptr<Object::Boolean> nativeBoolToBoolObject(bool boolean) {
-  return boolean ? TRUE : FALSE;
+static Object::Value nativeBoolToBoolObject(bool boolean) {
+  return Object::Value::Bool(boolean);
+}
+
+void Evaluator::TraceRoots(Gc::Heap &heap) const {
+  for (const auto &value : m_roots) {
+    value.Trace(heap);
+  }
+  for (const auto *env : m_envs) {
+    heap.Mark(env);
+  }
+  for (const auto *env : m_framePool) {
+    heap.Mark(env);
+  }
+  m_returnValue.Trace(heap);
+  m_tailCallee.Trace(heap);
+  for (const auto &value : m_tailArgs) {
+    value.Trace(heap);
+  }
 }
 
 // Environment stuff
-std::shared_ptr<Object::IObject>
+Object::Value
 Evaluator::Eval(Ast::INode *node,
                 const std::shared_ptr<Object::Environment> &env) {
+  return Eval(node, env.get());
+}
+
+// Nodes are compiled into closures before they run, see compile
+Object::Value Evaluator::Eval(Ast::INode *node, Object::Environment *env) {
   if (node == nullptr) {
     return nullptr;
   }
+  if (node->Type() == Ast::Type::PROGRAM) {
+    return evalProgram(Ast::Cast<Ast::Program>(node), env);
+  }
+  auto result = takeReturnValue(compile(node)(*this, env));
+  if (m_tailCallee != nullptr) {
+    return runTailCall();
+  }
+  return result;
+}
+
+// Turns a node into a closure with its children compiled and its operator
+// picked, so running it doesn't switch on node types, cast or look up
+// operators again. Function bodies are compiled along with the function
+// literal, once per program rather than once per call.
+class Evaluator::NodeCompiler
+  : public Ast::Visitor<NodeCompiler, Object::CompiledNode> {
+public:
+  static Object::CompiledNode Visit(Ast::Program *program);
+  static Object::CompiledNode Visit(Ast::Identifier *ident);
+  static Object::CompiledNode Visit(Ast::IntegerLiteral *integer);
+  static Object::CompiledNode Visit(Ast::PrefixExpression *prefixExpr);
+  static Object::CompiledNode Visit(Ast::InfixExpression *infixExpr);
+  static Object::CompiledNode Visit(Ast::Boolean *boolean);
+  static Object::CompiledNode Visit(Ast::BlockStatement *block);
+  static Object::CompiledNode Visit(Ast::IfExpression *ifExpr);
+  static Object::CompiledNode Visit(Ast::LetStatement *letStmt);
+  static Object::CompiledNode Visit(Ast::ReturnStatement *returnStmt);
+  static Object::CompiledNode Visit(Ast::ExpressionStatement *exprStmt);
+  static Object::CompiledNode Visit(Ast::FunctionLiteral *fun);
+  static Object::CompiledNode Visit(Ast::CallExpression *callExpr);
+  static Object::CompiledNode Visit(Ast::StringLiteral *strLit);
+  static Object::CompiledNode Visit(Ast::ArrayLiteral *arrLit);
+  static Object::CompiledNode Visit(Ast::IndexExpression *idxExp);
+  static Object::CompiledNode Visit(Ast::HashLiteral *hashLit);
+
+  // node as the last thing its function does, calls there become tail calls
+  static Object::CompiledNode compileTail(Ast::INode *node);
+
+private:
+  // The value of a literal, made once here and shared by every evaluation
+  // of the node. nullptr for anything else.
+  static Object::Value constant(Ast::INode *node);
+  static Object::CompiledNode constantNode(Object::Value value);
+  static Object::CompiledNode compileBlock(Ast::BlockStatement *block,
+                                           bool tail);
+  static Object::CompiledNode compileIf(Ast::IfExpression *ifExpr, bool tail);
+  static Object::CompiledNode compileCall(Ast::CallExpression *callExpr,
+                                          bool tail);
+  template <typename IntOp>
+  static Object::CompiledNode compileInfixOp(Object::CompiledNode left,
+                                             Object::CompiledNode right,
+                                             Ast::Operator op, IntOp intOp);
+};
+
+Object::CompiledNode Evaluator::compile(Ast::INode *node) {
+  if (node == nullptr) {
+    return [](Evaluator & /*ev*/, Object::Environment * /*env*/) {
+      return Object::Value();
+    };
+  }
+  return NodeCompiler().Dispatch(node);
+}
+
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::Program *program) {
+  return [program](Evaluator &ev, Object::Environment *env) {
+    return ev.evalProgram(program, env);
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::ExpressionStatement *exprStmt) {
+  return compile(exprStmt->m_expression.get());
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::IntegerLiteral *integer) {
+  return constantNode(constant(integer));
+}
 
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::Boolean *boolean) {
+  return constantNode(constant(boolean));
+}
+
+// Strings and arrays never change once made, so one can stand for every
+// evaluation of the literal. They are shared rather than collected, the
+// heap doesn't know about the compiled tree that holds on to them.
+Object::Value Evaluator::NodeCompiler::constant(Ast::INode *node) {
   switch (node->Type()) {
-  case Ast::Type::PROGRAM: {
-    return evalProgram(dynamic_cast<Ast::Program *>(node), env);
+  case Ast::Type::INTEGER_LITERAL:
+    return Object::Value::Int(Ast::Cast<Ast::IntegerLiteral>(node)->m_value);
+  case Ast::Type::BOOLEAN:
+    return nativeBoolToBoolObject(Ast::Cast<Ast::Boolean>(node)->m_value);
+  case Ast::Type::STRING_LITERAL:
+    return std::make_shared<Object::String>(
+      Ast::Cast<Ast::StringLiteral>(node)->m_value);
+  case Ast::Type::ARRAY_LITERAL: {
+    const auto &elements = Ast::Cast<Ast::ArrayLiteral>(node)->m_elements;
+    std::vector<Object::Value> values;
+    values.reserve(elements.size());
+    for (const auto &element : elements) {
+      auto value = element != nullptr ? constant(element.get()) : nullptr;
+      if (value == nullptr) {
+        return nullptr;
+      }
+      values.push_back(std::move(value));
+    }
+    return std::make_shared<Object::Array>(values);
   }
-  case (Ast::Type::EXPRESSION_STATEMENT): {
-    return Eval(
-      dynamic_cast<Ast::ExpressionStatement *>(node)->m_expression.get(), env);
+  default:
+    return nullptr;
   }
-  case Ast::Type::INTEGER_LITERAL: {
-    auto *integer = dynamic_cast<Ast::IntegerLiteral *>(node);
-    return (std::make_shared<Object::Integer>(integer->m_value));
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::constantNode(Object::Value value) {
+  return [value = std::move(value)](Evaluator & /*ev*/,
+                                    Object::Environment * /*env*/) {
+    return value;
+  };
+}
+
+// Tail positions are the value of a return and the end of a function body,
+// reached through blocks and the branches of an if
+Object::CompiledNode Evaluator::NodeCompiler::compileTail(Ast::INode *node) {
+  if (node == nullptr) {
+    return compile(node);
   }
-  case Ast::Type::BOOLEAN: {
-    auto *boolean = dynamic_cast<Ast::Boolean *>(node);
-    return nativeBoolToBoolObject(boolean->m_value);
+  switch (node->Type()) {
+  case Ast::Type::EXPRESSION_STATEMENT:
+    return compileTail(
+      Ast::Cast<Ast::ExpressionStatement>(node)->m_expression.get());
+  case Ast::Type::BLOCK_STATEMENT:
+    return compileBlock(Ast::Cast<Ast::BlockStatement>(node), true);
+  case Ast::Type::IF_EXPRESSION:
+    return compileIf(Ast::Cast<Ast::IfExpression>(node), true);
+  case Ast::Type::CALL_EXPRESSION:
+    return compileCall(Ast::Cast<Ast::CallExpression>(node), true);
+  default:
+    return compile(node);
+  }
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::BlockStatement *block) {
+  return compileBlock(block, false);
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::compileBlock(Ast::BlockStatement *block, bool tail) {
+  std::vector<std::pair<Object::CompiledNode, Ast::INode *>> statements;
+  statements.reserve(block->m_statements.size());
+  for (const auto &statement : block->m_statements) {
+    statements.emplace_back(tail && statement == block->m_statements.back()
+                              ? compileTail(statement.get())
+                              : compile(statement.get()),
+                            statement.get());
   }
-  case Ast::Type::PREFIX_EXPRESSION: {
-    auto *prefixExpr = dynamic_cast<Ast::PrefixExpression *>(node);
-    auto right = Eval(prefixExpr->m_right.get(), env);
-    if (isError(right.get())) {
-      return right;
+  return [statements = std::move(statements)](Evaluator &ev,
+                                              Object::Environment *env) {
+    Object::Value result;
+    for (const auto &[statement, node] : statements) {
+      result = statement(ev, env);
+      if (ev.m_returnValue != nullptr) {
+        return result;
+      }
+      if (isError(result)) {
+        locate(result, node);
+        return result;
+      }
     }
-    return evalPrefixExpression(prefixExpr->m_op, right);
+    return result;
+  };
+}
+
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::IfExpression *ifExpr) {
+  return compileIf(ifExpr, false);
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::compileIf(Ast::IfExpression *ifExpr, bool tail) {
+  auto condition = compile(ifExpr->m_condition.get());
+  auto consequence = tail ? compileTail(ifExpr->m_consequence.get())
+                          : compile(ifExpr->m_consequence.get());
+  Object::CompiledNode alternative;
+  if (ifExpr->m_alternative != nullptr) {
+    alternative = tail ? compileTail(ifExpr->m_alternative.get())
+                       : compile(ifExpr->m_alternative.get());
   }
-  case Ast::Type::INFIX_EXPRESSION: {
-    auto *infixExpr = dynamic_cast<Ast::InfixExpression *>(node);
-    auto left = Eval(infixExpr->m_left.get(), env);
-    if (isError(left.get())) {
-      return left;
+  return [condition = std::move(condition),
+          consequence = std::move(consequence),
+          alternative = std::move(alternative)](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    auto value = condition(ev, env);
+    if (isError(value)) {
+      return value;
     }
-    auto right = Eval(infixExpr->m_right.get(), env);
-    if (isError(right.get())) {
-      return right;
+    if (isTruthy(value.get())) {
+      return consequence(ev, env);
+    } else if (alternative) {
+      return alternative(ev, env);
+    } else {
+      return NULL_O;
     }
-    return evalInfixExpression(infixExpr->m_op, left.get(), right.get());
-  }
-  case Ast::Type::BLOCK_STATEMENT: {
-    auto *blockStmt = dynamic_cast<Ast::BlockStatement *>(node);
-    return evalStatements(blockStmt->m_statements, env);
-  }
-  case Ast::Type::IF_EXPRESSION: {
-    auto *ifStmt = dynamic_cast<Ast::IfExpression *>(node);
-    return evalIfExpression(ifStmt, env);
-  }
-  case Ast::Type::RETURN_STATEMENT: {
-    auto *returnStmt = dynamic_cast<Ast::ReturnStatement *>(node);
-    auto val = Eval(returnStmt->m_returnValue.get(), env);
-    if (isError(val.get())) {
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::ReturnStatement *returnStmt) {
+  // whoever takes the return value runs a pending tail call, be it a call
+  // or the program
+  auto value = compileTail(returnStmt->m_returnValue.get());
+  return [value = std::move(value)](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    auto val = value(ev, env);
+    if (isError(val)) {
       return val;
     }
-    return std::make_shared<Object::ReturnValue>(val);
-  }
-  case Ast::Type::LET_STATEMENT: {
-    auto *letStmt = dynamic_cast<Ast::LetStatement *>(node);
-    auto val = Eval(letStmt->m_expression.get(), env);
-    if (isError(val.get())) {
+    // picked up by the call or program being returned from, until then
+    // every block and argument list stops at it
+    ev.m_returnValue = val;
+    return val;
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::LetStatement *letStmt) {
+  auto value = compile(letStmt->m_expression.get());
+  int slot = letStmt->m_name->m_slot;
+  auto name = letStmt->m_name->m_symbol;
+  return [value = std::move(value), slot, name](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    auto val = value(ev, env);
+    if (isError(val)) {
       return val;
     }
-    env->Set(letStmt->m_name->m_value, val);
+    if (slot >= 0) {
+      env->SetAt(slot, val);
+    } else {
+      env->Set(name, val);
+    }
     return nullptr;
+  };
+}
+
+// Every evaluation of the literal shares one prototype, making a closure
+// is one allocation for the Function
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::FunctionLiteral *fun) {
+  auto prototype = std::make_shared<const Object::FunctionPrototype>(
+    fun, compileTail(fun->m_body.get()));
+  return [prototype = std::move(prototype)](Evaluator & /*ev*/,
+                                            Object::Environment *env) {
+    return Object::Value(Object::New<Object::Function>(prototype, env));
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::CallExpression *callExpr) {
+  return compileCall(callExpr, false);
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::compileCall(Ast::CallExpression *callExpr,
+                                     bool tail) {
+  auto function = compile(callExpr->m_function.get());
+  auto arguments = compileAll(callExpr->m_arguments);
+  if (tail) {
+    // Hands the callee and arguments to the call this one ends, which runs
+    // it in its place, see callFunction
+    return [function = std::move(function), arguments = std::move(arguments)](
+             Evaluator &ev, Object::Environment *env) -> Object::Value {
+      RootScope roots(ev.m_roots);
+      auto fn = function(ev, env);
+      if (isError(fn) || ev.m_returnValue != nullptr) {
+        return fn;
+      }
+      roots.Add(fn);
+      auto first = ev.m_roots.size();
+      if (auto err = ev.evalExpressions(arguments, env, roots)) {
+        return err;
+      }
+      ev.m_tailArgs.assign(ev.m_roots.begin() +
+                             static_cast<std::ptrdiff_t>(first),
+                           ev.m_roots.end());
+      ev.m_tailCallee = std::move(fn);
+      // not empty, so a return of it still stops the enclosing blocks
+      return NULL_O;
+    };
   }
-  case Ast::Type::IDENTIFIER: {
-    return evalIdentifier(node, env);
-  }
-  case Ast::Type::FUNCTION_LITERAL: {
-    auto *fun = dynamic_cast<Ast::FunctionLiteral *>(node);
-    auto params = std::move(fun->m_parameters);
-    auto body = std::move(fun->m_body);
-    return std::make_shared<Object::Function>(std::move(params), env,
-                                              std::move(body));
+  return [callExpr, function = std::move(function),
+          arguments = std::move(arguments)](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    RootScope roots(ev.m_roots);
+    auto fn = function(ev, env);
+    // a pending return belongs to an enclosing call, don't let this one take
+    // it
+    if (isError(fn) || ev.m_returnValue != nullptr) {
+      return fn;
+    }
+    roots.Add(fn);
+    auto first = ev.m_roots.size();
+    if (auto err = ev.evalExpressions(arguments, env, roots)) {
+      return err;
+    }
+    return ev.applyFunction(
+      callExpr, fn, std::span<const Object::Value>(ev.m_roots).subspan(first));
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::StringLiteral *strLit) {
+  return constantNode(constant(strLit));
+}
+
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::ArrayLiteral *arrLit) {
+  if (auto value = constant(arrLit)) {
+    return constantNode(std::move(value));
   }
-  case Ast::Type::CALL_EXPRESSION: {
-    auto *callExpr = dynamic_cast<Ast::CallExpression *>(node);
-    auto function = Eval(callExpr->m_function.get(), env);
-    if (isError(function.get())) {
-      return function;
+  auto elements = compileAll(arrLit->m_elements);
+  return [elements = std::move(elements)](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    RootScope roots(ev.m_roots);
+    auto first = ev.m_roots.size();
+    if (auto err = ev.evalExpressions(elements, env, roots)) {
+      return err;
     }
-    auto args = evalExpressions(callExpr->m_arguments, env);
-    if (std::ssize(args) == 1 && isError(args[0].get())) {
-      return args[0];
+    std::vector<Object::Value> values(ev.m_roots.begin() +
+                                        static_cast<std::ptrdiff_t>(first),
+                                      ev.m_roots.end());
+    return Object::New<Object::Array>(values);
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::IndexExpression *idxExp) {
+  auto left = compile(idxExp->m_left.get());
+  auto index = compile(idxExp->m_index.get());
+  return [left = std::move(left), index = std::move(index)](
+           Evaluator &ev, Object::Environment *env) -> Object::Value {
+    RootScope roots(ev.m_roots);
+    auto leftVal = left(ev, env);
+    if (isError(leftVal)) {
+      return leftVal;
+    }
+    roots.Add(leftVal);
+    auto indexVal = index(ev, env);
+    if (isError(indexVal)) {
+      return indexVal;
     }
+    return evalIndexExpression(leftVal, indexVal);
+  };
+}
 
-    return applyFunction(function, args);
+template <typename NodePtr, typename Alloc>
+std::vector<Object::CompiledNode>
+Evaluator::compileAll(const std::vector<NodePtr, Alloc> &nodes) {
+  std::vector<Object::CompiledNode> compiled;
+  compiled.reserve(nodes.size());
+  for (const auto &node : nodes) {
+    compiled.push_back(compile(node.get()));
   }
-  case Ast::Type::STRING_LITERAL: {
-    auto *strLit = dynamic_cast<Ast::StringLiteral *>(node);
-    return std::make_shared<Object::String>(strLit->m_value);
+  return compiled;
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::PrefixExpression *prefixExpr) {
+  auto right = compile(prefixExpr->m_right.get());
+  switch (prefixExpr->m_operator) {
+  case Ast::Operator::MINUS:
+    return [right = std::move(right)](Evaluator &ev,
+                                      Object::Environment *env) {
+      auto value = right(ev, env);
+      if (isError(value)) {
+        return value;
+      }
+      if (value.IsInteger()) {
+        return Object::Value::Int(-value.AsInteger());
+      }
+      return evalMinusPrefixOperatorExpression(value.get());
+    };
+  case Ast::Operator::BANG:
+    return [right = std::move(right)](Evaluator &ev,
+                                      Object::Environment *env) {
+      auto value = right(ev, env);
+      if (isError(value)) {
+        return value;
+      }
+      return evalBangOperatorExpression(value.get());
+    };
+  default:
+    return [right = std::move(right), op = prefixExpr->m_operator](
+             Evaluator &ev, Object::Environment *env) {
+      auto value = right(ev, env);
+      if (isError(value)) {
+        return value;
+      }
+      return evalPrefixExpression(op, value);
+    };
   }
-  case Ast::Type::ARRAY_LITERAL: {
-    auto *arrLit = dynamic_cast<Ast::ArrayLiteral *>(node);
-    auto elements = evalExpressions(arrLit->m_elements, env);
-    if (std::ssize(elements) == 1 && isError(elements[0].get())) {
-      return elements[1];
+}
+
+// Both sides integers is the common case, it gets the operator inline and
+// everything else goes through evalInfixExpression
+template <typename IntOp>
+Object::CompiledNode
+Evaluator::NodeCompiler::compileInfixOp(Object::CompiledNode left,
+                                        Object::CompiledNode right,
+                                        Ast::Operator op, IntOp intOp) {
+  return [left = std::move(left), right = std::move(right), op,
+          intOp](Evaluator &ev, Object::Environment *env) -> Object::Value {
+    RootScope roots(ev.m_roots);
+    auto leftVal = left(ev, env);
+    if (isError(leftVal)) {
+      return leftVal;
     }
-    return std::make_shared<Object::Array>(elements);
-  }
-  case Ast::Type::INDEX_EXPRESSION: {
-    auto *idxExp = dynamic_cast<Ast::IndexExpression *>(node);
-    auto left = Eval(idxExp->m_left.get(), env);
-    if (isError(left.get())) {
-      return left;
+    if (!leftVal.IsInteger()) {
+      roots.Add(leftVal);
     }
-    auto index = Eval(idxExp->m_index.get(), env);
-    if (isError(index.get())) {
-      return index;
+    auto rightVal = right(ev, env);
+    if (isError(rightVal)) {
+      return rightVal;
     }
-    return evalIndexExpression(left, index);
-  }
+    if (leftVal.IsInteger() && rightVal.IsInteger()) {
+      return intOp(leftVal.AsInteger(), rightVal.AsInteger());
+    }
+    return evalInfixExpression(op, leftVal, rightVal);
+  };
+}
 
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::InfixExpression *infixExpr) {
+  auto left = compile(infixExpr->m_left.get());
+  auto right = compile(infixExpr->m_right.get());
+  auto op = infixExpr->m_operator;
+  switch (op) {
+  case Ast::Operator::PLUS:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return Object::Value::Int(a + b);
+                          });
+  case Ast::Operator::MINUS:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return Object::Value::Int(a - b);
+                          });
+  case Ast::Operator::ASTERISK:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return Object::Value::Int(a * b);
+                          });
+  case Ast::Operator::SLASH:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) -> Object::Value {
+                            if (b == 0) {
+                              return newError("division by zero");
+                            }
+                            return Object::Value::Int(a / b);
+                          });
+  case Ast::Operator::LT:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return nativeBoolToBoolObject(a < b);
+                          });
+  case Ast::Operator::GT:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return nativeBoolToBoolObject(a > b);
+                          });
+  case Ast::Operator::EQ:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return nativeBoolToBoolObject(a == b);
+                          });
+  case Ast::Operator::NOT_EQ:
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [](long int a, long int b) {
+                            return nativeBoolToBoolObject(a != b);
+                          });
   default:
-    return nullptr;
+    return compileInfixOp(std::move(left), std::move(right), op,
+                          [op](long int a, long int b) {
+                            return evalInfixExpression(
+                              op, Object::Value::Int(a), Object::Value::Int(b));
+                          });
   }
 }
 
-std::shared_ptr<Object::IObject> Evaluator::applyFunction(
-  const std::shared_ptr<Object::IObject> &fn,
-  const std::vector<std::shared_ptr<Object::IObject>> &args) {
-  switch (fn->Type()) {
-  case Object::ObjectType::FUNCTION_OBJ: {
-    auto *function = dynamic_cast<Object::Function *>(fn.get());
-    auto extendedEnv = extendFunctionEnv(function, args);
-    auto evaluated = Eval(function->m_body.get(), extendedEnv);
-    return unwrapReturnValue(evaluated);
+// The node outlives the closure, both belong to the program or function
+// being run
+Object::CompiledNode Evaluator::NodeCompiler::Visit(Ast::Identifier *ident) {
+  if (ident->m_depth >= 0) {
+    return [ident, depth = ident->m_depth,
+            slot = ident->m_slot](Evaluator & /*ev*/,
+                                  Object::Environment *env) {
+      const auto &obj = env->GetAt(depth, slot);
+      if (obj != nullptr) {
+        return obj;
+      }
+      // not bound yet at its resolved address, e.g. a let in a branch that
+      // was not taken, so fall back to looking the name up
+      return lookupIdentifier(ident, env);
+    };
+  }
+  // builtins too, the lookup cache only keeps one for as long as nothing
+  // that could shadow it has been declared
+  return [ident](Evaluator & /*ev*/, Object::Environment *env) {
+    return lookupIdentifier(ident, env);
+  };
+}
+
+Object::CompiledNode
+Evaluator::NodeCompiler::Visit(Ast::HashLiteral *hashLit) {
+  std::vector<std::pair<Object::CompiledNode, Object::CompiledNode>> pairs;
+  pairs.reserve(hashLit->m_pairs.size());
+  for (const auto &[keyNode, valueNode] : hashLit->m_pairs) {
+    pairs.emplace_back(compile(keyNode.get()), compile(valueNode.get()));
   }
+  return [pairs = std::move(pairs)](Evaluator &ev,
+                                    Object::Environment *env) {
+    auto *hash = Object::New<Object::Hash>(pairs.size());
+    RootScope roots(ev.m_roots);
+    roots.Add(hash);
+    for (const auto &[keyFn, valueFn] : pairs) {
+      RootScope keyRoot(ev.m_roots);
+      auto key = keyFn(ev, env);
+      if (isError(key)) {
+        return key;
+      }
+      keyRoot.Add(key);
+      auto hashKey = Object::HashKeyOf(key);
+      if (!hashKey) {
+        return Object::Value(newError("unusable as hash key: " +
+                                      Object::objectTypeToStr(key->Type())));
+      }
+      auto value = valueFn(ev, env);
+      if (isError(value)) {
+        return value;
+      }
+      hash->Set(*hashKey, std::move(key), std::move(value));
+    }
+    return Object::Value(hash);
+  };
+}
+
+// args are the caller's, on the root stack. They are copied into the new
+// environment before anything can push more roots.
+Object::Value Evaluator::applyFunction(const Object::Value &fn,
+                                       std::span<const Object::Value> args) {
+  switch (fn->Type()) {
+  case Object::ObjectType::FUNCTION_OBJ:
+    return callFunction(static_cast<Object::Function *>(fn.get()), args);
   case Object::ObjectType::BUILTIN_OBJ: {
-    auto *function = dynamic_cast<Object::Builtin *>(fn.get());
+    auto *function = static_cast<Object::Builtin *>(fn.get());
     return function->m_fn(args);
   }
   default: {
@@ -161,92 +610,212 @@ std::shared_ptr<Object::IObject> Evaluator::applyFunction(
   }
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::unwrapReturnValue(std::shared_ptr<Object::IObject> obj) {
-  if (obj->Type() == Object::ObjectType::RETURN_VALUE_OBJ) {
-    return dynamic_cast<Object::ReturnValue *>(obj.get())->m_value;
+// Most call sites only ever call one function. The argument count of a
+// site never changes, so once a call to it got past the arity check the
+// next ones to the same prototype go straight in.
+Object::Value Evaluator::applyFunction(Ast::CallExpression *site,
+                                       const Object::Value &fn,
+                                       std::span<const Object::Value> args) {
+  if (fn->Type() != Object::ObjectType::FUNCTION_OBJ) {
+    return applyFunction(fn, args);
+  }
+  auto *function = static_cast<Object::Function *>(fn.get());
+  if (function->m_prototype->m_id == site->m_callee) {
+    count(&CacheStats::m_callHits);
+    return enterFunction(function, args);
+  }
+  count(&CacheStats::m_callMisses);
+  if (auto err = checkArity(function, args.size())) {
+    return err;
+  }
+  site->m_callee = function->m_prototype->m_id;
+  return enterFunction(function, args);
+}
+
+Object::Value Evaluator::checkArity(Object::Function *function,
+                                    std::size_t argc) {
+  if (argc != function->Parameters().size()) {
+    return newError(std::format("wrong number of arguments: want={}, got={}",
+                                function->Parameters().size(), argc));
+  }
+  return nullptr;
+}
+
+Object::Value Evaluator::callFunction(Object::Function *function,
+                                      std::span<const Object::Value> args) {
+  if (auto err = checkArity(function, args.size())) {
+    return err;
+  }
+  return enterFunction(function, args);
+}
+
+// A body that ends in a call leaves it pending instead of making it. The
+// finished call's environment is released and the pending one runs in its
+// place, so a loop written as tail recursion runs in constant stack and
+// keeps one environment alive at a time.
+Object::Value Evaluator::enterFunction(Object::Function *function,
+                                       std::span<const Object::Value> args) {
+  // function and args are rooted by the caller
+  Gc::Heap::Current().Safepoint();
+  auto *env = extendFunctionEnv(function, args);
+  // keeps the body that is running alive, it changes with every tail call
+  RootScope roots(m_roots);
+  roots.Add(function);
+  auto calleeSlot = m_roots.size() - 1;
+  while (true) {
+    m_envs.push_back(env);
+    auto evaluated = takeReturnValue(function->m_prototype->m_compiled(*this, env));
+    m_envs.pop_back();
+    releaseFunctionEnv(function, env);
+    if (m_tailCallee == nullptr) {
+      return evaluated;
+    }
+    if (m_tailCallee->Type() != Object::ObjectType::FUNCTION_OBJ) {
+      return runTailCall();
+    }
+    function = static_cast<Object::Function *>(m_tailCallee.get());
+    m_roots[calleeSlot] = std::move(m_tailCallee);
+    m_tailCallee = nullptr;
+    if (auto err = checkArity(function, m_tailArgs.size())) {
+      m_tailArgs.clear();
+      return err;
+    }
+    Gc::Heap::Current().Safepoint();
+    env = extendFunctionEnv(function, m_tailArgs);
+    m_tailArgs.clear();
+  }
+}
+
+// Makes a pending tail call from where no call can take its place, at the
+// top level or when the callee isn't a Monkey function
+Object::Value Evaluator::runTailCall() {
+  RootScope roots(m_roots);
+  Object::Value callee = std::move(m_tailCallee);
+  m_tailCallee = nullptr;
+  roots.Add(callee);
+  auto first = m_roots.size();
+  for (auto &arg : m_tailArgs) {
+    roots.Add(arg);
+  }
+  m_tailArgs.clear();
+  return applyFunction(callee,
+                       std::span<const Object::Value>(m_roots).subspan(first));
+}
+
+Object::Value Evaluator::takeReturnValue(Object::Value result) {
+  if (m_returnValue != nullptr) {
+    if (!isError(result)) {
+      result = std::move(m_returnValue);
+    }
+    m_returnValue = nullptr;
   }
-  return obj;
+  return result;
 }
 
-std::shared_ptr<Object::Environment> Evaluator::extendFunctionEnv(
-  Object::Function *fn,
-  const std::vector<std::shared_ptr<Object::IObject>> &args) {
-  std::shared_ptr<Object::Environment> env =
-    std::make_shared<Object::Environment>(fn->m_env);
+// The environment of a function that has no function literals in it can't
+// be captured, so once the call is over it goes back to the pool and the
+// next such call reuses it and its slots
+Object::Environment *
+Evaluator::extendFunctionEnv(Object::Function *fn,
+                             std::span<const Object::Value> args) {
+  const auto &layout = fn->Layout();
+  Object::Environment *env = nullptr;
+  if (layout != nullptr && !layout->m_captured && !m_framePool.empty()) {
+    env = m_framePool.back();
+    m_framePool.pop_back();
+    env->Reset(fn->m_env, layout);
+  } else {
+    env = Object::New<Object::Environment>(fn->m_env, layout);
+  }
+
+  // the resolver puts the parameters in the first slots of the layout
+  if (layout != nullptr) {
+    for (size_t i = 0; i < args.size(); i++) {
+      env->SetAt(static_cast<int>(i), args[i]);
+    }
+    return env;
+  }
 
   size_t index = 0;
-  for (const auto &param : fn->m_parameters) {
-    env->Set(param->m_value, args[index]);
+  for (const auto &param : fn->Parameters()) {
+    env->Set(param, args[index]);
     index++;
   }
   return env;
 }
 
-std::vector<std::shared_ptr<Object::IObject>> Evaluator::evalExpressions(
-  const std::vector<std::unique_ptr<Ast::IExpression>> &exps,
-  const std::shared_ptr<Object::Environment> &env) {
-  std::vector<std::shared_ptr<Object::IObject>> result;
-  for (const auto &e : exps) {
-    auto evaluated = Eval(e.get(), env);
-    if (isError(evaluated.get())) {
-      result.push_back(evaluated);
-      return result;
-    }
-    result.push_back(evaluated);
+void Evaluator::releaseFunctionEnv(Object::Function *fn,
+                                   Object::Environment *env) {
+  if (fn->Layout() == nullptr || fn->Layout()->m_captured ||
+      m_framePool.size() >= MaxPooledFrames) {
+    return;
   }
-  return result;
+  // drop what the call left in its slots so the pool keeps no values alive.
+  // The layout stays, the next call of the same function needn't set it.
+  env->Reset(nullptr, fn->Layout());
+  m_framePool.push_back(env);
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalProgram(Ast::Program *program,
-                       const std::shared_ptr<Object::Environment> &env) {
-  std::shared_ptr<Object::IObject> result;
-  for (auto &statement : program->m_statements) {
-    result = Eval(statement.get(), env);
-    if (result) {
-      if (result->Type() == Object::ObjectType::RETURN_VALUE_OBJ) {
-        return dynamic_cast<Object::ReturnValue *>(result.get())->m_value;
-      } else if (result->Type() == Object::ObjectType::ERROR_OBJ) {
-        return result;
-      }
+Object::Value
+Evaluator::evalExpressions(const std::vector<Object::CompiledNode> &exps,
+                           Object::Environment *env, RootScope &roots) {
+  for (const auto &exp : exps) {
+    auto evaluated = exp(*this, env);
+    if (isError(evaluated) || m_returnValue != nullptr) {
+      return evaluated;
     }
+    roots.Add(evaluated);
   }
-  return result;
+  return nullptr;
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalStatements(std::vector<std::unique_ptr<Ast::IStatement>> &stmts,
-                          const std::shared_ptr<Object::Environment> &env) {
-  std::shared_ptr<Object::IObject> result;
-  for (auto &statement : stmts) {
-    result = Eval(statement.get(), env);
-    if (result != nullptr &&
-        (result->Type() == Object::ObjectType::RETURN_VALUE_OBJ ||
-         result->Type() == Object::ObjectType::ERROR_OBJ)) {
-      return result;
+Object::Value Evaluator::evalProgram(Ast::Program *program,
+                                     Object::Environment *env) {
+  Resolver::Resolver(env->Layout()).Resolve(program);
+  auto statements = compileAll(program->m_statements);
+
+  // nothing is held between statements but the environment
+  m_envs.push_back(env);
+  Object::Value result;
+  for (std::size_t i = 0; i < statements.size(); i++) {
+    Gc::Heap::Current().Safepoint();
+    result = statements[i](*this, env);
+    bool returned = m_returnValue != nullptr;
+    if (returned) {
+      result = takeReturnValue(result);
+      if (m_tailCallee != nullptr) {
+        result = runTailCall();
+      }
+    }
+    if (isError(result)) {
+      locate(result, program->m_statements[i].get());
+      break;
+    }
+    if (returned) {
+      break;
     }
   }
+  m_envs.pop_back();
   return result;
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalPrefixExpression(const std::string &op,
-                                const std::shared_ptr<Object::IObject> &right) {
-  if (op == "!") {
+Object::Value Evaluator::evalPrefixExpression(Ast::Operator op,
+                                              const Object::Value &right) {
+  switch (op) {
+  case Ast::Operator::BANG:
     return evalBangOperatorExpression(right.get());
-  } else if (op == "-") {
+  case Ast::Operator::MINUS:
     return evalMinusPrefixOperatorExpression(right.get());
-  } else {
-    return newError(std::format("unknown operator: {}{}", op,
+  default:
+    return newError(std::format("unknown operator: {}{}",
+                                Ast::OperatorString(op),
                                 Object::objectTypeToStr(right->Type())));
   }
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalBangOperatorExpression(Object::IObject *right) {
+Object::Value Evaluator::evalBangOperatorExpression(Object::IObject *right) {
   if (right->Type() == Object::ObjectType::BOOLEAN_OBJ) {
-    auto *boolean = dynamic_cast<Object::Boolean *>(right);
+    auto *boolean = static_cast<Object::Boolean *>(right);
     if (boolean->m_value) {
       return FALSE;
     } else {
@@ -261,125 +830,161 @@ Evaluator::evalBangOperatorExpression(Object::IObject *right) {
   return FALSE;
 }
 
-std::shared_ptr<Object::IObject>
+Object::Value
 Evaluator::evalMinusPrefixOperatorExpression(Object::IObject *right) {
   if (right->Type() != Object::ObjectType::INTEGER_OBJ) {
     return newError(std::format("unknown operator: -{}",
                                 Object::objectTypeToStr(right->Type())));
   }
-  auto value = dynamic_cast<Object::Integer *>(right)->m_value;
-  return std::make_shared<Object::Integer>(-value);
+  auto value = static_cast<Object::Integer *>(right)->m_value;
+  return Object::Value::Int(-value);
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalInfixExpression(const std::string &op, Object::IObject *left,
-                               Object::IObject *right) {
+// Infix operators are dispatched on (left type, operator, right type)
+// through a table of handlers, every pair the language has no meaning for
+// ends up in unsupportedInfix.
+namespace {
+using InfixHandler = Object::Value (*)(Ast::Operator op,
+                                       const Object::Value &left,
+                                       const Object::Value &right);
 
-  if (left->Type() == Object::ObjectType::INTEGER_OBJ &&
-      right->Type() == Object::ObjectType::INTEGER_OBJ) {
-    return evalIntegerInfixExpression(op, left, right);
+// integers are usually inline in the Value, but can still come boxed
+long int integerOf(const Object::Value &value) {
+  if (value.IsInteger()) {
+    return value.AsInteger();
   }
+  return static_cast<Object::Integer *>(value.get())->m_value;
+}
 
-  if (left->Type() == Object::ObjectType::BOOLEAN_OBJ &&
-      right->Type() == Object::ObjectType::BOOLEAN_OBJ) {
-    return evalBooleanInfixExpression(op, left, right);
+template <Ast::Operator Op>
+Object::Value integerInfix(Ast::Operator /*op*/, const Object::Value &left,
+                           const Object::Value &right) {
+  auto leftVal = integerOf(left);
+  auto rightVal = integerOf(right);
+  if constexpr (Op == Ast::Operator::PLUS) {
+    return Object::Value::Int(leftVal + rightVal);
+  } else if constexpr (Op == Ast::Operator::MINUS) {
+    return Object::Value::Int(leftVal - rightVal);
+  } else if constexpr (Op == Ast::Operator::ASTERISK) {
+    return Object::Value::Int(leftVal * rightVal);
+  } else if constexpr (Op == Ast::Operator::SLASH) {
+    if (rightVal == 0) {
+      return Evaluator::newError("division by zero");
+    }
+    return Object::Value::Int(leftVal / rightVal);
+  } else if constexpr (Op == Ast::Operator::LT) {
+    return nativeBoolToBoolObject(leftVal < rightVal);
+  } else if constexpr (Op == Ast::Operator::GT) {
+    return nativeBoolToBoolObject(leftVal > rightVal);
+  } else if constexpr (Op == Ast::Operator::EQ) {
+    return nativeBoolToBoolObject(leftVal == rightVal);
+  } else {
+    static_assert(Op == Ast::Operator::NOT_EQ);
+    return nativeBoolToBoolObject(leftVal != rightVal);
   }
+}
 
-  if (left->Type() == Object::ObjectType::STRING_OBJ &&
-      right->Type() == Object::ObjectType::STRING_OBJ) {
-    return evalStringInfixExpression(op, left, right);
-  }
+template <bool Equal>
+Object::Value booleanEquality(Ast::Operator /*op*/, const Object::Value &left,
+                              const Object::Value &right) {
+  bool same = static_cast<Object::Boolean *>(left.get())->m_value ==
+              static_cast<Object::Boolean *>(right.get())->m_value;
+  return nativeBoolToBoolObject(same == Equal);
+}
 
-  if (left->Type() != right->Type()) {
-    return newError(std::format("type mismatch: {} {} {}",
-                                Object::objectTypeToStr(left->Type()), op,
-                                Object::objectTypeToStr(right->Type())));
-  }
+Object::Value booleanUnsupported(Ast::Operator op,
+                                 const Object::Value & /*left*/,
+                                 const Object::Value & /*right*/) {
+  return Evaluator::newError(
+    std::format("Unsupported infix operator for booleans. Got {} "
+                "expected == or !=",
+                Ast::OperatorString(op)));
+}
 
-  return newError(std::format("unknown operator: {} {} {}",
-                              Object::objectTypeToStr(left->Type()), op,
-                              Object::objectTypeToStr(right->Type())));
+Object::Value stringConcat(Ast::Operator /*op*/, const Object::Value &left,
+                           const Object::Value &right) {
+  return Object::String::Concat(left, right);
 }
 
-std::shared_ptr<Object::IObject> Evaluator::evalBooleanInfixExpression(
-  const std::string &op, Object::IObject *left, Object::IObject *right) {
-  auto *leftPtr = dynamic_cast<Object::Boolean *>(left);
-  auto *rightPtr = dynamic_cast<Object::Boolean *>(right);
+template <bool Equal>
+Object::Value stringEquality(Ast::Operator /*op*/, const Object::Value &left,
+                             const Object::Value &right) {
+  auto *leftVal = static_cast<Object::String *>(left.get());
+  auto *rightVal = static_cast<Object::String *>(right.get());
+  // strings of different lengths are unequal without flattening either
+  bool same = leftVal->Length() == rightVal->Length() &&
+              leftVal->Flat() == rightVal->Flat();
+  return nativeBoolToBoolObject(same == Equal);
+}
 
-  auto leftVal = leftPtr->m_value;
-  auto rightVal = rightPtr->m_value;
-  if (Token::tokenMap.find(op) != Token::tokenMap.end()) {
-    switch (Token::tokenMap.at(op)) {
-    case Token::EQ:
-      return nativeBoolToBoolObject(leftVal == rightVal);
-    case Token::NOT_EQ:
-      return nativeBoolToBoolObject(leftVal != rightVal);
-    default:
-      return std::make_shared<Object::Error>(
-        std::format("Unsupported infix operator for booleans. Got {} "
-                    "expected == or !=",
-                    op));
-    }
-  } else {
-    return std::make_shared<Object::Error>(
-      std::format("{} is not a valid operator", op));
-  }
-}
-
-std::shared_ptr<Object::IObject> Evaluator::evalStringInfixExpression(
-  const std::string &op, Object::IObject *left, Object::IObject *right) {
-  auto leftVal = dynamic_cast<Object::String *>(left);
-  auto rightVal = dynamic_cast<Object::String *>(right);
-  auto opIter = Token::tokenMap.find(op);
-  if (opIter != Token::tokenMap.end()) {
-    switch (opIter->second) {
-    case Token::PLUS:
-      return std::make_shared<Object::String>(leftVal->m_value +
-                                              rightVal->m_value);
-    case Token::EQ:
-      return nativeBoolToBoolObject(leftVal->m_value == rightVal->m_value);
-    case Token::NOT_EQ:
-      return nativeBoolToBoolObject(leftVal->m_value != rightVal->m_value);
-    default:
-      break;
+Object::Value unsupportedInfix(Ast::Operator op, const Object::Value &left,
+                               const Object::Value &right) {
+  auto leftType = left.Type();
+  auto rightType = right.Type();
+  return Evaluator::newError(
+    std::format("{}: {} {} {}",
+                leftType != rightType ? "type mismatch" : "unknown operator",
+                Object::objectTypeToStr(leftType), Ast::OperatorString(op),
+                Object::objectTypeToStr(rightType)));
+}
+
+using InfixTable = std::array<
+  std::array<std::array<InfixHandler, Object::ObjectTypeCount>,
+             Ast::OperatorCount>,
+  Object::ObjectTypeCount>;
+
+constexpr std::size_t idx(Object::ObjectType type) {
+  return static_cast<std::size_t>(type);
+}
+constexpr std::size_t idx(Ast::Operator op) {
+  return static_cast<std::size_t>(op);
+}
+
+constexpr InfixTable infixHandlers = [] {
+  InfixTable table{};
+  for (auto &byOp : table) {
+    for (auto &byRight : byOp) {
+      byRight.fill(&unsupportedInfix);
     }
   }
-  return newError(std::format("unknown operator: {} {} {}",
-                              Object::objectTypeToStr(leftVal->Type()), op,
-                              Object::objectTypeToStr(rightVal->Type())));
-}
-
-std::shared_ptr<Object::IObject> Evaluator::evalIntegerInfixExpression(
-  const std::string &op, Object::IObject *left, Object::IObject *right) {
-  auto leftVal = dynamic_cast<Object::Integer *>(left)->m_value;
-  auto rightVal = dynamic_cast<Object::Integer *>(right)->m_value;
-  auto opIter = Token::tokenMap.find(op);
-
-  if (opIter != Token::tokenMap.end()) {
-    switch (opIter->second) {
-    case Token::PLUS:
-      return std::make_shared<Object::Integer>(leftVal + rightVal);
-    case Token::MINUS:
-      return std::make_shared<Object::Integer>(leftVal - rightVal);
-    case Token::ASTERISK:
-      return std::make_shared<Object::Integer>(leftVal * rightVal);
-    case Token::SLASH:
-      return std::make_shared<Object::Integer>(leftVal / rightVal);
-    case Token::LT:
-      return nativeBoolToBoolObject(leftVal < rightVal);
-    case Token::GT:
-      return nativeBoolToBoolObject(leftVal > rightVal);
-    case Token::EQ:
-      return nativeBoolToBoolObject(leftVal == rightVal);
-    case Token::NOT_EQ:
-      return nativeBoolToBoolObject(leftVal != rightVal);
-    default:
-      break;
-    }
+
+  using Ast::Operator;
+  using Object::ObjectType;
+  auto &integers = table[idx(ObjectType::INTEGER_OBJ)];
+  auto integer = idx(ObjectType::INTEGER_OBJ);
+  integers[idx(Operator::PLUS)][integer] = &integerInfix<Operator::PLUS>;
+  integers[idx(Operator::MINUS)][integer] = &integerInfix<Operator::MINUS>;
+  integers[idx(Operator::ASTERISK)][integer] =
+    &integerInfix<Operator::ASTERISK>;
+  integers[idx(Operator::SLASH)][integer] = &integerInfix<Operator::SLASH>;
+  integers[idx(Operator::LT)][integer] = &integerInfix<Operator::LT>;
+  integers[idx(Operator::GT)][integer] = &integerInfix<Operator::GT>;
+  integers[idx(Operator::EQ)][integer] = &integerInfix<Operator::EQ>;
+  integers[idx(Operator::NOT_EQ)][integer] = &integerInfix<Operator::NOT_EQ>;
+
+  auto &booleans = table[idx(ObjectType::BOOLEAN_OBJ)];
+  auto boolean = idx(ObjectType::BOOLEAN_OBJ);
+  for (auto &byRight : booleans) {
+    byRight[boolean] = &booleanUnsupported;
   }
-  return newError(std::format("unknown operator: {} {} {}",
-                              Object::objectTypeToStr(left->Type()), op,
-                              Object::objectTypeToStr(right->Type())));
+  booleans[idx(Operator::EQ)][boolean] = &booleanEquality<true>;
+  booleans[idx(Operator::NOT_EQ)][boolean] = &booleanEquality<false>;
+
+  auto &strings = table[idx(ObjectType::STRING_OBJ)];
+  auto string = idx(ObjectType::STRING_OBJ);
+  strings[idx(Operator::PLUS)][string] = &stringConcat;
+  strings[idx(Operator::EQ)][string] = &stringEquality<true>;
+  strings[idx(Operator::NOT_EQ)][string] = &stringEquality<false>;
+  return table;
+}();
+} // namespace
+
+Object::Value Evaluator::evalInfixExpression(Ast::Operator op,
+                                             const Object::Value &leftVal,
+                                             const Object::Value &rightVal) {
+  auto handler =
+    infixHandlers[idx(leftVal.Type())][idx(op)][idx(rightVal.Type())];
+  return handler(op, leftVal, rightVal);
 }
 
 bool Evaluator::isTruthy(const Object::IObject *const obj) {
@@ -387,7 +992,7 @@ bool Evaluator::isTruthy(const Object::IObject *const obj) {
   case Object::ObjectType::NULL_OBJ:
     return false;
   case Object::ObjectType::BOOLEAN_OBJ: {
-    const auto *boolObj = dynamic_cast<const Object::Boolean *>(obj);
+    const auto *boolObj = static_cast<const Object::Boolean *>(obj);
     return boolObj->m_value;
   }
   default:
@@ -395,66 +1000,116 @@ bool Evaluator::isTruthy(const Object::IObject *const obj) {
   }
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalIfExpression(const Ast::IfExpression *const ifExpr,
-                            const std::shared_ptr<Object::Environment> &env) {
-  auto condition = Eval(ifExpr->m_condition.get(), env);
-  if (isError(condition.get())) {
-    return condition;
-  }
-  if (isTruthy(condition.get())) {
-    return Eval(ifExpr->m_consequence.get(), env);
-  } else if (ifExpr->m_alternative != nullptr) {
-    return Eval(ifExpr->m_alternative.get(), env);
-  } else {
-    return NULL_O;
-  }
-}
-
 std::shared_ptr<Object::Error>
 Evaluator::newError(const std::string &errorMsg) {
   return std::make_shared<Object::Error>(errorMsg);
 }
 
-bool Evaluator::isError(const Object::IObject *const obj) {
-  if (obj != nullptr) {
+void Evaluator::locate(const Object::Value &error, Ast::INode *node) {
+  auto *err = static_cast<Object::Error *>(error.get());
+  if (err->m_offset == Token::NoOffset) {
+    err->m_offset = Ast::OffsetOf(node);
+    err->m_source = Ast::SourceOf(node);
+  }
+}
+
+bool Evaluator::isError(const Object::Value &obj) {
+  if (obj != nullptr && !obj.IsInteger()) {
     return obj->Type() == Object::ObjectType::ERROR_OBJ;
   }
   return false;
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalIdentifier(Ast::INode *node,
-                          const std::shared_ptr<Object::Environment> &env) {
+Evaluator::CacheStats &Evaluator::CacheStatistics() {
+  thread_local CacheStats stats;
+  return stats;
+}
 
-  auto *ident = dynamic_cast<Ast::Identifier *>(node);
-  auto lookup = env->Get(ident->m_value);
-  if (lookup.ok) {
-    return lookup.obj;
+// The cache holds while no name has been declared since it was filled,
+// which covers a let that binds the name closer to the site. It isn't
+// filled when a closer scope has the name declared but not yet bound, that
+// binding could appear without a declaration.
+Object::Value Evaluator::lookupIdentifier(Ast::Identifier *ident,
+                                          Object::Environment *env) {
+  auto &cache = ident->m_cache;
+  auto generation = Ast::ScopeLayout::Generation();
+  if (cache.m_generation == generation &&
+      cache.m_origin == env->Layout().get()) {
+    if (cache.m_builtin >= 0) {
+      count(&CacheStats::m_lookupHits);
+      return Builtins::builtinList[static_cast<size_t>(cache.m_builtin)]
+        .builtin;
+    }
+    auto *scope = env->Outer(cache.m_depth);
+    if (scope != nullptr && scope->Layout().get() == cache.m_layout) {
+      const auto &obj = scope->GetAt(0, cache.m_slot);
+      if (obj != nullptr) {
+        count(&CacheStats::m_lookupHits);
+        return obj;
+      }
+    }
   }
-  if (Builtins::builtins.contains(ident->m_value)) {
-    return Builtins::builtins[ident->m_value];
+  count(&CacheStats::m_lookupMisses);
+
+  auto name = ident->m_symbol;
+  cache = {};
+  bool shadowed = false;
+  int depth = 0;
+  for (auto *scope = env; scope != nullptr; scope = scope->Outer(1)) {
+    int slot = scope->Layout()->Find(name);
+    if (slot >= 0) {
+      const auto &obj = scope->GetAt(0, slot);
+      if (obj != nullptr) {
+        if (!shadowed) {
+          cache = {.m_generation = generation,
+                   .m_origin = env->Layout().get(),
+                   .m_layout = scope->Layout().get(),
+                   .m_depth = depth,
+                   .m_slot = slot};
+        }
+        return obj;
+      }
+      shadowed = true;
+    }
+    depth++;
+  }
+  int builtin = ident->m_builtin;
+  for (size_t i = 0; builtin < 0 && i < Builtins::builtinList.size(); i++) {
+    if (Builtins::builtinList[i].name == name) {
+      builtin = static_cast<int>(i);
+    }
+  }
+  if (builtin >= 0) {
+    if (!shadowed) {
+      cache = {.m_generation = generation,
+               .m_origin = env->Layout().get(),
+               .m_builtin = builtin};
+    }
+    return Builtins::builtinList[static_cast<size_t>(builtin)].builtin;
   }
-  return newError(std::format("identifier not found: {}", ident->m_value));
+  return newError(
+    std::format("identifier not found: {}", Symbols::Name(name)));
 }
 
-std::shared_ptr<Object::IObject>
-Evaluator::evalIndexExpression(const std::shared_ptr<Object::IObject> &left,
-                               const std::shared_ptr<Object::IObject> &index) {
+Object::Value Evaluator::evalIndexExpression(const Object::Value &left,
+                                             const Object::Value &index) {
   if (left->Type() == Object::ObjectType::ARRAY_OBJ &&
       index->Type() == Object::ObjectType::INTEGER_OBJ) {
     return evalArrayIndexExpression(left, index);
   }
+  if (left->Type() == Object::ObjectType::HASH_OBJ) {
+    return evalHashIndexExpression(left, index);
+  }
   // if none of the above are true return an error
   return newError("index operator not supported: " +
                   Object::objectTypeToStr(left->Type()));
 }
 
-std::shared_ptr<Object::IObject> Evaluator::evalArrayIndexExpression(
-  const std::shared_ptr<Object::IObject> &array,
-  const std::shared_ptr<Object::IObject> &index) {
-  auto arrObj = dynamic_cast<Object::Array *>(array.get());
-  auto idx = dynamic_cast<Object::Integer *>(index.get())->m_value;
+Object::Value
+Evaluator::evalArrayIndexExpression(const Object::Value &array,
+                                    const Object::Value &index) {
+  auto arrObj = static_cast<Object::Array *>(array.get());
+  auto idx = static_cast<Object::Integer *>(index.get())->m_value;
   auto max = std::ssize(arrObj->m_elements) - 1;
   if (idx < 0 || idx > max) {
     return NULL_O;
@@ -462,4 +1117,20 @@ std::shared_ptr<Object::IObject> Evaluator::evalArrayIndexExpression(
   return arrObj->m_elements[static_cast<size_t>(idx)];
 }
 
+Object::Value
+Evaluator::evalHashIndexExpression(const Object::Value &hash,
+                                   const Object::Value &index) {
+  auto *hashObj = static_cast<Object::Hash *>(hash.get());
+  auto key = Object::HashKeyOf(index);
+  if (!key) {
+    return newError("unusable as hash key: " +
+                    Object::objectTypeToStr(index->Type()));
+  }
+  const auto *pair = hashObj->Find(*key, index);
+  if (pair == nullptr) {
+    return NULL_O;
+  }
+  return pair->m_value;
+}
+
 } // namespace Evaluator
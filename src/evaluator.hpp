@@ -1,91 +1,162 @@
 #pragma once
 #include "ast.hpp"
+#include "gc.hpp"
 #include "object.hpp"
+#include <cstddef>
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 namespace Evaluator {
 
-extern std::shared_ptr<Object::Null> NULL_O;
-extern std::shared_ptr<Object::Boolean> TRUE;
-extern std::shared_ptr<Object::Boolean> FALSE;
-class Evaluator {
+extern const Object::Value NULL_O;
+extern const Object::Value TRUE;
+extern const Object::Value FALSE;
+// Nodes are compiled into a tree of closures (Object::CompiledNode) that is
+// then run, see compile.
+//
+// Roots the collector needs from the evaluator are the environments of the
+// calls in progress and the values a caller still holds while it evaluates
+// something else. The heap only collects when a function is applied or
+// between top level statements, so only what is held across a nested Eval
+// has to be rooted.
+class Evaluator : public Gc::RootSource {
 public:
-  std::shared_ptr<Object::IObject>
+  // env is pinned by the caller, typically the repl's global environment
+  Object::Value
   Eval(Ast::INode *node, const std::shared_ptr<Object::Environment> &env);
-  std::shared_ptr<Object::IObject>
-  evalProgram(Ast::Program *program,
-              const std::shared_ptr<Object::Environment> &env);
+  Object::Value Eval(Ast::INode *node, Object::Environment *env);
+  Object::Value evalProgram(Ast::Program *program, Object::Environment *env);
+
+  void TraceRoots(Gc::Heap &heap) const override;
 
   // public so it can be used elsewhere
   static std::shared_ptr<Object::Error> newError(const std::string &errorMsg);
 
-private:
-  // methods
-  std::shared_ptr<Object::IObject>
-  evalStatements(std::vector<std::unique_ptr<Ast::IStatement>> &stmts,
-                 const std::shared_ptr<Object::Environment> &env);
-
-  static std::shared_ptr<Object::IObject>
-  evalPrefixExpression(const std::string &op,
-                       const std::shared_ptr<Object::IObject> &right);
-
-  static std::shared_ptr<Object::IObject>
-  evalBangOperatorExpression(Object::IObject *right);
-
-  static std::shared_ptr<Object::IObject>
-  evalMinusPrefixOperatorExpression(Object::IObject *right);
-
-  static std::shared_ptr<Object::IObject>
-  evalInfixExpression(const std::string &op, Object::IObject *left,
-                      Object::IObject *right);
-
-  static std::shared_ptr<Object::IObject>
-  evalIntegerInfixExpression(const std::string &op, Object::IObject *left,
-                             Object::IObject *right);
+  // also used by the vm so both engines share the same semantics
+  static Object::Value
+  evalPrefixExpression(Ast::Operator op, const Object::Value &right);
 
-  static std::shared_ptr<Object::IObject>
-  evalBooleanInfixExpression(const std::string &op, Object::IObject *left,
-                             Object::IObject *right);
-
-  static std::shared_ptr<Object::IObject>
-  evalStringInfixExpression(const std::string &op, Object::IObject *left,
-                            Object::IObject *right);
+  static Object::Value evalInfixExpression(Ast::Operator op,
+                                           const Object::Value &leftVal,
+                                           const Object::Value &rightVal);
 
   static bool isTruthy(const Object::IObject *const obj);
 
-  std::shared_ptr<Object::IObject>
-  evalIfExpression(const Ast::IfExpression *const ifExpr,
-                   const std::shared_ptr<Object::Environment> &env);
-
-  static bool isError(const Object::IObject *const obj);
-
-  std::vector<std::shared_ptr<Object::IObject>>
-  evalExpressions(const std::vector<std::unique_ptr<Ast::IExpression>> &exps,
-                  const std::shared_ptr<Object::Environment> &env);
-
-  std::shared_ptr<Object::IObject>
-  applyFunction(const std::shared_ptr<Object::IObject> &fn,
-                const std::vector<std::shared_ptr<Object::IObject>> &args);
+  static Object::Value
+  evalIndexExpression(const Object::Value &left, const Object::Value &index);
+
+  // also used by the stack evaluator
+  static bool isError(const Object::Value &obj);
+  // Gives an error where it came from, unless somewhere further in already
+  // did
+  static void locate(const Object::Value &error, Ast::INode *node);
+  // Looks up an identifier the resolver left without a usable address,
+  // going straight to where it was found the last time when that is still
+  // where it would be found
+  static Object::Value lookupIdentifier(Ast::Identifier *ident,
+                                        Object::Environment *env);
+
+  // Counts for the caches at identifier and call sites on this thread. Only
+  // kept when built with MONKEY_CACHE_STATS (cmake -DCACHE_STATS=ON), they
+  // stay 0 otherwise and the lookups don't pay for counting.
+  struct CacheStats {
+    std::size_t m_lookupHits = 0;
+    std::size_t m_lookupMisses = 0;
+    // calls to the same function as the last one at the site
+    std::size_t m_callHits = 0;
+    std::size_t m_callMisses = 0;
+  };
+  static CacheStats &CacheStatistics();
+#ifdef MONKEY_CACHE_STATS
+  static constexpr bool CountsCaches = true;
+#else
+  static constexpr bool CountsCaches = false;
+#endif
 
-  static std::shared_ptr<Object::Environment>
-  extendFunctionEnv(Object::Function *fn,
-                    const std::vector<std::shared_ptr<Object::IObject>> &args);
-
-  static std::shared_ptr<Object::IObject>
-  unwrapReturnValue(std::shared_ptr<Object::IObject> obj);
+private:
+  static void count(std::size_t CacheStats::*counter) {
+    if constexpr (CountsCaches) {
+      ++(CacheStatistics().*counter);
+    }
+  }
+
+  std::vector<Object::Value> m_roots;
+  std::vector<Object::Environment *> m_envs;
+  // environments of finished calls, ready to be reused, see extendFunctionEnv
+  std::vector<Object::Environment *> m_framePool;
+  static constexpr std::size_t MaxPooledFrames = 256;
+  // set by a return statement until the call it returns from takes it
+  Object::Value m_returnValue;
+  // a call in tail position waiting to be made in place of the one it ends,
+  // see callFunction
+  Object::Value m_tailCallee;
+  std::vector<Object::Value> m_tailArgs;
+
+  // Roots values for as long as it lives
+  class RootScope {
+  public:
+    explicit RootScope(std::vector<Object::Value> &roots)
+      : m_roots(roots), m_mark(roots.size()) {}
+    RootScope(const RootScope &) = delete;
+    RootScope &operator=(const RootScope &) = delete;
+    RootScope(RootScope &&) = delete;
+    RootScope &operator=(RootScope &&) = delete;
+    ~RootScope() { m_roots.resize(m_mark); }
+    void Add(const Object::Value &value) { m_roots.push_back(value); }
+
+  private:
+    std::vector<Object::Value> &m_roots;
+    std::size_t m_mark;
+  };
+
+  // compiles nodes into closures, defined in evaluator.cpp
+  class NodeCompiler;
 
-  static std::shared_ptr<Object::IObject>
-  evalIdentifier(Ast::INode *node,
-                 const std::shared_ptr<Object::Environment> &env);
+  // methods
+  static Object::CompiledNode compile(Ast::INode *node);
+  template <typename NodePtr, typename Alloc>
+  static std::vector<Object::CompiledNode>
+  compileAll(const std::vector<NodePtr, Alloc> &nodes);
+  static Object::Value evalBangOperatorExpression(Object::IObject *right);
 
-  static std::shared_ptr<Object::IObject>
-  evalIndexExpression(const std::shared_ptr<Object::IObject> &left,
-                      const std::shared_ptr<Object::IObject> &index);
+  static Object::Value
+  evalMinusPrefixOperatorExpression(Object::IObject *right);
 
-  static std::shared_ptr<Object::IObject>
-  evalArrayIndexExpression(const std::shared_ptr<Object::IObject> &array,
-                           const std::shared_ptr<Object::IObject> &index);
+  // Evaluates exps and adds them to roots in order, stops at and returns
+  // the first error
+  Object::Value evalExpressions(const std::vector<Object::CompiledNode> &exps,
+                                Object::Environment *env, RootScope &roots);
+
+  Object::Value applyFunction(const Object::Value &fn,
+                              std::span<const Object::Value> args);
+  // the same, from a call site that remembers the function it last called
+  Object::Value applyFunction(Ast::CallExpression *site,
+                              const Object::Value &fn,
+                              std::span<const Object::Value> args);
+
+  Object::Value callFunction(Object::Function *function,
+                             std::span<const Object::Value> args);
+  // callFunction once the arity has been checked
+  Object::Value enterFunction(Object::Function *function,
+                              std::span<const Object::Value> args);
+  Object::Value runTailCall();
+  static Object::Value checkArity(Object::Function *function,
+                                  std::size_t argc);
+
+  Object::Environment *extendFunctionEnv(Object::Function *fn,
+                                         std::span<const Object::Value> args);
+  void releaseFunctionEnv(Object::Function *fn, Object::Environment *env);
+
+  // result, or the pending return value if there is one
+  Object::Value takeReturnValue(Object::Value result);
+
+  static Object::Value
+  evalArrayIndexExpression(const Object::Value &array,
+                           const Object::Value &index);
+
+  static Object::Value evalHashIndexExpression(const Object::Value &hash,
+                                               const Object::Value &index);
 };
 
 } // namespace Evaluator
@@ -0,0 +1,101 @@
+#include "gc.hpp"
+#include <algorithm>
+#include <chrono>
+namespace Gc {
+
+RootSource::RootSource() : m_heap(&Heap::Current()) {
+  m_heap->m_rootSources.push_back(this);
+}
+
+RootSource::RootSource(const RootSource & /*other*/) : RootSource() {}
+
+RootSource::~RootSource() {
+  auto &sources = m_heap->m_rootSources;
+  sources.erase(std::find(sources.begin(), sources.end(), this));
+}
+
+Heap::~Heap() {
+  while (m_objects != nullptr) {
+    Header *next = m_objects->m_next;
+    destroy(m_objects);
+    m_objects = next;
+  }
+}
+
+Heap &Heap::Current() {
+  static thread_local Heap heap;
+  return heap;
+}
+
+void *Heap::allocate(std::size_t size) {
+  return static_cast<Header *>(::operator new(sizeof(Header) + size)) + 1;
+}
+
+void Heap::deallocate(void *mem) {
+  ::operator delete(static_cast<Header *>(mem) - 1);
+}
+
+void Heap::link(void *mem, std::size_t size) {
+  auto *header = new (static_cast<Header *>(mem) - 1)
+    Header{.m_next = m_objects,
+           .m_size = static_cast<std::uint32_t>(size),
+           .m_pins = 0,
+           .m_marked = false};
+  m_objects = header;
+  m_stats.m_liveObjects++;
+  m_stats.m_liveBytes += size;
+  m_stats.m_allocatedObjects++;
+  m_stats.m_allocatedBytes += size;
+}
+
+void Heap::destroy(Header *header) {
+  auto *obj = reinterpret_cast<Collectable *>(header + 1);
+  obj->~Collectable();
+  ::operator delete(header);
+}
+
+void Heap::Collect() {
+  auto start = std::chrono::steady_clock::now();
+
+  for (Header *header = m_objects; header != nullptr;
+       header = header->m_next) {
+    if (header->m_pins > 0) {
+      Mark(reinterpret_cast<Collectable *>(header + 1));
+    }
+  }
+  for (const auto *source : m_rootSources) {
+    source->TraceRoots(*this);
+  }
+  // an explicit grey list instead of recursion, long chains of
+  // environments or nested arrays would overflow the stack otherwise
+  while (!m_grey.empty()) {
+    const Collectable *obj = m_grey.back();
+    m_grey.pop_back();
+    obj->Trace(*this);
+  }
+
+  Header **prev = &m_objects;
+  while (*prev != nullptr) {
+    Header *header = *prev;
+    if (header->m_marked) {
+      header->m_marked = false;
+      prev = &header->m_next;
+      continue;
+    }
+    *prev = header->m_next;
+    m_stats.m_liveObjects--;
+    m_stats.m_liveBytes -= header->m_size;
+    m_stats.m_freedObjects++;
+    m_stats.m_freedBytes += header->m_size;
+    destroy(header);
+  }
+  m_threshold = std::max(MinThreshold, m_stats.m_liveBytes * 2);
+
+  auto pause = std::chrono::steady_clock::now() - start;
+  m_stats.m_collections++;
+  m_stats.m_totalPause += pause;
+  m_stats.m_maxPause = std::max<std::chrono::nanoseconds>(
+    m_stats.m_maxPause, pause);
+}
+
+} // namespace Gc
@@ -0,0 +1,173 @@
+#pragma once
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+namespace Gc {
+
+class Heap;
+
+// Base of everything the heap owns. Trace has to Mark every collectable the
+// object points at, directly or through a Value.
+class Collectable {
+public:
+  Collectable() = default;
+  Collectable(const Collectable &) = default;
+  Collectable &operator=(const Collectable &) = default;
+  Collectable(Collectable &&) = default;
+  Collectable &operator=(Collectable &&) = default;
+  virtual ~Collectable() = default;
+  virtual void Trace(Heap & /*heap*/) const {}
+};
+
+// Something outside the heap that holds on to collectables, like the
+// evaluator's stack or the vm's. It is registered with the current heap for
+// as long as it lives and asked for its roots on every collection.
+class RootSource {
+public:
+  RootSource();
+  RootSource(const RootSource &other);
+  RootSource &operator=(const RootSource &) { return *this; }
+  RootSource(RootSource &&) = delete;
+  RootSource &operator=(RootSource &&) = delete;
+  virtual ~RootSource();
+  virtual void TraceRoots(Heap &heap) const = 0;
+
+private:
+  Heap *m_heap;
+};
+
+struct Stats {
+  std::size_t m_collections = 0;
+  std::size_t m_liveObjects = 0;
+  std::size_t m_liveBytes = 0;
+  // totals since the heap was created
+  std::size_t m_allocatedObjects = 0;
+  std::size_t m_allocatedBytes = 0;
+  std::size_t m_freedObjects = 0;
+  std::size_t m_freedBytes = 0;
+  std::chrono::nanoseconds m_totalPause{0};
+  std::chrono::nanoseconds m_maxPause{0};
+};
+
+// Mark and sweep heap for runtime objects and environments. Copying a
+// pointer to a collectable costs nothing, instead everything reachable from
+// the registered root sources and from pinned objects survives a collection
+// and the rest is freed, cycles included.
+//
+// Collections only happen at Safepoint, never inside Make, so code that
+// holds on to fresh objects between safepoints doesn't have to root them.
+class Heap {
+public:
+  Heap() = default;
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+  Heap(Heap &&) = delete;
+  Heap &operator=(Heap &&) = delete;
+  // frees everything, pinned or not
+  ~Heap();
+
+  // The heap of the calling thread
+  static Heap &Current();
+
+  template <typename T, typename... Args> T *Make(Args &&...args) {
+    static_assert(std::is_base_of_v<Collectable, T>);
+    static_assert(alignof(T) <= alignof(Header));
+    void *mem = allocate(sizeof(T));
+    T *obj = nullptr;
+    try {
+      obj = new (mem) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(mem);
+      throw;
+    }
+    // headerOf relies on the collectable being at the start of the object
+    assert(static_cast<void *>(static_cast<Collectable *>(obj)) == mem);
+    link(mem, sizeof(T));
+    return obj;
+  }
+
+  // Called from Trace, and from TraceRoots for the roots themselves
+  void Mark(const Collectable *obj) {
+    if (obj == nullptr) {
+      return;
+    }
+    Header *header = headerOf(obj);
+    if (!header->m_marked) {
+      header->m_marked = true;
+      m_grey.push_back(obj);
+    }
+  }
+
+  // Collects if enough has been allocated since the last collection. Only
+  // call it where every live object is reachable from a root.
+  void Safepoint() {
+    if (m_stats.m_liveBytes >= m_threshold) {
+      Collect();
+    }
+  }
+  void Collect();
+
+  // Pinned objects are roots. Used for handles held by C++ code, see Pin.
+  static void Pin(const Collectable *obj) {
+    Header *header = headerOf(obj);
+    assert(header->m_pins < MaxPins);
+    header->m_pins++;
+  }
+  static void Unpin(const Collectable *obj) {
+    Header *header = headerOf(obj);
+    assert(header->m_pins > 0);
+    header->m_pins--;
+  }
+
+  [[nodiscard]] const Stats &Statistics() const { return m_stats; }
+
+private:
+  friend class RootSource;
+
+  // The pin count takes every bit the mark bit leaves, so it is as wide as
+  // it can be without growing the header
+  struct alignas(std::max_align_t) Header {
+    Header *m_next;
+    std::uint32_t m_size;
+    std::uint32_t m_pins : 31;
+    std::uint32_t m_marked : 1;
+  };
+  static constexpr std::uint32_t MaxPins = (1U << 31) - 1;
+
+  // collect again once this much is live, grows with the live set so the
+  // time spent collecting stays proportional to what is allocated
+  static constexpr std::size_t MinThreshold = 1024 * 1024;
+
+  Header *m_objects = nullptr;
+  std::vector<const Collectable *> m_grey;
+  std::vector<const RootSource *> m_rootSources;
+  std::size_t m_threshold = MinThreshold;
+  Stats m_stats;
+
+  static Header *headerOf(const Collectable *obj) {
+    return reinterpret_cast<Header *>(const_cast<Collectable *>(obj)) - 1;
+  }
+  static void *allocate(std::size_t size);
+  static void deallocate(void *mem);
+  void link(void *mem, std::size_t size);
+  static void destroy(Header *header);
+};
+
+// A shared_ptr that keeps a collectable alive for as long as it (or a copy)
+// is around, for the global environment of the repl and for results handed
+// to code outside the evaluator. It must not outlive the heap.
+template <typename T> std::shared_ptr<T> Pin(T *obj) {
+  if (obj == nullptr) {
+    return nullptr;
+  }
+  Heap::Pin(obj);
+  return std::shared_ptr<T>(obj, [](T *pinned) { Heap::Unpin(pinned); });
+}
+
+} // namespace Gc
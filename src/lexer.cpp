@@ -1,201 +1,599 @@
 #include "lexer.hpp"
+#include "symbols.hpp"
 #include "token.hpp"
-#include <cctype>
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace Lexer {
 
-Lexer::Lexer(std::string input) : m_input(std::move(input)) { readChar(); }
+namespace {
 
-Token::Token Lexer::NextToken() {
-  Token::Token tok{};
-  skipWhitespace();
-  switch (m_ch) {
-  case 0:
-    tok.Type = Token::EOF_;
-    tok.Literal = "";
-    break;
-  case '=':
-    if (peekChar() == '=') {
-      char ch = m_ch;
-      readChar();
-      std::string literal = std::string() + ch + m_ch;
-      tok.Type = Token::EQ;
-      tok.Literal = literal;
-    } else {
-      tok.Type = Token::ASSIGN;
-      ;
-      tok.Literal = m_ch;
+enum class CharClass : std::uint8_t {
+  OTHER,
+  // a NUL or the end of the input
+  END,
+  SPACE,
+  LETTER,
+  DIGIT,
+  QUOTE,
+  // a token of its own
+  SINGLE,
+  // a token of its own, or the first of two when followed by =
+  WITH_EQ,
+};
+
+struct CharInfo {
+  CharClass Class = CharClass::OTHER;
+  Token::TokenType Type = Token::ILLEGAL;
+  // for WITH_EQ, the token when followed by =
+  Token::TokenType WithEq = Token::ILLEGAL;
+};
+
+constexpr std::array<CharInfo, 256> charTable = [] {
+  std::array<CharInfo, 256> table{};
+  auto set = [&](char ch, CharInfo info) {
+    table[static_cast<unsigned char>(ch)] = info;
+  };
+  set('\0', {.Class = CharClass::END, .Type = Token::EOF_});
+  for (char ch : {' ', '\t', '\n', '\r'}) {
+    set(ch, {.Class = CharClass::SPACE});
+  }
+  for (char ch = 'a'; ch <= 'z'; ch++) {
+    set(ch, {.Class = CharClass::LETTER, .Type = Token::IDENT});
+    set(static_cast<char>(ch - 'a' + 'A'),
+        {.Class = CharClass::LETTER, .Type = Token::IDENT});
+  }
+  set('_', {.Class = CharClass::LETTER, .Type = Token::IDENT});
+  for (char ch = '0'; ch <= '9'; ch++) {
+    set(ch, {.Class = CharClass::DIGIT, .Type = Token::INT});
+  }
+  set('"', {.Class = CharClass::QUOTE, .Type = Token::STRING});
+  using Single = std::pair<char, Token::TokenType>;
+  for (auto [ch, type] : std::initializer_list<Single>{
+         {'+', Token::PLUS},
+         {'-', Token::MINUS},
+         {'*', Token::ASTERISK},
+         {'/', Token::SLASH},
+         {'<', Token::LT},
+         {'>', Token::GT},
+         {',', Token::COMMA},
+         {';', Token::SEMICOLON},
+         {'(', Token::LPAREN},
+         {')', Token::RPAREN},
+         {'{', Token::LBRACE},
+         {'}', Token::RBRACE},
+         {'[', Token::LBRACKET},
+         {']', Token::RBRACKET},
+         {':', Token::COLON}}) {
+    set(ch, {.Class = CharClass::SINGLE, .Type = type});
+  }
+  set('=', {.Class = CharClass::WITH_EQ,
+            .Type = Token::ASSIGN,
+            .WithEq = Token::EQ});
+  set('!', {.Class = CharClass::WITH_EQ,
+            .Type = Token::BANG,
+            .WithEq = Token::NOT_EQ});
+  return table;
+}();
+
+CharClass classOf(char ch) {
+  return charTable[static_cast<unsigned char>(ch)].Class;
+}
+
+Token::Offset offsetOf(std::size_t pos) {
+  return pos < Token::NoOffset ? static_cast<Token::Offset>(pos)
+                               : Token::NoOffset;
+}
+
+#if defined(__AVX2__)
+struct Simd {
+  using Vec = __m256i;
+  static constexpr std::size_t Width = 32;
+  static constexpr std::uint32_t All = 0xFFFFFFFF;
+  static Vec Load(const char *ptr) {
+    return _mm256_loadu_si256(reinterpret_cast<const Vec *>(ptr));
+  }
+  static Vec Splat(char ch) { return _mm256_set1_epi8(ch); }
+  static Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+  // signed
+  static Vec Lt(Vec a, Vec b) { return _mm256_cmpgt_epi8(b, a); }
+  static Vec Add(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+  static Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+  static Vec Not(Vec a) { return _mm256_xor_si256(a, Splat(-1)); }
+  static std::uint32_t Mask(Vec a) {
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(a));
+  }
+};
+#elif defined(__SSE2__)
+struct Simd {
+  using Vec = __m128i;
+  static constexpr std::size_t Width = 16;
+  static constexpr std::uint32_t All = 0xFFFF;
+  static Vec Load(const char *ptr) {
+    return _mm_loadu_si128(reinterpret_cast<const Vec *>(ptr));
+  }
+  static Vec Splat(char ch) { return _mm_set1_epi8(ch); }
+  static Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+  // signed
+  static Vec Lt(Vec a, Vec b) { return _mm_cmplt_epi8(a, b); }
+  static Vec Add(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+  static Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+  static Vec Not(Vec a) { return _mm_xor_si128(a, Splat(-1)); }
+  static std::uint32_t Mask(Vec a) {
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(a));
+  }
+};
+#endif
+
+#if defined(__SSE2__)
+Simd::Vec equals(Simd::Vec bytes, char ch) {
+  return Simd::Eq(bytes, Simd::Splat(ch));
+}
+
+// bytes in [lo, lo + n). Moving lo to -128 turns the unsigned range check
+// into one signed compare.
+Simd::Vec inRange(Simd::Vec bytes, char lo, int n) {
+  auto shifted = Simd::Add(bytes, Simd::Splat(static_cast<char>(-128 - lo)));
+  return Simd::Lt(shifted, Simd::Splat(static_cast<char>(-128 + n)));
+}
+#endif
+
+// The runs skip() scans over. Match on a vector has to agree with Match on
+// a single byte, the table, for every byte.
+struct Space {
+  static bool Match(char ch) { return classOf(ch) == CharClass::SPACE; }
+#if defined(__SSE2__)
+  static Simd::Vec Match(Simd::Vec bytes) {
+    return Simd::Or(Simd::Or(equals(bytes, ' '), equals(bytes, '\t')),
+                    Simd::Or(equals(bytes, '\n'), equals(bytes, '\r')));
+  }
+#endif
+};
+
+struct Letter {
+  static bool Match(char ch) { return classOf(ch) == CharClass::LETTER; }
+#if defined(__SSE2__)
+  // setting 0x20 lowercases letters and moves nothing else into a-z
+  static Simd::Vec Match(Simd::Vec bytes) {
+    return Simd::Or(inRange(Simd::Or(bytes, Simd::Splat(0x20)), 'a', 26),
+                    equals(bytes, '_'));
+  }
+#endif
+};
+
+struct Digit {
+  static bool Match(char ch) { return classOf(ch) == CharClass::DIGIT; }
+#if defined(__SSE2__)
+  static Simd::Vec Match(Simd::Vec bytes) { return inRange(bytes, '0', 10); }
+#endif
+};
+
+// what a string literal holds up to its closing quote or first escape
+struct StringByte {
+  static bool Match(char ch) { return ch != '"' && ch != '\\' && ch != '\0'; }
+#if defined(__SSE2__)
+  static Simd::Vec Match(Simd::Vec bytes) {
+    return Simd::Not(
+      Simd::Or(Simd::Or(equals(bytes, '"'), equals(bytes, '\\')),
+               equals(bytes, '\0')));
+  }
+#endif
+};
+
+// Outside strings, what cutting the input into pieces doesn't care about
+struct Plain {
+  static bool Match(char ch) {
+    switch (ch) {
+    case '"':
+    case ';':
+    case '(':
+    case ')':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+      return false;
+    default:
+      return true;
     }
-    break;
-  case '+':
-    tok.Type = Token::PLUS;
-    tok.Literal = m_ch;
-    break;
-  case '-':
-    tok.Type = Token::MINUS;
-    tok.Literal = m_ch;
-    break;
-  case '!':
-    if (peekChar() == '=') {
-      char ch = m_ch;
-      readChar();
-      std::string literal = std::string() + ch + m_ch;
-      tok.Type = Token::NOT_EQ;
-      tok.Literal = literal;
+  }
+#if defined(__SSE2__)
+  static Simd::Vec Match(Simd::Vec bytes) {
+    auto brackets =
+      Simd::Or(Simd::Or(equals(bytes, '('), equals(bytes, ')')),
+               Simd::Or(Simd::Or(equals(bytes, '['), equals(bytes, ']')),
+                        Simd::Or(equals(bytes, '{'), equals(bytes, '}'))));
+    return Simd::Not(
+      Simd::Or(brackets, Simd::Or(equals(bytes, '"'), equals(bytes, ';'))));
+  }
+#endif
+};
+
+// The first position from pos on whose byte isn't in Class
+template <typename Class>
+std::size_t skip(std::string_view input, std::size_t pos) {
+#if defined(__SSE2__)
+  while (pos + Simd::Width <= input.size()) {
+    auto matches = Simd::Mask(Class::Match(Simd::Load(input.data() + pos)));
+    if (matches != Simd::All) {
+      return pos + static_cast<std::size_t>(std::countr_one(matches));
+    }
+    pos += Simd::Width;
+  }
+#endif
+  while (pos < input.size() && Class::Match(input[pos])) {
+    pos++;
+  }
+  return pos;
+}
+
+// Past the end of the string whose contents start at pos, going through
+// escapes the way readString does
+std::size_t skipString(std::string_view input, std::size_t pos) {
+  while (true) {
+    pos = skip<StringByte>(input, pos);
+    if (pos >= input.size() || input[pos] != '\\') {
+      return pos + 1;
+    }
+    char next = pos + 1 < input.size() ? input[pos + 1] : '\0';
+    pos += next == '"' || next == 'n' || next == 't' ? 2 : 1;
+  }
+}
+
+// Where to cut input into about parts pieces, starting with 0 and ending
+// with its size. A cut is just past a semicolon outside any string or
+// bracket, so no token is cut in two and each piece lexes on its own to
+// the tokens the whole input has there.
+std::vector<std::size_t> cutPoints(std::string_view input, std::size_t parts) {
+  std::vector<std::size_t> cuts{0};
+  std::size_t next = 1;
+  std::size_t depth = 0;
+  std::size_t pos = 0;
+  while (next < parts) {
+    pos = skip<Plain>(input, pos);
+    if (pos >= input.size()) {
+      break;
+    }
+    switch (input[pos++]) {
+    case '"':
+      pos = skipString(input, pos);
+      break;
+    case '(':
+    case '[':
+    case '{':
+      depth++;
+      break;
+    case ')':
+    case ']':
+    case '}':
+      depth -= depth > 0 ? 1 : 0;
+      break;
+    default: // ;
+      if (depth == 0 && pos >= input.size() * next / parts &&
+          pos < input.size()) {
+        cuts.push_back(pos);
+        while (next < parts && input.size() * next / parts <= pos) {
+          next++;
+        }
+      }
+    }
+  }
+  cuts.push_back(input.size());
+  return cuts;
+}
+
+// One piece of a TokenBuffer, indices local to it
+struct Piece {
+  std::vector<std::uint8_t> Types;
+  std::vector<std::uint32_t> Offsets;
+  std::vector<std::uint32_t> Lengths;
+  std::vector<std::pair<std::uint32_t, long int>> Ints;
+  std::vector<std::pair<std::uint32_t, Symbols::Symbol>> Names;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> Decoded;
+  std::deque<std::string> Strings;
+  // lexing stopped at a NUL, what comes after it isn't part of the program
+  bool Stopped = false;
+  // where the EOF_ that ended the piece is
+  std::uint32_t End = 0;
+};
+
+Piece lexPiece(std::string_view input, std::size_t begin, std::size_t end) {
+  auto local = std::make_shared<Token::Source>();
+  local->Text = input.substr(begin, end - begin);
+  Lexer l(local);
+  Piece piece;
+  // generated scripts run to about a token every two bytes
+  std::size_t expected = (end - begin) / 2;
+  piece.Types.reserve(expected);
+  piece.Offsets.reserve(expected);
+  piece.Lengths.reserve(expected);
+  auto tok = l.NextToken();
+  for (; tok.Type != Token::EOF_; tok = l.NextToken()) {
+    auto index = static_cast<std::uint32_t>(piece.Types.size());
+    piece.Types.push_back(static_cast<std::uint8_t>(tok.Type));
+    piece.Offsets.push_back(static_cast<std::uint32_t>(begin + tok.Start));
+    if (tok.Type == Token::INT) {
+      piece.Ints.emplace_back(index, tok.Int);
+    } else if (tok.Type == Token::IDENT) {
+      piece.Names.emplace_back(index, tok.Name);
+    }
+    const char *text = local->Text.data();
+    if (tok.Literal.data() >= text &&
+        tok.Literal.data() <= text + local->Text.size()) {
+      piece.Lengths.push_back(static_cast<std::uint32_t>(tok.Literal.size()));
     } else {
-      tok.Type = Token::BANG;
-      tok.Literal = m_ch;
+      // decoded strings are the only literals outside the text, in order
+      piece.Decoded.emplace_back(
+        index, static_cast<std::uint32_t>(piece.Decoded.size()));
+      piece.Lengths.push_back(0);
     }
-    break;
-  case '*':
-    tok.Type = Token::ASTERISK;
-    tok.Literal = m_ch;
-    break;
-  case '/':
-    tok.Type = Token::SLASH;
-    tok.Literal = m_ch;
-    break;
-  case '<':
-    tok.Type = Token::LT;
-    tok.Literal = m_ch;
-    break;
-  case '>':
-    tok.Type = Token::GT;
-    tok.Literal = m_ch;
-    break;
-  case ',':
-    tok.Type = Token::COMMA;
-    tok.Literal = m_ch;
-    break;
-  case ';':
-    tok.Type = Token::SEMICOLON;
-    tok.Literal = m_ch;
-    break;
-  case '(':
-    tok.Type = Token::LPAREN;
-    tok.Literal = m_ch;
-    break;
-  case ')':
-    tok.Type = Token::RPAREN;
-    tok.Literal = m_ch;
-    break;
-  case '{':
-    tok.Type = Token::LBRACE;
-    tok.Literal = m_ch;
-    break;
-  case '}':
-    tok.Type = Token::RBRACE;
-    tok.Literal = m_ch;
-    break;
-  case '"':
-    tok.Type = Token::STRING;
+  }
+  piece.Stopped = !l.Exhausted();
+  piece.End = static_cast<std::uint32_t>(begin + tok.Start);
+  piece.Strings = std::move(local->Decoded);
+  return piece;
+}
+
+std::size_t partsFor(std::size_t size) {
+  if (size < TokenBuffer::ParallelThreshold) {
+    return 1;
+  }
+  std::size_t threads = std::max(1U, std::thread::hardware_concurrency());
+  return std::min(threads, size / (TokenBuffer::ParallelThreshold / 4));
+}
+
+template <typename T>
+void append(std::vector<T> &to, std::vector<T> &from) {
+  to.insert(to.end(), std::make_move_iterator(from.begin()),
+            std::make_move_iterator(from.end()));
+}
+
+} // namespace
+
+Lexer::Lexer(std::string input)
+  : m_source(std::make_shared<Token::Source>()) {
+  m_source->Owned = std::move(input);
+  m_source->Text = m_source->Owned;
+  m_input = m_source->Text;
+}
+
+Lexer::Lexer(std::shared_ptr<Token::Source> source)
+  : m_source(std::move(source)), m_input(m_source->Text) {}
+
+Token::Token Lexer::NextToken() {
+  skipWhitespace();
+  size_t start = m_position;
+  const auto &info = charTable[static_cast<unsigned char>(at(start))];
+  Token::Token tok{.Type = info.Type, .Start = offsetOf(start), .Literal = {}};
+  switch (info.Class) {
+  case CharClass::END:
+    // lexing goes on after a NUL in the input, and the end stays the end.
+    // An unterminated string leaves the lexer one past it.
+    tok.Start = offsetOf(std::min(start, m_input.size()));
+    m_position++;
+    return tok;
+  case CharClass::LETTER:
+    tok.Literal = readIdentifier();
+    tok.Type = Token::LookupIdent(tok.Literal);
+    if (tok.Type == Token::IDENT) {
+      tok.Name = Symbols::Intern(tok.Literal);
+    }
+    return tok;
+  case CharClass::DIGIT:
+    tok.Literal = readNumber(tok.Int);
+    return tok;
+  case CharClass::QUOTE:
     tok.Literal = readString();
-    break;
-  case '[':
-    tok.Type = Token::LBRACKET;
-    tok.Literal = m_ch;
-    break;
-  case ']':
-    tok.Type = Token::RBRACKET;
-    tok.Literal = m_ch;
-    break;
-  case ':':
-    tok.Type = Token::COLON;
-    tok.Literal = m_ch;
-    break;
-  default:
-    if (isLetter(m_ch)) {
-      tok.Literal = readIdentifier();
-      tok.Type = Token::LookupIdent(tok.Literal);
-      return tok;
-    } else if (std::isdigit(m_ch)) {
-      tok.Type = Token::INT;
-      tok.Literal = readNumber();
+    return tok;
+  case CharClass::WITH_EQ:
+    if (at(start + 1) == '=') {
+      tok.Type = info.WithEq;
+      tok.Literal = m_input.substr(start, 2);
+      m_position += 2;
       return tok;
-    } else {
-      tok.Type = Token::ILLEGAL;
-      tok.Literal = m_ch;
     }
     break;
+  default:
+    break;
   }
-  readChar();
+  tok.Literal = m_input.substr(start, 1);
+  m_position++;
   return tok;
 }
 
-std::string Lexer::readIdentifier() {
+std::string_view Lexer::readIdentifier() {
   size_t position = m_position;
-  while (isLetter(m_ch)) {
-    readChar();
-  }
+  m_position = skip<Letter>(m_input, m_position);
   return m_input.substr(position, m_position - position);
 }
 
-std::string Lexer::readNumber() {
+// Decodes the digits on the way so the parser doesn't have to
+std::string_view Lexer::readNumber(long int &value) {
+  constexpr long int max = std::numeric_limits<long int>::max();
   size_t position = m_position;
-  while (std::isdigit(m_ch)) {
-    readChar();
+  m_position = skip<Digit>(m_input, m_position);
+  auto digits = m_input.substr(position, m_position - position);
+  value = 0;
+  for (char ch : digits) {
+    long int digit = ch - '0';
+    if (value >= 0 && value <= (max - digit) / 10) {
+      value = value * 10 + digit;
+    } else {
+      value = -1;
+    }
   }
-  return m_input.substr(position, m_position - position);
+  return digits;
 }
 
-std::string Lexer::readString() {
-  std::string out;
-  readChar(); // get rid of first "
-  while (m_ch != '"' && m_ch != 0) {
-    if (m_ch == '\\') {
-      char peek = peekChar();
-      switch (peek) {
-      case '"':
-        out.append("\"");
-        readChar();
-        break;
-      case 'n':
-        out.append("\n");
-        readChar();
-        break;
-      case 't':
-        out.append("\t");
-        readChar();
-        break;
-      default:
-        out.push_back(m_ch);
-      }
-    } else {
-      out.push_back(m_ch);
+// A string without escapes is just a slice of the source. One with escapes
+// gets decoded into the Source so the token can still be a view. Either
+// way the lexer ends up past the closing quote.
+std::string_view Lexer::readString() {
+  size_t position = m_position + 1; // get rid of first "
+  size_t end = skip<StringByte>(m_input, position);
+  if (at(end) != '\\') {
+    m_position = end + 1;
+    return m_input.substr(position, end - position);
+  }
+
+  std::string out(m_input.substr(position, end - position));
+  for (; at(end) != '"' && at(end) != '\0'; end++) {
+    char ch = at(end);
+    if (ch != '\\') {
+      out.push_back(ch);
+      continue;
+    }
+    switch (at(end + 1)) {
+    case '"':
+      out.push_back('"');
+      end++;
+      break;
+    case 'n':
+      out.push_back('\n');
+      end++;
+      break;
+    case 't':
+      out.push_back('\t');
+      end++;
+      break;
+    default:
+      out.push_back(ch);
     }
-    readChar();
   }
-  return out;
+  m_position = end + 1;
+  return m_source->Decoded.emplace_back(std::move(out));
 }
 
-void Lexer::readChar() {
-  if (m_readPosition >= m_input.size()) {
-    m_ch = 0;
-  } else {
-    m_ch = m_input[m_readPosition];
+void Lexer::skipWhitespace() { m_position = skip<Space>(m_input, m_position); }
+
+TokenBuffer TokenBuffer::Tokenize(std::shared_ptr<Token::Source> source,
+                                  std::size_t parts) {
+  std::string_view input = source->Text;
+  auto cuts = cutPoints(input, parts == 0 ? partsFor(input.size()) : parts);
+  std::vector<Piece> pieces(cuts.size() - 1);
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 1; i < pieces.size(); i++) {
+      threads.emplace_back([&, i] {
+        pieces[i] = lexPiece(input, cuts[i], cuts[i + 1]);
+      });
+    }
+    pieces[0] = lexPiece(input, cuts[0], cuts[1]);
+  }
+
+  TokenBuffer buffer;
+  buffer.m_source = std::move(source);
+  buffer.m_parts = pieces.size();
+  std::size_t tokens = 0;
+  for (const auto &piece : pieces) {
+    tokens += piece.Types.size();
+  }
+  // the first piece's arrays are taken over rather than copied, which is
+  // all there is to stitching when there is only the one
+  buffer.m_types = std::move(pieces[0].Types);
+  buffer.m_offsets = std::move(pieces[0].Offsets);
+  buffer.m_lengths = std::move(pieces[0].Lengths);
+  buffer.m_types.reserve(tokens + 1);
+  buffer.m_offsets.reserve(tokens + 1);
+  buffer.m_lengths.reserve(tokens + 1);
+  std::uint32_t base = 0;
+  std::uint32_t end = 0;
+  for (std::size_t i = 0; i < pieces.size(); i++) {
+    auto &piece = pieces[i];
+    if (i > 0) {
+      append(buffer.m_types, piece.Types);
+      append(buffer.m_offsets, piece.Offsets);
+      append(buffer.m_lengths, piece.Lengths);
+    }
+    auto decodedBase =
+      static_cast<std::uint32_t>(buffer.m_source->Decoded.size());
+    for (auto [index, value] : piece.Ints) {
+      buffer.m_ints.emplace_back(base + index, value);
+    }
+    for (auto [index, name] : piece.Names) {
+      buffer.m_names.emplace_back(base + index, name);
+    }
+    for (auto [index, decoded] : piece.Decoded) {
+      buffer.m_decoded.emplace_back(base + index, decodedBase + decoded);
+    }
+    for (auto &str : piece.Strings) {
+      buffer.m_source->Decoded.push_back(std::move(str));
+    }
+    end = piece.End;
+    if (piece.Stopped) {
+      break;
+    }
+    base = static_cast<std::uint32_t>(buffer.m_types.size());
   }
-  m_position = m_readPosition;
-  m_readPosition += 1;
+  buffer.m_types.push_back(static_cast<std::uint8_t>(Token::EOF_));
+  buffer.m_offsets.push_back(end);
+  buffer.m_lengths.push_back(0);
+  return buffer;
 }
 
-bool Lexer::isLetter(char ch) {
-  return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ch == '_';
+// Everything but the side tables. A string's literal starts past its quote.
+Token::Token TokenBuffer::token(std::size_t index) const {
+  auto type = static_cast<Token::TokenType>(m_types[index]);
+  Token::Offset start = m_offsets[index];
+  return {.Type = type,
+          .Start = start,
+          .Literal = m_source->Text.substr(
+            start + (type == Token::STRING ? 1 : 0), m_lengths[index])};
 }
-void Lexer::skipWhitespace() {
-  while (m_ch == ' ' || m_ch == '\t' || m_ch == '\n' || m_ch == '\r') {
-    readChar();
+
+Token::Token TokenBuffer::At(std::size_t index) const {
+  index = std::min(index, m_types.size() - 1);
+  auto key = static_cast<std::uint32_t>(index);
+  auto byIndex = [](const auto &entry, std::uint32_t i) {
+    return entry.first < i;
+  };
+  auto tok = token(index);
+  if (tok.Type == Token::INT) {
+    tok.Int =
+      std::lower_bound(m_ints.begin(), m_ints.end(), key, byIndex)->second;
+  } else if (tok.Type == Token::IDENT) {
+    tok.Name =
+      std::lower_bound(m_names.begin(), m_names.end(), key, byIndex)->second;
+  } else if (tok.Type == Token::STRING) {
+    auto found =
+      std::lower_bound(m_decoded.begin(), m_decoded.end(), key, byIndex);
+    if (found != m_decoded.end() && found->first == key) {
+      tok.Literal = m_source->Decoded[found->second];
+    }
   }
+  return tok;
 }
 
-char Lexer::peekChar() {
-  if (m_readPosition >= m_input.size()) {
-    return 0;
-  } else {
-    return m_input[m_readPosition];
+Token::Token TokenBuffer::Next(Cursor &cursor) const {
+  std::size_t index = std::min(cursor.m_index, m_types.size() - 1);
+  auto tok = token(index);
+  if (tok.Type == Token::INT) {
+    tok.Int = m_ints[cursor.m_int++].second;
+  } else if (tok.Type == Token::IDENT) {
+    tok.Name = m_names[cursor.m_name++].second;
+  } else if (tok.Type == Token::STRING && cursor.m_decoded < m_decoded.size() &&
+             m_decoded[cursor.m_decoded].first == index) {
+    tok.Literal = m_source->Decoded[m_decoded[cursor.m_decoded++].second];
+  }
+  if (cursor.m_index < m_types.size()) {
+    cursor.m_index++;
   }
+  return tok;
 }
 
 } // namespace Lexer
@@ -1,27 +1,96 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <token.hpp>
+#include <utility>
+#include <vector>
 namespace Lexer {
 
+// Picks the token from a table of character classes and skips runs of
+// whitespace, identifier letters, digits and string contents 16 or 32
+// bytes at a time where SSE2 or AVX2 is available, one at a time elsewhere
 class Lexer {
 private:
-  std::string m_input;
+  std::shared_ptr<Token::Source> m_source;
+  std::string_view m_input; // m_source->Text
   size_t m_position = 0;
-  size_t m_readPosition = 0;
-  char m_ch = 0;
-
-  std::string readIdentifier();
-  std::string readNumber();
-  std::string readString();
-  void readChar();
-  bool isLetter(char ch);
+
+  std::string_view readIdentifier();
+  std::string_view readNumber(long int &value);
+  std::string_view readString();
   void skipWhitespace();
-  char peekChar();
+  // the byte at pos, 0 past the end the same as a NUL in the input
+  [[nodiscard]] char at(size_t pos) const {
+    return pos < m_input.size() ? m_input[pos] : '\0';
+  }
 
 public:
   explicit Lexer(std::string input);
+  // lexes Text in place, wherever it lives
+  explicit Lexer(std::shared_ptr<Token::Source> source);
   ~Lexer() = default;
   Token::Token NextToken();
+  // what the tokens point into
+  [[nodiscard]] std::shared_ptr<const Token::Source> Source() const {
+    return m_source;
+  }
+  // whether the last EOF_ was the end of the input rather than a NUL in it
+  [[nodiscard]] bool Exhausted() const { return m_position > m_input.size(); }
+};
+
+// A whole input lexed up front, one array per field, for the parser to walk
+// by index. Big inputs are cut just past semicolons outside any string or
+// bracket and the pieces lexed on threads of their own. Tokens are where
+// they start in the Source's Text and how long their literal is; INT
+// values, IDENT symbols and strings with escapes, whose literal isn't a
+// slice of Text, are in side tables by token index.
+class TokenBuffer {
+private:
+  std::shared_ptr<Token::Source> m_source;
+  std::vector<std::uint8_t> m_types;
+  std::vector<std::uint32_t> m_offsets;
+  std::vector<std::uint32_t> m_lengths;
+  std::vector<std::pair<std::uint32_t, long int>> m_ints;
+  std::vector<std::pair<std::uint32_t, Symbols::Symbol>> m_names;
+  // token index to index in m_source->Decoded
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> m_decoded;
+  std::size_t m_parts = 0;
+
+  [[nodiscard]] Token::Token token(std::size_t index) const;
+
+public:
+  // offsets are 32 bits and every one, the end's too, has to be below
+  // NoOffset. Bigger inputs have to go through a Lexer.
+  static constexpr std::size_t MaxInput = Token::NoOffset - 1;
+  // Inputs smaller than this are lexed on the calling thread
+  static constexpr std::size_t ParallelThreshold = std::size_t{1} << 20;
+
+  // Lexes all of source->Text, at most MaxInput bytes, in about parts
+  // pieces, 0 to pick from the size of the input and the machine
+  static TokenBuffer Tokenize(std::shared_ptr<Token::Source> source,
+                              std::size_t parts = 0);
+
+  // Where a reader going front to back is, in the tokens and in the side
+  // tables, so Next doesn't have to search them
+  struct Cursor {
+    std::size_t m_index = 0;
+    std::size_t m_int = 0;
+    std::size_t m_name = 0;
+    std::size_t m_decoded = 0;
+  };
+
+  // the tokens up to the first EOF_, which is included
+  [[nodiscard]] std::size_t Size() const { return m_types.size(); }
+  // past the end is the closing EOF_
+  [[nodiscard]] Token::Token At(std::size_t index) const;
+  Token::Token Next(Cursor &cursor) const;
+  [[nodiscard]] std::size_t Parts() const { return m_parts; }
+  [[nodiscard]] std::shared_ptr<const Token::Source> Source() const {
+    return m_source;
+  }
 };
 
 } // namespace Lexer
@@ -1,14 +1,39 @@
 #include "repl.hpp"
 #include <iostream>
+#include <string>
 
-void run() {
+void run(Repl::Engine engine) {
     std::cout << "Hello! This is the Monkey programming languag!\n";
     std::cout << "Feel free to type in commands\n";
-    Repl::Start();
+    Repl::Start(engine);
 
 }
 
-int main() {
-    run();
+int main(int argc, char **argv) {
+    Repl::Engine engine = Repl::Engine::EVALUATOR;
+    bool timed = false;
+    std::string script;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--engine=vm") {
+            engine = Repl::Engine::VM;
+        } else if (arg == "--engine=eval") {
+            engine = Repl::Engine::EVALUATOR;
+        } else if (arg == "--engine=stack") {
+            engine = Repl::Engine::STACK;
+        } else if (arg == "--time") {
+            timed = true;
+        } else if (script.empty() && (arg == "-" || !arg.starts_with("-"))) {
+            script = arg;
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--engine=eval|vm|stack] [--time] [script|-]\n";
+            return 1;
+        }
+    }
+    if (!script.empty()) {
+        return Repl::RunFile(script, engine, timed);
+    }
+    run(engine);
     return 0;
 }
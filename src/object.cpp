@@ -1,5 +1,9 @@
 #include "object.hpp"
 #include "helpers.hpp"
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <format>
 #include <iostream>
 #include <memory>
@@ -28,38 +32,102 @@ std::string objectTypeToStr(ObjectType type) {
     return "BUILTIN";
   case Object::ObjectType::ARRAY_OBJ:
     return "ARRAY";
+  case Object::ObjectType::COMPILED_FUNCTION_OBJ:
+    return "COMPILED_FUNCTION";
+  case Object::ObjectType::CLOSURE_OBJ:
+    return "CLOSURE";
+  case Object::ObjectType::HASH_OBJ:
+    return "HASH";
   }
 }
 
 void Environment::PrintEnv() {
   std::cout << "ENVIRONMENT ################################################\n";
-  for (const auto &pair : this->m_environment) {
-    std::cout << std::format("key: {}, type: {}", pair.first,
-                             Object::objectTypeToStr(pair.second->Type()));
+  for (size_t slot = 0; slot < m_slots.size(); slot++) {
+    if (m_slots[slot] != nullptr) {
+      std::cout << std::format("key: {}, type: {}",
+                               Symbols::Name(m_layout->m_names[slot]),
+                               Object::objectTypeToStr(m_slots[slot]->Type()));
+    }
   }
 }
 
-Environment::Environment(const std::shared_ptr<Environment> &outerEnv)
-  : m_outerEnv(std::weak_ptr<Environment>(outerEnv)) {}
+Environment::Environment() : m_layout(std::make_shared<Ast::ScopeLayout>()) {}
 
-Environment::EnvObj Environment::Get(const std::string &name) {
-  std::shared_ptr<Environment> outerEnv = m_outerEnv.lock();
-  if (this->m_environment.contains(name)) {
-    return {.obj = this->m_environment[name], .ok = true};
-  } else if (outerEnv) {
-    return outerEnv->Get(name);
-  } else {
-    return {.obj = nullptr, .ok = false};
+Environment::Environment(Environment *outerEnv,
+                         std::shared_ptr<Ast::ScopeLayout> layout)
+  : m_outerEnv(outerEnv),
+    m_layout(layout != nullptr ? std::move(layout)
+                               : std::make_shared<Ast::ScopeLayout>()),
+    m_slots(m_layout->m_names.size()) {}
+
+Environment::EnvObj Environment::Get(Symbols::Symbol name) {
+  int slot = m_layout->Find(name);
+  if (slot >= 0 && static_cast<size_t>(slot) < m_slots.size() &&
+      m_slots[static_cast<size_t>(slot)] != nullptr) {
+    return {.obj = m_slots[static_cast<size_t>(slot)], .ok = true};
+  }
+  if (m_outerEnv != nullptr) {
+    return m_outerEnv->Get(name);
+  }
+  return {.obj = nullptr, .ok = false};
+}
+
+void Environment::Set(Symbols::Symbol name, Value obj) {
+  SetAt(m_layout->Declare(name), std::move(obj));
+}
+
+const Value &Environment::GetAt(int depth, int slot) {
+  static const Value empty = nullptr;
+  Environment *env = this;
+  for (; depth > 0 && env != nullptr; depth--) {
+    env = env->m_outerEnv;
   }
+  auto index = static_cast<size_t>(slot);
+  if (env == nullptr || index >= env->m_slots.size()) {
+    return empty;
+  }
+  return env->m_slots[index];
+}
+
+Environment *Environment::Outer(int depth) {
+  Environment *env = this;
+  for (; depth > 0 && env != nullptr; depth--) {
+    env = env->m_outerEnv;
+  }
+  return env;
 }
 
-void Environment::Set(const std::string &name,
-                      std::shared_ptr<Object::IObject> obj) {
-  this->m_environment[name] = std::move(obj);
+void Environment::SetAt(int slot, Value obj) {
+  auto index = static_cast<size_t>(slot);
+  if (index >= m_slots.size()) {
+    m_slots.resize(index + 1);
+  }
+  m_slots[index] = obj != nullptr ? std::move(obj) : Value::Null();
+}
+
+void Environment::Reset(Environment *outerEnv,
+                        const std::shared_ptr<Ast::ScopeLayout> &layout) {
+  m_outerEnv = outerEnv;
+  if (m_layout != layout) {
+    m_layout = layout;
+  }
+  m_slots.assign(m_layout != nullptr ? m_layout->m_names.size() : 0,
+                 Value());
+}
+
+const std::shared_ptr<Ast::ScopeLayout> &Environment::Layout() const {
+  return m_layout;
+}
+
+void Environment::Trace(Gc::Heap &heap) const {
+  for (const auto &slot : m_slots) {
+    slot.Trace(heap);
+  }
+  heap.Mark(m_outerEnv);
 }
 
 // integer
-Integer::Integer(long int value) : m_value(value) {}
 ObjectType Integer::Type() const { return ObjectType::INTEGER_OBJ; }
 std::string Integer::Inspect() const { return std::to_string(m_value); }
 
@@ -72,11 +140,52 @@ std::string Boolean::Inspect() const { return m_value ? "true" : "false"; }
 ObjectType Null::Type() const { return ObjectType::NULL_OBJ; }
 std::string Null::Inspect() const { return "null"; }
 
+// value
+static Boolean trueObj(true);
+static Boolean falseObj(false);
+static Null nullObj;
+
+void Value::releaseHeap() {
+  m_heap.~shared_ptr();
+  m_ptr = nullptr;
+}
+
+Value Value::Bool(bool value) {
+  Value v;
+  v.m_ptr = value ? &trueObj : &falseObj;
+  v.m_tag = Tag::IMMORTAL;
+  return v;
+}
+
+Value Value::Null() {
+  Value v;
+  v.m_ptr = &nullObj;
+  v.m_tag = Tag::IMMORTAL;
+  return v;
+}
+
+std::shared_ptr<IObject> Value::Shared() const {
+  switch (m_tag) {
+  case Tag::INTEGER:
+    return std::make_shared<Integer>(m_int.m_value);
+  case Tag::IMMORTAL:
+    // aliasing an empty owner gives a pointer that never frees the singleton
+    return {std::shared_ptr<IObject>(), m_ptr};
+  case Tag::COLLECTED:
+    return Gc::Pin(m_ptr);
+  case Tag::HEAP:
+    return m_heap;
+  default:
+    return nullptr;
+  }
+}
+
 // Return Object
-ReturnValue::ReturnValue(std::shared_ptr<IObject> value)
+ReturnValue::ReturnValue(Value value)
   : m_value(std::move(value)) {}
 ObjectType ReturnValue::Type() const { return ObjectType::RETURN_VALUE_OBJ; }
 std::string ReturnValue::Inspect() const { return m_value->Inspect(); }
+void ReturnValue::Trace(Gc::Heap &heap) const { m_value.Trace(heap); }
 
 // Error Object
 Error::Error(std::string message) : m_message(std::move(message)) {}
@@ -87,38 +196,196 @@ std::string Error::Inspect() const {
 
 // Function Object
 
-Function::Function(std::vector<std::unique_ptr<Ast::Identifier>> parameters,
-                   std::shared_ptr<Environment> env,
-                   std::unique_ptr<Ast::BlockStatement> body)
-  : m_parameters(std::move(parameters)), m_env(std::move(env)),
-    m_body(std::move(body)) {}
+// 0 is left for no prototype, see Ast::CallExpression::m_callee
+static std::atomic<std::uint64_t> nextPrototypeId = 1;
+
+FunctionPrototype::FunctionPrototype(const Ast::FunctionLiteral *literal,
+                                     CompiledNode compiled)
+  : m_arena(Ast::ArenaOf(literal)),
+    m_id(nextPrototypeId.fetch_add(1, std::memory_order_relaxed)),
+    m_body(literal->m_body),
+    m_layout(literal->m_layout), m_compiled(std::move(compiled)) {
+  m_parameters.reserve(literal->m_parameters.size());
+  for (const auto &param : literal->m_parameters) {
+    m_parameters.push_back(param->m_symbol);
+  }
+}
+
+Function::Function(std::shared_ptr<const FunctionPrototype> prototype,
+                   Environment *env)
+  : m_prototype(std::move(prototype)), m_env(env) {}
 
 ObjectType Function::Type() const { return ObjectType::FUNCTION_OBJ; }
 
 std::string Function::Inspect() const {
   std::string out;
   std::vector<std::string> params;
-  params.reserve(this->m_parameters.size());
-  for (const auto &p : this->m_parameters) {
-    params.emplace_back(p->String());
+  params.reserve(Parameters().size());
+  for (auto param : Parameters()) {
+    params.emplace_back(Symbols::Name(param));
   }
   out.append("fn(");
   out.append(Helpers::combineVecStrWithDelim(params, ","));
   out.append(") {\n");
-  out.append(this->m_body->String());
+  out.append(Body()->String());
   out.append("\n}");
   return out;
 }
+void Function::Trace(Gc::Heap &heap) const { heap.Mark(m_env); }
 
 // String Object
-String::String(std::string value) : m_value(std::move(value)) {}
+String::String(std::string value)
+  : m_value(std::move(value)), m_length(m_value.size()) {}
+
+String::String(Value left, Value right)
+  : m_left(std::move(left)), m_right(std::move(right)),
+    m_length(static_cast<const String *>(m_left.get())->m_length +
+             static_cast<const String *>(m_right.get())->m_length) {}
+
+Value String::Concat(const Value &left, const Value &right) {
+  const auto *l = static_cast<const String *>(left.get());
+  const auto *r = static_cast<const String *>(right.get());
+  if (l->m_length + r->m_length <= FlatMax) {
+    return New<String>(l->Flat() + r->Flat());
+  }
+  if (l->IsRope() && r->m_length < FlatMax) {
+    const auto *last = static_cast<const String *>(l->m_right.get());
+    if (!last->IsRope() && last->m_length + r->m_length <= FlatMax) {
+      return New<String>(l->m_left,
+                         New<String>(last->m_value + r->Flat()));
+    }
+  }
+  return New<String>(left, right);
+}
+
+const std::string &String::Flat() const {
+  if (!IsRope()) {
+    return m_value;
+  }
+  // ropes built by appending are as deep as they are long, so no recursion
+  std::string out;
+  out.reserve(m_length);
+  std::vector<const String *> stack{this};
+  while (!stack.empty()) {
+    const String *str = stack.back();
+    stack.pop_back();
+    if (!str->IsRope()) {
+      out.append(str->m_value);
+      continue;
+    }
+    stack.push_back(static_cast<const String *>(str->m_right.get()));
+    stack.push_back(static_cast<const String *>(str->m_left.get()));
+  }
+  m_value = std::move(out);
+  m_left = nullptr;
+  m_right = nullptr;
+  return m_value;
+}
+
+HashKey String::GetHashKey() const {
+  if (!m_hashed) {
+    m_hash = std::hash<std::string>{}(Flat());
+    m_hashed = true;
+  }
+  return {.m_type = ObjectType::STRING_OBJ, .m_value = m_hash};
+}
 ObjectType String::Type() const { return ObjectType::STRING_OBJ; }
-std::string String::Inspect() const { return m_value; }
+std::string String::Inspect() const { return Flat(); }
+void String::Trace(Gc::Heap &heap) const {
+  m_left.Trace(heap);
+  m_right.Trace(heap);
+}
 
 // Array object
 
-Array::Array(std::vector<std::shared_ptr<IObject>> elements)
-  : m_elements(std::move(elements)) {}
+// Persistent vector
+PersistentVector::PersistentVector(const std::vector<Value> &values) {
+  for (const auto &value : values) {
+    *this = Push(value);
+  }
+}
+
+const Value *PersistentVector::leafFor(std::size_t pos) const {
+  if (pos >= tailOffset()) {
+    return m_tail->m_values.data();
+  }
+  const Node *node = m_root.get();
+  for (std::size_t level = m_shift; level > 0; level -= Bits) {
+    node = static_cast<const Branch *>(node)->m_children[(pos >> level) & Mask]
+             .get();
+  }
+  return static_cast<const Leaf *>(node)->m_values.data();
+}
+
+PersistentVector PersistentVector::Push(Value value) const {
+  PersistentVector out = *this;
+  std::size_t tailLength = m_end - tailOffset();
+  if (m_tail == nullptr || tailLength < Width) {
+    if (m_tail == nullptr || m_tail->m_used != tailLength) {
+      // someone else already appended to this tail, copy our part of it
+      out.m_tail = std::make_shared<Leaf>();
+      for (std::size_t i = 0; i < tailLength; i++) {
+        out.m_tail->m_values[i] = m_tail->m_values[i];
+      }
+    }
+    out.m_tail->m_values[tailLength] = std::move(value);
+    out.m_tail->m_used = tailLength + 1;
+    out.m_end++;
+    return out;
+  }
+
+  // the tail is full, it goes into the trie and a new one is started
+  if ((m_end >> Bits) > (std::size_t{1} << m_shift)) {
+    out.m_root = std::make_shared<Branch>();
+    out.m_root->m_children[0] = m_root;
+    out.m_root->m_children[1] = newPath(m_shift, m_tail);
+    out.m_shift += Bits;
+  } else {
+    out.m_root = pushTail(m_shift, m_root.get(), m_tail);
+  }
+  out.m_tail = std::make_shared<Leaf>();
+  out.m_tail->m_values[0] = std::move(value);
+  out.m_tail->m_used = 1;
+  out.m_end++;
+  return out;
+}
+
+PersistentVector PersistentVector::Rest() const {
+  PersistentVector out = *this;
+  out.m_offset++;
+  return out;
+}
+
+std::shared_ptr<PersistentVector::Branch>
+PersistentVector::pushTail(std::size_t level, const Branch *parent,
+                           std::shared_ptr<Leaf> tail) const {
+  auto node = parent != nullptr ? std::make_shared<Branch>(*parent)
+                                : std::make_shared<Branch>();
+  std::size_t index = ((m_end - 1) >> level) & Mask;
+  if (level == Bits) {
+    node->m_children[index] = std::move(tail);
+  } else if (node->m_children[index] != nullptr) {
+    node->m_children[index] = pushTail(
+      level - Bits, static_cast<const Branch *>(node->m_children[index].get()),
+      std::move(tail));
+  } else {
+    node->m_children[index] = newPath(level - Bits, std::move(tail));
+  }
+  return node;
+}
+
+std::shared_ptr<PersistentVector::Node>
+PersistentVector::newPath(std::size_t level, std::shared_ptr<Leaf> tail) {
+  if (level == 0) {
+    return tail;
+  }
+  auto node = std::make_shared<Branch>();
+  node->m_children[0] = newPath(level - Bits, std::move(tail));
+  return node;
+}
+
+Array::Array(const std::vector<Value> &elements) : m_elements(elements) {}
+Array::Array(PersistentVector elements) : m_elements(std::move(elements)) {}
 ObjectType Array::Type() const { return ObjectType::ARRAY_OBJ; }
 std::string Array::Inspect() const {
   std::string out;
@@ -132,9 +399,198 @@ std::string Array::Inspect() const {
   out.append("]");
   return out;
 }
+void Array::Trace(Gc::Heap &heap) const {
+  for (const auto &element : m_elements) {
+    element.Trace(heap);
+  }
+}
+
+// Hash object
+std::optional<HashKey> HashKeyOf(const Value &value) {
+  switch (value.Type()) {
+  case ObjectType::INTEGER_OBJ:
+    return static_cast<const Integer *>(value.get())->GetHashKey();
+  case ObjectType::BOOLEAN_OBJ:
+    return static_cast<const Boolean *>(value.get())->GetHashKey();
+  case ObjectType::STRING_OBJ:
+    return static_cast<const String *>(value.get())->GetHashKey();
+  default:
+    return std::nullopt;
+  }
+}
+
+namespace {
+constexpr std::uint8_t emptyCtrl = 0x80;
+constexpr std::uint64_t lowBits = 0x0101010101010101;
+constexpr std::uint64_t highBits = 0x8080808080808080;
+
+// Integer keys are their own value, so spread them out before the low bits
+// pick a group (splitmix64's finalizer)
+std::uint64_t mix(const HashKey &key) {
+  std::uint64_t x = key.m_value + (static_cast<std::uint64_t>(key.m_type) *
+                                   0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+std::uint64_t loadGroup(const std::uint8_t *ctrl) {
+  std::uint64_t group = 0;
+  std::memcpy(&group, ctrl, sizeof(group));
+  return group;
+}
+
+// High bit set in every byte of the group equal to h2. The borrow can mark
+// a byte next to a real match as well, comparing the keys sorts that out.
+std::uint64_t matchByte(std::uint64_t group, std::uint8_t h2) {
+  std::uint64_t x = group ^ (lowBits * h2);
+  return (x - lowBits) & ~x & highBits;
+}
+
+std::uint64_t matchEmpty(std::uint64_t group) { return group & highBits; }
+
+// Only called once the HashKeys match, which settles it for integers and
+// booleans. Strings are hashed, two different ones can share a HashKey.
+bool sameKey(const Value &left, const Value &right) {
+  if (left.get() == right.get() || left.Type() != ObjectType::STRING_OBJ) {
+    return true;
+  }
+  return static_cast<const String *>(left.get())->Flat() ==
+         static_cast<const String *>(right.get())->Flat();
+}
+
+// slot in the group of the lowest bit set in a match
+std::size_t matchIndex(std::uint64_t match) {
+  auto byte = static_cast<std::size_t>(std::countr_zero(match)) / 8;
+  return std::endian::native == std::endian::little ? byte : 7 - byte;
+}
+} // namespace
+
+Hash::Hash(std::size_t capacity) {
+  m_pairs.reserve(capacity);
+  std::size_t slots = GroupSize;
+  while (slots * 7 / 8 < capacity) {
+    slots *= 2;
+  }
+  rehash(slots);
+}
+
+std::size_t Hash::probe(const HashKey &hashKey, const Value &key,
+                        std::uint64_t hash, bool &found) const {
+  auto h2 = static_cast<std::uint8_t>(hash & 0x7f);
+  std::size_t groupMask = m_ctrl.size() / GroupSize - 1;
+  std::size_t group = (hash >> 7) & groupMask;
+  // triangular steps visit every group when there is a power of two of them
+  for (std::size_t step = 1;; step++) {
+    std::size_t base = group * GroupSize;
+    std::uint64_t ctrl = loadGroup(&m_ctrl[base]);
+    for (auto match = matchByte(ctrl, h2); match != 0; match &= match - 1) {
+      std::size_t slot = base + matchIndex(match);
+      const auto &pair = m_pairs[m_slots[slot]];
+      if (m_ctrl[slot] == h2 && pair.m_hashKey == hashKey &&
+          sameKey(pair.m_key, key)) {
+        found = true;
+        return slot;
+      }
+    }
+    if (auto empty = matchEmpty(ctrl); empty != 0) {
+      found = false;
+      return base + matchIndex(empty);
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+const Hash::Pair *Hash::Find(const HashKey &hashKey, const Value &key) const {
+  if (m_pairs.empty()) {
+    return nullptr;
+  }
+  bool found = false;
+  std::size_t slot = probe(hashKey, key, mix(hashKey), found);
+  return found ? &m_pairs[m_slots[slot]] : nullptr;
+}
+
+void Hash::Set(const HashKey &hashKey, Value key, Value value) {
+  // keep at least one slot in eight empty so probes always stop
+  if ((m_pairs.size() + 1) * 8 > m_ctrl.size() * 7) {
+    rehash(m_ctrl.empty() ? GroupSize : m_ctrl.size() * 2);
+  }
+  std::uint64_t hash = mix(hashKey);
+  bool found = false;
+  std::size_t slot = probe(hashKey, key, hash, found);
+  if (found) {
+    m_pairs[m_slots[slot]].m_value = std::move(value);
+    return;
+  }
+  m_ctrl[slot] = static_cast<std::uint8_t>(hash & 0x7f);
+  m_slots[slot] = static_cast<std::uint32_t>(m_pairs.size());
+  m_pairs.push_back({.m_hashKey = hashKey,
+                     .m_key = std::move(key),
+                     .m_value = std::move(value)});
+}
+
+void Hash::rehash(std::size_t capacity) {
+  m_ctrl.assign(capacity, emptyCtrl);
+  m_slots.assign(capacity, 0);
+  for (std::size_t i = 0; i < m_pairs.size(); i++) {
+    std::uint64_t hash = mix(m_pairs[i].m_hashKey);
+    bool found = false;
+    std::size_t slot =
+      probe(m_pairs[i].m_hashKey, m_pairs[i].m_key, hash, found);
+    m_ctrl[slot] = static_cast<std::uint8_t>(hash & 0x7f);
+    m_slots[slot] = static_cast<std::uint32_t>(i);
+  }
+}
+
+ObjectType Hash::Type() const { return ObjectType::HASH_OBJ; }
+std::string Hash::Inspect() const {
+  std::string out;
+  std::vector<std::string> pairs;
+  pairs.reserve(m_pairs.size());
+  for (const auto &pair : m_pairs) {
+    pairs.emplace_back(
+      std::format("{}: {}", pair.m_key->Inspect(), pair.m_value->Inspect()));
+  }
+  out.append("{");
+  out.append(Helpers::combineVecStrWithDelim(pairs, ", "));
+  out.append("}");
+  return out;
+}
+void Hash::Trace(Gc::Heap &heap) const {
+  for (const auto &pair : m_pairs) {
+    pair.m_key.Trace(heap);
+    pair.m_value.Trace(heap);
+  }
+}
 
 // BuiltinFunction object
 Builtin::Builtin(BuiltinFunction fn) : m_fn(std::move(fn)) {}
 ObjectType Builtin::Type() const { return ObjectType::BUILTIN_OBJ; }
 std::string Builtin::Inspect() const { return "builtin function"; }
+
+// Compiled function object
+CompiledFunction::CompiledFunction(Code::Instructions instructions,
+                                   int numLocals, int numParameters)
+  : m_instructions(std::move(instructions)), m_numLocals(numLocals),
+    m_numParameters(numParameters) {}
+ObjectType CompiledFunction::Type() const {
+  return ObjectType::COMPILED_FUNCTION_OBJ;
+}
+std::string CompiledFunction::Inspect() const {
+  return std::format("CompiledFunction[{}]", static_cast<const void *>(this));
+}
+
+// Closure object
+Closure::Closure(std::shared_ptr<CompiledFunction> fn,
+                 std::vector<Value> free)
+  : m_fn(std::move(fn)), m_free(std::move(free)) {}
+ObjectType Closure::Type() const { return ObjectType::CLOSURE_OBJ; }
+std::string Closure::Inspect() const {
+  return std::format("Closure[{}]", static_cast<const void *>(this));
+}
+void Closure::Trace(Gc::Heap &heap) const {
+  for (const auto &value : m_free) {
+    value.Trace(heap);
+  }
+}
 } // namespace Object
@@ -1,9 +1,22 @@
 #pragma once
 #include "ast.hpp"
+#include "code.hpp"
+#include "gc.hpp"
+#include <array>
+#include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <optional>
+#include <span>
 #include <string>
+#include <vector>
+namespace Evaluator {
+class Evaluator;
+} // namespace Evaluator
 namespace Object {
 
 enum class ObjectType : std::uint8_t {
@@ -15,37 +28,36 @@ enum class ObjectType : std::uint8_t {
   FUNCTION_OBJ,
   STRING_OBJ,
   BUILTIN_OBJ,
-  ARRAY_OBJ
+  ARRAY_OBJ,
+  COMPILED_FUNCTION_OBJ,
+  CLOSURE_OBJ,
+  HASH_OBJ
 };
+// for tables indexed by ObjectType, HASH_OBJ has to stay the last type
+constexpr std::size_t ObjectTypeCount =
+  static_cast<std::size_t>(ObjectType::HASH_OBJ) + 1;
 std::string objectTypeToStr(ObjectType type);
-struct IObject {
-  virtual ~IObject() = default;
-  [[nodiscard]] virtual ObjectType Type() const = 0;
-  [[nodiscard]] virtual std::string Inspect() const = 0;
-};
 
-class Environment {
-public:
-  struct EnvObj {
-    std::shared_ptr<Object::IObject> obj;
-    bool ok;
-  };
-  Environment() = default;
-  explicit Environment(const std::shared_ptr<Environment> &outerEnv);
-  EnvObj Get(const std::string &name);
-  void Set(const std::string &name, std::shared_ptr<Object::IObject>);
-
-  void PrintEnv();
+// What a hash compares keys by. Only integers, booleans and strings can be
+// keys, so the type and a 64 bit value are enough to tell them apart.
+struct HashKey {
+  ObjectType m_type;
+  std::uint64_t m_value;
+  bool operator==(const HashKey &other) const = default;
+};
 
-private:
-  std::weak_ptr<Environment> m_outerEnv;
-  std::unordered_map<std::string, std::shared_ptr<Object::IObject>>
-    m_environment;
+struct IObject : public Gc::Collectable {
+  [[nodiscard]] virtual ObjectType Type() const = 0;
+  [[nodiscard]] virtual std::string Inspect() const = 0;
 };
 
 struct Integer : public IObject {
   long int m_value;
-  explicit Integer(long int value);
+  explicit Integer(long int value) : m_value(value) {}
+  [[nodiscard]] HashKey GetHashKey() const {
+    return {.m_type = ObjectType::INTEGER_OBJ,
+            .m_value = static_cast<std::uint64_t>(m_value)};
+  }
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
 };
@@ -53,6 +65,9 @@ struct Integer : public IObject {
 struct Boolean : public IObject {
   bool m_value;
   explicit Boolean(bool value);
+  [[nodiscard]] HashKey GetHashKey() const {
+    return {.m_type = ObjectType::BOOLEAN_OBJ, .m_value = m_value ? 1U : 0U};
+  }
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
 };
@@ -62,47 +77,456 @@ struct Null : public IObject {
   [[nodiscard]] std::string Inspect() const override;
 };
 
+// Integers, booleans and null are carried inline instead of in their own
+// heap allocation. Integers live in the Value itself, booleans and null
+// point at immortal singletons. Objects made at runtime live on the
+// collected heap and are held by a plain pointer, so none of these touch a
+// refcount when they are copied around. Objects owned elsewhere (compiler
+// constants, builtins, errors) are still shared.
+class Value {
+public:
+  Value() : m_ptr(nullptr) {}
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  Value(std::nullptr_t) : m_ptr(nullptr) {}
+  template <typename T>
+    requires std::derived_from<T, IObject>
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  Value(std::shared_ptr<T> obj) : m_ptr(nullptr) {
+    if (obj != nullptr) {
+      new (&m_heap) std::shared_ptr<IObject>(std::move(obj));
+      m_tag = Tag::HEAP;
+    }
+  }
+  // obj has to come from Gc::Heap, see Object::New
+  template <typename T>
+    requires std::derived_from<T, IObject>
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  Value(T *obj)
+    : m_tag(obj != nullptr ? Tag::COLLECTED : Tag::EMPTY), m_ptr(obj) {}
+  Value(const Value &other) : m_ptr(nullptr) { copyFrom(other); }
+  Value(Value &&other) noexcept : m_ptr(nullptr) { moveFrom(other); }
+  Value &operator=(const Value &other) {
+    if (this != &other) {
+      reset();
+      copyFrom(other);
+    }
+    return *this;
+  }
+  Value &operator=(Value &&other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+  ~Value() { reset(); }
+
+  static Value Int(long int value) {
+    Value v;
+    new (&v.m_int) Integer(value);
+    v.m_tag = Tag::INTEGER;
+    return v;
+  }
+  // Int without the temporary, for the vm's arithmetic on its stack
+  void SetInt(long int value) {
+    reset();
+    new (&m_int) Integer(value);
+    m_tag = Tag::INTEGER;
+  }
+  static Value Bool(bool value);
+  static Value Null();
+
+  [[nodiscard]] IObject *get() const {
+    switch (m_tag) {
+    case Tag::INTEGER:
+      return const_cast<Integer *>(&m_int);
+    case Tag::IMMORTAL:
+    case Tag::COLLECTED:
+      return m_ptr;
+    case Tag::HEAP:
+      return m_heap.get();
+    default:
+      return nullptr;
+    }
+  }
+  IObject *operator->() const { return get(); }
+  explicit operator bool() const { return m_tag != Tag::EMPTY; }
+  friend bool operator==(const Value &value, std::nullptr_t) {
+    return value.m_tag == Tag::EMPTY;
+  }
+
+  [[nodiscard]] ObjectType Type() const {
+    return IsInteger() ? ObjectType::INTEGER_OBJ : get()->Type();
+  }
+  [[nodiscard]] bool IsInteger() const { return m_tag == Tag::INTEGER; }
+  // only valid when IsInteger()
+  [[nodiscard]] long int AsInteger() const { return m_int.m_value; }
+
+  // Boxes inline values and pins collected ones, for code that still wants
+  // a shared_ptr
+  [[nodiscard]] std::shared_ptr<IObject> Shared() const;
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  operator std::shared_ptr<IObject>() const { return Shared(); }
+
+  void Trace(Gc::Heap &heap) const {
+    if (m_tag == Tag::COLLECTED) {
+      heap.Mark(m_ptr);
+    } else if (m_tag == Tag::HEAP) {
+      // shared objects aren't the heap's, but may hold values that are
+      m_heap->Trace(heap);
+    }
+  }
+
+private:
+  enum class Tag : std::uint8_t { EMPTY, INTEGER, IMMORTAL, COLLECTED, HEAP };
+  Tag m_tag = Tag::EMPTY;
+  union {
+    Integer m_int;
+    IObject *m_ptr;
+    std::shared_ptr<IObject> m_heap;
+  };
+
+  // the shared_ptr is let go of out of line, so that the rest stays small
+  // enough to inline where values are copied and overwritten in a loop
+  void reset() {
+    if (m_tag == Tag::HEAP) {
+      releaseHeap();
+    }
+    m_tag = Tag::EMPTY;
+  }
+  void releaseHeap();
+  void copyFrom(const Value &other) {
+    switch (other.m_tag) {
+    case Tag::INTEGER:
+      new (&m_int) Integer(other.m_int.m_value);
+      break;
+    case Tag::HEAP:
+      new (&m_heap) std::shared_ptr<IObject>(other.m_heap);
+      break;
+    default:
+      m_ptr = other.m_ptr;
+      break;
+    }
+    m_tag = other.m_tag;
+  }
+  void moveFrom(Value &other) {
+    if (other.m_tag == Tag::HEAP) {
+      new (&m_heap) std::shared_ptr<IObject>(std::move(other.m_heap));
+      m_tag = Tag::HEAP;
+      other.reset();
+      return;
+    }
+    copyFrom(other);
+    other.m_tag = Tag::EMPTY;
+  }
+};
+
+class Environment;
+// An AST node the evaluator has compiled into a closure
+using CompiledNode =
+  std::function<Value(Evaluator::Evaluator &ev, Environment *env)>;
+
+// Runtime objects and environments are owned by the collector
+template <typename T, typename... Args> T *New(Args &&...args) {
+  return Gc::Heap::Current().Make<T>(std::forward<Args>(args)...);
+}
+
+// Made with New. The outer environment is kept alive by the collector for
+// as long as anything (a closure, a call in progress) can still see this one.
+class Environment : public Gc::Collectable {
+public:
+  struct EnvObj {
+    Value obj;
+    bool ok;
+  };
+  Environment();
+  // layout is the resolved scope of the function being called, when it is
+  // null the environment gets a layout of its own that grows on Set
+  explicit Environment(Environment *outerEnv,
+                       std::shared_ptr<Ast::ScopeLayout> layout = nullptr);
+  EnvObj Get(Symbols::Symbol name);
+  void Set(Symbols::Symbol name, Value obj);
+
+  // Fast paths for identifiers the resolver has given a lexical address.
+  // GetAt returns nullptr for a slot that has not been assigned yet.
+  const Value &GetAt(int depth, int slot);
+  // depth environments up the chain, nullptr past the outermost
+  Environment *Outer(int depth);
+  // Binding nullptr (what an empty block evaluates to) binds null, only a
+  // slot that was never assigned is empty
+  void SetAt(int slot, Value obj);
+  // Makes this the environment of a new call, keeping the slots' storage
+  // and, when it is the same, the layout. Used by the evaluator to recycle
+  // environments nothing captured.
+  void Reset(Environment *outerEnv,
+             const std::shared_ptr<Ast::ScopeLayout> &layout);
+  [[nodiscard]] const std::shared_ptr<Ast::ScopeLayout> &Layout() const;
+
+  void PrintEnv();
+  void Trace(Gc::Heap &heap) const override;
+
+private:
+  Environment *m_outerEnv = nullptr;
+  std::shared_ptr<Ast::ScopeLayout> m_layout;
+  std::vector<Value> m_slots;
+};
+
 struct ReturnValue : public IObject {
-  std::shared_ptr<IObject> m_value;
-  explicit ReturnValue(std::shared_ptr<IObject> value);
+  Value m_value;
+  explicit ReturnValue(Value value);
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
 };
 
 struct Error : public IObject {
   std::string m_message;
+  // where in the program it came from, the innermost statement it came
+  // out of in the evaluator and the node that failed in the stack
+  // evaluator. Unknown in the vm.
+  Token::Offset m_offset = Token::NoOffset;
+  // the Source m_offset is in. For an error raised in a function that's
+  // the one the function was parsed from, not the Program that called it.
+  std::shared_ptr<const Token::Source> m_source;
   explicit Error(std::string message);
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
 };
+// What every function made from one literal shares, made once per literal
+// and not changed after that. Holds on to what it needs from the literal so
+// it doesn't matter when the Program goes away.
+struct FunctionPrototype {
+  // the arena the body was parsed into, declared first so it outlives it
+  std::shared_ptr<Ast::Arena> m_arena;
+  // never reused, unlike the address, so a cache can't take a new
+  // prototype for a freed one
+  std::uint64_t m_id;
+  std::vector<Symbols::Symbol> m_parameters;
+  std::shared_ptr<Ast::BlockStatement> m_body;
+  std::shared_ptr<Ast::ScopeLayout> m_layout;
+  // the body compiled, what a call runs in the evaluator. Empty for the
+  // stack evaluator, which runs the body itself.
+  CompiledNode m_compiled;
+
+  explicit FunctionPrototype(const Ast::FunctionLiteral *literal,
+                             CompiledNode compiled = nullptr);
+};
+
+// A closure: its prototype and the environment the literal was evaluated in
 struct Function : public IObject {
-  std::vector<std::unique_ptr<Ast::Identifier>> m_parameters;
-  std::shared_ptr<Environment> m_env;
-  std::unique_ptr<Ast::BlockStatement> m_body;
-  Function(std::vector<std::unique_ptr<Ast::Identifier>> parameters,
-           std::shared_ptr<Environment> env,
-           std::unique_ptr<Ast::BlockStatement> body);
+  std::shared_ptr<const FunctionPrototype> m_prototype;
+  Environment *m_env;
+  Function(std::shared_ptr<const FunctionPrototype> prototype,
+           Environment *env);
+
+  [[nodiscard]] const std::vector<Symbols::Symbol> &Parameters() const {
+    return m_prototype->m_parameters;
+  }
+  [[nodiscard]] Ast::BlockStatement *Body() const {
+    return m_prototype->m_body.get();
+  }
+  // null when the literal was never resolved
+  [[nodiscard]] const std::shared_ptr<Ast::ScopeLayout> &Layout() const {
+    return m_prototype->m_layout;
+  }
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
 };
 
+// Either flat or a rope, the concatenation of two other strings that is
+// only copied into one buffer when the characters are needed (comparing,
+// hashing, Inspect). Building a string out of many small pieces is linear
+// that way instead of copying everything built so far on every +.
 struct String : public IObject {
-  std::string m_value;
   explicit String(std::string value);
+  // left + right, both strings
+  String(Value left, Value right);
+
+  // Results up to this long are copied instead of becoming a rope node, and
+  // a short piece appended to a rope is merged into the rope's last leaf
+  // while that stays under it, so leaves don't end up a few bytes each
+  static constexpr std::size_t FlatMax = 256;
+  static Value Concat(const Value &left, const Value &right);
+
+  // flattens a rope, once
+  [[nodiscard]] const std::string &Flat() const;
+  [[nodiscard]] std::size_t Length() const { return m_length; }
+  [[nodiscard]] bool IsRope() const { return m_left != nullptr; }
+
+  // hashed the first time the string is used as a key
+  [[nodiscard]] HashKey GetHashKey() const;
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
+
+private:
+  mutable std::string m_value;
+  // set while this is a rope, let go of once it is flattened
+  mutable Value m_left;
+  mutable Value m_right;
+  std::size_t m_length;
+  mutable std::uint64_t m_hash = 0;
+  mutable bool m_hashed = false;
+};
+
+// Immutable vector that shares structure between versions, a 32-way trie
+// with the last (up to) 32 elements kept in a tail leaf the way Clojure's
+// vector does it. Push only copies the tail, and not even that when
+// nothing was pushed on the same version before, so building an array one
+// element at a time is amortised O(1). Rest is a slice that moves the start
+// along and shares everything.
+class PersistentVector {
+  static constexpr std::size_t Bits = 5;
+  static constexpr std::size_t Width = 1 << Bits;
+  static constexpr std::size_t Mask = Width - 1;
+
+  struct Node {};
+  struct Leaf : Node {
+    std::array<Value, Width> m_values;
+    // slots written so far, a version whose tail ends there may append in
+    // place since nobody else can see past it
+    std::size_t m_used = 0;
+  };
+  struct Branch : Node {
+    std::array<std::shared_ptr<Node>, Width> m_children;
+  };
+
+public:
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Value *;
+    using reference = const Value &;
+
+    Iterator() = default;
+    Iterator(const PersistentVector *vec, std::size_t index)
+      : m_vec(vec), m_index(index) {}
+    reference operator*() const {
+      std::size_t pos = m_vec->m_offset + m_index;
+      if (m_leaf == nullptr) {
+        m_leaf = m_vec->leafFor(pos);
+      }
+      return m_leaf[pos & Mask];
+    }
+    pointer operator->() const { return &**this; }
+    Iterator &operator++() {
+      m_index++;
+      if (((m_vec->m_offset + m_index) & Mask) == 0) {
+        m_leaf = nullptr;
+      }
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator prev = *this;
+      ++*this;
+      return prev;
+    }
+    friend bool operator==(const Iterator &a, const Iterator &b) {
+      return a.m_index == b.m_index;
+    }
+
+  private:
+    const PersistentVector *m_vec = nullptr;
+    std::size_t m_index = 0;
+    // values of the leaf m_index is in, looked up once per leaf
+    mutable const Value *m_leaf = nullptr;
+  };
+
+  PersistentVector() = default;
+  explicit PersistentVector(const std::vector<Value> &values);
+
+  [[nodiscard]] std::size_t size() const { return m_end - m_offset; }
+  [[nodiscard]] bool empty() const { return m_end == m_offset; }
+  const Value &operator[](std::size_t index) const {
+    std::size_t pos = m_offset + index;
+    return leafFor(pos)[pos & Mask];
+  }
+  [[nodiscard]] Iterator begin() const { return {this, 0}; }
+  [[nodiscard]] Iterator end() const { return {this, size()}; }
+
+  // a new version with value appended
+  [[nodiscard]] PersistentVector Push(Value value) const;
+  // a new version without the first element, must not be empty
+  [[nodiscard]] PersistentVector Rest() const;
+
+private:
+  std::shared_ptr<Branch> m_root;
+  std::shared_ptr<Leaf> m_tail;
+  // bits to shift an index by to pick the child of the root
+  std::size_t m_shift = Bits;
+  // elements live at [m_offset, m_end) in trie positions
+  std::size_t m_offset = 0;
+  std::size_t m_end = 0;
+
+  [[nodiscard]] std::size_t tailOffset() const {
+    return m_end < Width ? 0 : ((m_end - 1) >> Bits) << Bits;
+  }
+  [[nodiscard]] const Value *leafFor(std::size_t pos) const;
+  std::shared_ptr<Branch> pushTail(std::size_t level, const Branch *parent,
+                                   std::shared_ptr<Leaf> tail) const;
+  static std::shared_ptr<Node> newPath(std::size_t level,
+                                       std::shared_ptr<Leaf> tail);
 };
 
 struct Array : public IObject {
-  std::vector<std::shared_ptr<IObject>> m_elements;
+  PersistentVector m_elements;
 
-  explicit Array(std::vector<std::shared_ptr<IObject>> elements);
+  explicit Array(const std::vector<Value> &elements);
+  explicit Array(PersistentVector elements);
   [[nodiscard]] ObjectType Type() const override;
   [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
 };
 
-using BuiltinFunction = std::function<std::shared_ptr<IObject>(
-  const std::vector<std::shared_ptr<IObject>> &args)>;
+// nullopt for values that can't be used as a hash key
+std::optional<HashKey> HashKeyOf(const Value &value);
+
+// Insertion ordered map in the style of a Swiss table. The pairs live in a
+// dense vector in the order they were added, the table only holds indices
+// into it. Slots come in groups of eight with a control byte each that is
+// either empty or 7 bits of the key's hash, so a lookup checks a whole
+// group with a few word operations and only compares keys on a byte match.
+struct Hash : public IObject {
+  struct Pair {
+    HashKey m_hashKey;
+    Value m_key;
+    Value m_value;
+  };
+
+  Hash() = default;
+  explicit Hash(std::size_t capacity);
+
+  // nullptr if the key is not in the hash. hashKey is key's, keys whose
+  // hashes collide are told apart by comparing them.
+  [[nodiscard]] const Pair *Find(const HashKey &hashKey,
+                                 const Value &key) const;
+  // replaces the value if the key is already there
+  void Set(const HashKey &hashKey, Value key, Value value);
+  [[nodiscard]] const std::vector<Pair> &Pairs() const { return m_pairs; }
+  [[nodiscard]] std::size_t Size() const { return m_pairs.size(); }
+
+  [[nodiscard]] ObjectType Type() const override;
+  [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
+
+private:
+  static constexpr std::size_t GroupSize = 8;
+
+  std::vector<Pair> m_pairs;
+  std::vector<std::uint8_t> m_ctrl;
+  std::vector<std::uint32_t> m_slots;
+
+  // slot of the key, or of the empty slot it would go in
+  [[nodiscard]] std::size_t probe(const HashKey &hashKey, const Value &key,
+                                  std::uint64_t hash, bool &found) const;
+  void rehash(std::size_t capacity);
+};
+
+// args point into the caller's stack and are only valid during the call
+using BuiltinFunction = std::function<Value(std::span<const Value> args)>;
 struct Builtin : IObject {
   BuiltinFunction m_fn;
   explicit Builtin(BuiltinFunction fn);
@@ -110,4 +534,25 @@ struct Builtin : IObject {
   [[nodiscard]] std::string Inspect() const override;
 };
 
+// Function body compiled to bytecode for the vm
+struct CompiledFunction : public IObject {
+  Code::Instructions m_instructions;
+  int m_numLocals;
+  int m_numParameters;
+  CompiledFunction(Code::Instructions instructions, int numLocals,
+                   int numParameters);
+  [[nodiscard]] ObjectType Type() const override;
+  [[nodiscard]] std::string Inspect() const override;
+};
+
+// A compiled function together with the free variables it closes over
+struct Closure : public IObject {
+  std::shared_ptr<CompiledFunction> m_fn;
+  std::vector<Value> m_free;
+  Closure(std::shared_ptr<CompiledFunction> fn, std::vector<Value> free);
+  [[nodiscard]] ObjectType Type() const override;
+  [[nodiscard]] std::string Inspect() const override;
+  void Trace(Gc::Heap &heap) const override;
+};
+
 } // namespace Object
@@ -0,0 +1,330 @@
+#include "optimizer.hpp"
+#include "ast.hpp"
+#include <climits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+namespace Optimizer {
+
+namespace {
+bool isLiteral(const Ast::INode *node) {
+  if (node == nullptr) {
+    return false;
+  }
+  switch (node->Type()) {
+  case Ast::Type::INTEGER_LITERAL:
+  case Ast::Type::BOOLEAN:
+  case Ast::Type::STRING_LITERAL:
+  case Ast::Type::FUNCTION_LITERAL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the same as Evaluator::isTruthy for the literals a condition can fold to
+bool isTruthy(Ast::INode *literal) {
+  if (auto *boolean = Ast::As<Ast::Boolean>(literal)) {
+    return boolean->m_value;
+  }
+  return true;
+}
+
+// an if whose condition is a literal, after optimizeIf
+Ast::IfExpression *decidedIf(Ast::INode *node) {
+  auto *ifExpr = Ast::As<Ast::IfExpression>(node);
+  if (ifExpr == nullptr || !isLiteral(ifExpr->m_condition.get())) {
+    return nullptr;
+  }
+  return ifExpr;
+}
+} // namespace
+
+// Programs parsed without an arena aren't folded, there would be nothing to
+// keep the text of the new literals alive
+void Optimizer::Optimize(Ast::Program *program) {
+  m_arena = program->m_arena.get();
+  Ast::Arena::Scope arenaScope(m_arena);
+  optimizeStatements(program->m_statements);
+}
+
+// Literals and decided ifs are dropped or spliced into the list, except the
+// last statement whose value is the value of the list
+template <typename Statements>
+void Optimizer::optimizeStatements(Statements &statements) {
+  Statements out(statements.get_allocator());
+  out.reserve(statements.size());
+  for (std::size_t i = 0; i < statements.size(); i++) {
+    auto &stmt = statements[i];
+    bool last = i == statements.size() - 1;
+    optimizeStatement(stmt.get());
+    auto *exprStmt = Ast::As<Ast::ExpressionStatement>(stmt.get());
+    if (exprStmt == nullptr) {
+      out.push_back(std::move(stmt));
+      continue;
+    }
+    auto *expr = exprStmt->m_expression.get();
+    if (auto *ifExpr = decidedIf(expr)) {
+      if (isTruthy(ifExpr->m_condition.get()) &&
+          !(last && ifExpr->m_consequence->m_statements.empty())) {
+        // blocks have no scope of their own, so the branch's statements can
+        // run in the enclosing list
+        for (auto &branchStmt : ifExpr->m_consequence->m_statements) {
+          out.push_back(std::move(branchStmt));
+        }
+        m_stats.m_prunedBranches++;
+        continue;
+      }
+      if (!isTruthy(ifExpr->m_condition.get()) && !last) {
+        m_stats.m_prunedBranches++;
+        continue;
+      }
+    }
+    if (isLiteral(expr) && !last) {
+      m_stats.m_droppedStatements++;
+      continue;
+    }
+    out.push_back(std::move(stmt));
+  }
+  statements = std::move(out);
+}
+
+void Optimizer::optimizeStatement(Ast::IStatement *stmt) {
+  switch (stmt->Type()) {
+  case Ast::Type::LET_STATEMENT:
+    optimize(Ast::Cast<Ast::LetStatement>(stmt)->m_expression);
+    return;
+  case Ast::Type::RETURN_STATEMENT:
+    optimize(Ast::Cast<Ast::ReturnStatement>(stmt)->m_returnValue);
+    return;
+  case Ast::Type::EXPRESSION_STATEMENT:
+    optimize(Ast::Cast<Ast::ExpressionStatement>(stmt)->m_expression);
+    return;
+  case Ast::Type::BLOCK_STATEMENT:
+    optimizeStatements(Ast::Cast<Ast::BlockStatement>(stmt)->m_statements);
+    return;
+  default:
+    return;
+  }
+}
+
+// Children first, so folding works its way up from the leaves
+void Optimizer::optimize(std::unique_ptr<Ast::IExpression> &expr) {
+  if (expr == nullptr) {
+    return;
+  }
+  switch (expr->Type()) {
+  case Ast::Type::PREFIX_EXPRESSION: {
+    auto *prefix = Ast::Cast<Ast::PrefixExpression>(expr.get());
+    optimize(prefix->m_right);
+    if (auto folded = fold(prefix)) {
+      expr = std::move(folded);
+      m_stats.m_folded++;
+    }
+    return;
+  }
+  case Ast::Type::INFIX_EXPRESSION: {
+    auto *infix = Ast::Cast<Ast::InfixExpression>(expr.get());
+    optimize(infix->m_left);
+    optimize(infix->m_right);
+    if (auto folded = fold(infix)) {
+      expr = std::move(folded);
+      m_stats.m_folded++;
+    }
+    return;
+  }
+  case Ast::Type::IF_EXPRESSION:
+    optimizeIf(expr);
+    return;
+  case Ast::Type::FUNCTION_LITERAL: {
+    auto *fun = Ast::Cast<Ast::FunctionLiteral>(expr.get());
+    if (fun->m_body != nullptr) {
+      optimizeStatements(fun->m_body->m_statements);
+    }
+    return;
+  }
+  case Ast::Type::CALL_EXPRESSION: {
+    auto *callExpr = Ast::Cast<Ast::CallExpression>(expr.get());
+    optimize(callExpr->m_function);
+    for (auto &arg : callExpr->m_arguments) {
+      optimize(arg);
+    }
+    return;
+  }
+  case Ast::Type::ARRAY_LITERAL:
+    for (auto &element : Ast::Cast<Ast::ArrayLiteral>(expr.get())->m_elements) {
+      optimize(element);
+    }
+    return;
+  case Ast::Type::INDEX_EXPRESSION: {
+    auto *idxExp = Ast::Cast<Ast::IndexExpression>(expr.get());
+    optimize(idxExp->m_left);
+    optimize(idxExp->m_index);
+    return;
+  }
+  case Ast::Type::HASH_EXPRESSION:
+    for (auto &[key, value] : Ast::Cast<Ast::HashLiteral>(expr.get())->m_pairs) {
+      optimize(key);
+      optimize(value);
+    }
+    return;
+  default:
+    return;
+  }
+}
+
+// A decided if becomes the expression its branch is when that is all the
+// branch holds. Otherwise the branch not taken is dropped and a false
+// condition with an else is turned around, leaving an if with a true
+// condition and no else for optimizeStatements to splice.
+void Optimizer::optimizeIf(std::unique_ptr<Ast::IExpression> &expr) {
+  auto *ifExpr = Ast::Cast<Ast::IfExpression>(expr.get());
+  optimize(ifExpr->m_condition);
+  optimizeStatements(ifExpr->m_consequence->m_statements);
+  if (ifExpr->m_alternative != nullptr) {
+    optimizeStatements(ifExpr->m_alternative->m_statements);
+  }
+  if (decidedIf(ifExpr) == nullptr) {
+    return;
+  }
+  if (!isTruthy(ifExpr->m_condition.get())) {
+    if (ifExpr->m_alternative == nullptr) {
+      // evaluates to null, which has no literal
+      return;
+    }
+    ifExpr->m_consequence = std::move(ifExpr->m_alternative);
+    ifExpr->m_condition = boolean(true);
+  }
+  ifExpr->m_alternative = nullptr;
+  m_stats.m_prunedBranches++;
+
+  auto &taken = ifExpr->m_consequence->m_statements;
+  if (taken.size() == 1) {
+    auto *exprStmt = Ast::As<Ast::ExpressionStatement>(taken[0].get());
+    if (exprStmt != nullptr && exprStmt->m_expression != nullptr) {
+      expr = std::move(exprStmt->m_expression);
+    }
+  }
+}
+
+std::unique_ptr<Ast::IExpression>
+Optimizer::fold(Ast::PrefixExpression *prefix) {
+  auto *right = prefix->m_right.get();
+  if (m_arena == nullptr || !isLiteral(right) ||
+      right->Type() == Ast::Type::FUNCTION_LITERAL) {
+    return nullptr;
+  }
+  switch (prefix->m_operator) {
+  case Ast::Operator::MINUS: {
+    auto *integer = Ast::As<Ast::IntegerLiteral>(right);
+    if (integer == nullptr || integer->m_value == LONG_MIN) {
+      return nullptr;
+    }
+    return this->integer(-integer->m_value);
+  }
+  case Ast::Operator::BANG:
+    // anything that isn't a boolean or null is truthy
+    return boolean(!isTruthy(right));
+  default:
+    return nullptr;
+  }
+}
+
+std::unique_ptr<Ast::IExpression>
+Optimizer::fold(Ast::InfixExpression *infix) {
+  if (m_arena == nullptr) {
+    return nullptr;
+  }
+  using Ast::Operator;
+  auto op = infix->m_operator;
+  auto *leftInt = Ast::As<Ast::IntegerLiteral>(infix->m_left.get());
+  auto *rightInt = Ast::As<Ast::IntegerLiteral>(infix->m_right.get());
+  if (leftInt != nullptr && rightInt != nullptr) {
+    long int a = leftInt->m_value;
+    long int b = rightInt->m_value;
+    long int result = 0;
+    switch (op) {
+    // overflow is left to happen at runtime, the same as before
+    case Operator::PLUS:
+      return __builtin_add_overflow(a, b, &result) ? nullptr : integer(result);
+    case Operator::MINUS:
+      return __builtin_sub_overflow(a, b, &result) ? nullptr : integer(result);
+    case Operator::ASTERISK:
+      return __builtin_mul_overflow(a, b, &result) ? nullptr : integer(result);
+    case Operator::SLASH:
+      if (b == 0 || (a == LONG_MIN && b == -1)) {
+        return nullptr;
+      }
+      return integer(a / b);
+    case Operator::LT:
+      return boolean(a < b);
+    case Operator::GT:
+      return boolean(a > b);
+    case Operator::EQ:
+      return boolean(a == b);
+    case Operator::NOT_EQ:
+      return boolean(a != b);
+    default:
+      return nullptr;
+    }
+  }
+
+  auto *leftBool = Ast::As<Ast::Boolean>(infix->m_left.get());
+  auto *rightBool = Ast::As<Ast::Boolean>(infix->m_right.get());
+  if (leftBool != nullptr && rightBool != nullptr) {
+    if (op == Operator::EQ) {
+      return boolean(leftBool->m_value == rightBool->m_value);
+    }
+    if (op == Operator::NOT_EQ) {
+      return boolean(leftBool->m_value != rightBool->m_value);
+    }
+    return nullptr;
+  }
+
+  auto *leftStr = Ast::As<Ast::StringLiteral>(infix->m_left.get());
+  auto *rightStr = Ast::As<Ast::StringLiteral>(infix->m_right.get());
+  if (leftStr != nullptr && rightStr != nullptr) {
+    switch (op) {
+    case Operator::PLUS:
+      return string(leftStr->m_value + rightStr->m_value);
+    case Operator::EQ:
+      return boolean(leftStr->m_value == rightStr->m_value);
+    case Operator::NOT_EQ:
+      return boolean(leftStr->m_value != rightStr->m_value);
+    default:
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Ast::IExpression> Optimizer::integer(long int value) {
+  return std::make_unique<Ast::IntegerLiteral>(
+    Token::Token{.Type = Token::INT,
+                 .Literal = literalText(std::to_string(value)),
+                 .Int = value},
+    value);
+}
+
+std::unique_ptr<Ast::IExpression> Optimizer::boolean(bool value) {
+  return std::make_unique<Ast::Boolean>(
+    Token::Token{.Type = value ? Token::TRUE : Token::FALSE,
+                 .Literal = value ? "true" : "false"},
+    value);
+}
+
+std::unique_ptr<Ast::IExpression> Optimizer::string(std::string value) {
+  auto literal = literalText(value);
+  return std::make_unique<Ast::StringLiteral>(
+    Token::Token{.Type = Token::STRING, .Literal = literal}, std::move(value));
+}
+
+// Tokens only point at their text, the arena owns it along with the nodes
+std::string_view Optimizer::literalText(std::string text) {
+  auto owned = std::make_shared<const std::string>(std::move(text));
+  m_arena->Retain(owned);
+  return *owned;
+}
+
+} // namespace Optimizer
@@ -0,0 +1,47 @@
+#pragma once
+#include "ast.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+namespace Optimizer {
+
+// Rewrites a parsed program before it runs. Prefix and infix expressions
+// on integer, boolean and string literals are folded into a literal, an if
+// whose condition is a literal is replaced by the branch it takes, and
+// expression statements that are only a literal are dropped unless their
+// value is the value of the block or program. Expressions that would be an
+// error at runtime (type mismatches, division by zero) are left alone so
+// they still fail the same way.
+class Optimizer {
+public:
+  void Optimize(Ast::Program *program);
+
+  struct Stats {
+    std::size_t m_folded = 0;
+    std::size_t m_prunedBranches = 0;
+    std::size_t m_droppedStatements = 0;
+  };
+  [[nodiscard]] const Stats &Statistics() const { return m_stats; }
+
+private:
+  // keeps the text of folded literals alive, see literalText
+  Ast::Arena *m_arena = nullptr;
+  Stats m_stats;
+
+  void optimize(std::unique_ptr<Ast::IExpression> &expr);
+  // the program's list or a block's
+  template <typename Statements>
+  void optimizeStatements(Statements &statements);
+  void optimizeStatement(Ast::IStatement *stmt);
+  void optimizeIf(std::unique_ptr<Ast::IExpression> &expr);
+
+  std::unique_ptr<Ast::IExpression> fold(Ast::PrefixExpression *prefix);
+  std::unique_ptr<Ast::IExpression> fold(Ast::InfixExpression *infix);
+  std::unique_ptr<Ast::IExpression> integer(long int value);
+  std::unique_ptr<Ast::IExpression> boolean(bool value);
+  std::unique_ptr<Ast::IExpression> string(std::string value);
+  std::string_view literalText(std::string text);
+};
+
+} // namespace Optimizer
@@ -1,46 +1,76 @@
 #include "parser.hpp"
 #include "ast.hpp"
-#include "iostream"
 #include "token.hpp"
+#include <array>
 #include <memory>
-#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 namespace Parser {
 
-Parser::Parser(Lexer::Lexer &lexer) : m_l(lexer) {
+// Parse functions by token type, nullptr where the token can't start (or
+// continue) an expression
+using PrefixTable = std::array<Parser::prefixParseFn, Token::TokenTypeCount>;
+using InfixTable = std::array<Parser::infixParseFn, Token::TokenTypeCount>;
+
+static constexpr PrefixTable prefixParseFns = [] {
+  PrefixTable table{};
+  table[Token::IDENT] = &Parser::parseIdentifier;
+  table[Token::INT] = &Parser::parseIntegerLiteral;
+  table[Token::BANG] = &Parser::parsePrefixExpression;
+  table[Token::MINUS] = &Parser::parsePrefixExpression;
+  table[Token::TRUE] = &Parser::parseBoolean;
+  table[Token::FALSE] = &Parser::parseBoolean;
+  table[Token::LPAREN] = &Parser::parseGroupedExpression;
+  table[Token::IF] = &Parser::parseIfExpression;
+  table[Token::FUNCTION] = &Parser::parseFunctionLiteral;
+  table[Token::STRING] = &Parser::parseStringLiteral;
+  table[Token::LBRACKET] = &Parser::parseArrayLiteral;
+  table[Token::LBRACE] = &Parser::ParseHashLiteral;
+  return table;
+}();
+
+static constexpr InfixTable infixParseFns = [] {
+  InfixTable table{};
+  table[Token::PLUS] = &Parser::parseInfixExpression;
+  table[Token::MINUS] = &Parser::parseInfixExpression;
+  table[Token::SLASH] = &Parser::parseInfixExpression;
+  table[Token::ASTERISK] = &Parser::parseInfixExpression;
+  table[Token::EQ] = &Parser::parseInfixExpression;
+  table[Token::NOT_EQ] = &Parser::parseInfixExpression;
+  table[Token::LT] = &Parser::parseInfixExpression;
+  table[Token::GT] = &Parser::parseInfixExpression;
+  table[Token::LPAREN] = &Parser::parseCallExpression;
+  table[Token::LBRACKET] = &Parser::parseIndexExpression;
+  return table;
+}();
+
+Parser::Parser(Lexer::Lexer &lexer, bool useArena)
+  : m_l(&lexer), m_useArena(useArena) {
+  nextToken();
+  nextToken();
+}
+
+Parser::Parser(const Lexer::TokenBuffer &tokens, bool useArena)
+  : m_tokens(&tokens), m_useArena(useArena) {
   nextToken();
   nextToken();
-  registerPrefix(Token::IDENT, &Parser::parseIdentifier);
-  registerPrefix(Token::INT, &Parser::parseIntegerLiteral);
-  registerPrefix(Token::BANG, &Parser::parsePrefixExpression);
-  registerPrefix(Token::MINUS, &Parser::parsePrefixExpression);
-  registerPrefix(Token::TRUE, &Parser::parseBoolean);
-  registerPrefix(Token::FALSE, &Parser::parseBoolean);
-  registerPrefix(Token::LPAREN, &Parser::parseGroupedExpression);
-  registerPrefix(Token::IF, &Parser::parseIfExpression);
-  registerPrefix(Token::FUNCTION, &Parser::parseFunctionLiteral);
-  registerPrefix(Token::STRING, &Parser::parseStringLiteral);
-  registerPrefix(Token::LBRACKET, &Parser::parseArrayLiteral);
-  registerPrefix(Token::LBRACE, &Parser::ParseHashLiteral);
-
-  registerInfix(Token::PLUS, &Parser::parseInfixExpression);
-  registerInfix(Token::MINUS, &Parser::parseInfixExpression);
-  registerInfix(Token::SLASH, &Parser::parseInfixExpression);
-  registerInfix(Token::ASTERISK, &Parser::parseInfixExpression);
-  registerInfix(Token::EQ, &Parser::parseInfixExpression);
-  registerInfix(Token::NOT_EQ, &Parser::parseInfixExpression);
-  registerInfix(Token::LT, &Parser::parseInfixExpression);
-  registerInfix(Token::GT, &Parser::parseInfixExpression);
-  registerInfix(Token::LPAREN, &Parser::parseCallExpression);
-  registerInfix(Token::LBRACKET, &Parser::parseIndexExpression);
 }
 
 void Parser::nextToken() {
   m_curToken = m_peekToken;
-  m_peekToken = m_l.NextToken();
+  m_peekToken =
+    m_tokens != nullptr ? m_tokens->Next(m_cursor) : m_l->NextToken();
 }
 
 Ast::Program Parser::ParseProgram() {
   Ast::Program program;
+  program.m_source = m_tokens != nullptr ? m_tokens->Source() : m_l->Source();
+  if (m_useArena) {
+    program.m_arena = std::make_shared<Ast::Arena>();
+    program.m_arena->SetSource(program.m_source);
+  }
+  Ast::Arena::Scope arenaScope(program.m_arena.get());
   while (m_curToken.Type != Token::EOF_) {
     std::unique_ptr<Ast::IStatement> stmt = parseStatement();
     if (stmt != nullptr) {
@@ -70,8 +100,7 @@ std::unique_ptr<Ast::LetStatement> Parser::parseLetStatement() {
     return nullptr;
   }
 
-  stmt->m_name =
-    std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Literal);
+  stmt->m_name = std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Name);
   if (!expectPeek(Token::ASSIGN)) {
     return nullptr;
   }
@@ -107,10 +136,8 @@ std::unique_ptr<Ast::ExpressionStatement> Parser::parseExpressionStatement() {
 
 std::unique_ptr<Ast::IExpression>
 Parser::parseExpression(Precedence precedence) {
-  prefixParseFn prefix;
-  try {
-    prefix = m_prefixParseFns.at(m_curToken.Type);
-  } catch (std::out_of_range &err) {
+  prefixParseFn prefix = prefixParseFns[m_curToken.Type];
+  if (prefix == nullptr) {
     noPrefixParseFnError(m_curToken.Type);
     return nullptr;
   }
@@ -118,10 +145,8 @@ Parser::parseExpression(Precedence precedence) {
   auto leftExp = (this->*prefix)();
 
   while (!peekTokenIs(Token::SEMICOLON) && precedence < peekPrecedence()) {
-    infixParseFn infix;
-    try {
-      infix = m_infixParseFns.at(m_peekToken.Type);
-    } catch (std::out_of_range &err) {
+    infixParseFn infix = infixParseFns[m_peekToken.Type];
+    if (infix == nullptr) {
       return leftExp;
     }
     nextToken();
@@ -132,26 +157,25 @@ Parser::parseExpression(Precedence precedence) {
 }
 
 std::unique_ptr<Ast::IExpression> Parser::parseIdentifier() {
-  auto ident =
-    std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Literal);
+  auto ident = std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Name);
   return ident;
 }
 
 std::unique_ptr<Ast::IExpression> Parser::parseIntegerLiteral() {
-  try {
-    long int value = stoi(m_curToken.Literal);
-    auto lit = std::make_unique<Ast::IntegerLiteral>(m_curToken, value);
-    return lit;
-  } catch (const std::invalid_argument &ia) {
-    std::string msg = "could not parse " + m_curToken.Literal + "as integer";
-    m_errors.push_back(msg);
+  // the lexer already decoded the digits
+  if (m_curToken.Int < 0) {
+    std::string msg =
+      "could not parse " + std::string(m_curToken.Literal) + " as integer";
+    addError(msg, m_curToken);
     return nullptr;
   }
+  return std::make_unique<Ast::IntegerLiteral>(m_curToken, m_curToken.Int);
 }
 
 std::unique_ptr<Ast::IExpression> Parser::parsePrefixExpression() {
   auto expression =
-    std::make_unique<Ast::PrefixExpression>(m_curToken, m_curToken.Literal);
+    std::make_unique<Ast::PrefixExpression>(m_curToken,
+                                            std::string(m_curToken.Literal));
   nextToken();
   expression->m_right = parseExpression(PREFIX);
   return expression;
@@ -160,7 +184,7 @@ std::unique_ptr<Ast::IExpression> Parser::parsePrefixExpression() {
 std::unique_ptr<Ast::IExpression>
 Parser::parseInfixExpression(std::unique_ptr<Ast::IExpression> left) {
   auto expression = std::make_unique<Ast::InfixExpression>(
-    m_curToken, std::move(left), m_curToken.Literal);
+    m_curToken, std::move(left), std::string(m_curToken.Literal));
   Precedence precedence = curPrecedence();
   nextToken();
   expression->m_right = parseExpression(precedence);
@@ -239,23 +263,22 @@ std::unique_ptr<Ast::IExpression> Parser::parseFunctionLiteral() {
   return expression;
 }
 
-std::vector<std::unique_ptr<Ast::Identifier>>
-Parser::parseFunctionParameters() {
-  std::vector<std::unique_ptr<Ast::Identifier>> identifiers;
+Ast::NodeList<Ast::Identifier> Parser::parseFunctionParameters() {
+  Ast::NodeList<Ast::Identifier> identifiers;
   if (peekTokenIs(Token::RPAREN)) {
     nextToken();
     return identifiers;
   }
 
   nextToken();
-  identifiers.push_back(
-    std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Literal));
+  identifiers.push_back(std::make_unique<Ast::Identifier>(
+    m_curToken, m_curToken.Name));
 
   while (peekTokenIs(Token::COMMA)) {
     nextToken();
     nextToken();
-    identifiers.push_back(
-      std::make_unique<Ast::Identifier>(m_curToken, m_curToken.Literal));
+    identifiers.push_back(std::make_unique<Ast::Identifier>(
+      m_curToken, m_curToken.Name));
   }
   if (!expectPeek(Token::RPAREN)) {
     malformedFunctionParameterListError();
@@ -273,7 +296,8 @@ Parser::parseCallExpression(std::unique_ptr<Ast::IExpression> function) {
 }
 
 std::unique_ptr<Ast::IExpression> Parser::parseStringLiteral() {
-  return make_unique<Ast::StringLiteral>(m_curToken, m_curToken.Literal);
+  return make_unique<Ast::StringLiteral>(m_curToken,
+                                         std::string(m_curToken.Literal));
 }
 
 std::unique_ptr<Ast::IExpression> Parser::parseArrayLiteral() {
@@ -282,9 +306,9 @@ std::unique_ptr<Ast::IExpression> Parser::parseArrayLiteral() {
   return array;
 }
 
-std::vector<std::unique_ptr<Ast::IExpression>>
+Ast::NodeList<Ast::IExpression>
 Parser::parseExpressionList(Token::TokenType end) {
-  std::vector<std::unique_ptr<Ast::IExpression>> list;
+  Ast::NodeList<Ast::IExpression> list;
   if (peekTokenIs(end)) {
     nextToken();
     return list;
@@ -315,41 +339,24 @@ Parser::parseIndexExpression(std::unique_ptr<Ast::IExpression> left) {
 
 std::unique_ptr<Ast::IExpression> Parser::ParseHashLiteral() {
   auto hash = std::make_unique<Ast::HashLiteral>(m_curToken);
-  hash->m_pairs = std::unordered_map<std::unique_ptr<Ast::IExpression>,
-                                     std::unique_ptr<Ast::IExpression>>{};
-  while (peekTokenIs(Token::RBRACE) == false) {
+  while (!peekTokenIs(Token::RBRACE)) {
     nextToken();
     auto key = parseExpression(LOWEST);
-    if (expectPeek(Token::COLON) == false) {
-
-      std::cout << "3" << std::endl;
+    if (!expectPeek(Token::COLON)) {
       return nullptr;
     }
     nextToken();
     auto value = parseExpression(LOWEST);
-    hash->m_pairs[std::move(key)] = std::move(value);
-    if (peekTokenIs(Token::RBRACE) == false &&
-        expectPeek(Token::COMMA) == false) {
-
-      std::cout << "2" << std::endl;
+    hash->m_pairs.emplace_back(std::move(key), std::move(value));
+    if (!peekTokenIs(Token::RBRACE) && !expectPeek(Token::COMMA)) {
       return nullptr;
     }
   }
-  if (expectPeek(Token::RBRACE) == false) {
-
-    std::cout << "1" << std::endl;
+  if (!expectPeek(Token::RBRACE)) {
     return nullptr;
   }
-  std::cout << "0" << std::endl;
   return hash;
 }
-void Parser::registerPrefix(Token::TokenType tokenType, prefixParseFn fn) {
-  m_prefixParseFns[tokenType] = fn;
-}
-
-void Parser::registerInfix(Token::TokenType tokenType, infixParseFn fn) {
-  m_infixParseFns[tokenType] = fn;
-}
 
 bool Parser::curTokenIs(Token::TokenType t) { return m_curToken.Type == t; }
 
@@ -366,48 +373,61 @@ bool Parser::expectPeek(Token::TokenType t) {
 }
 
 Precedence Parser::peekPrecedence() {
-  try {
-    Precedence p = precedences.at(m_peekToken.Type);
-    return p;
+  return precedences[m_peekToken.Type];
+}
 
-  }
+Precedence Parser::curPrecedence() { return precedences[m_curToken.Type]; }
 
-  catch (std::out_of_range &err) {
-    return LOWEST;
+std::vector<std::string> Parser::Errors() {
+  std::vector<std::string> messages;
+  messages.reserve(m_errors.size());
+  for (const auto &error : m_errors) {
+    messages.push_back(error.m_message);
   }
+  return messages;
 }
 
-Precedence Parser::curPrecedence() {
-  try {
-    Precedence p = precedences.at(m_curToken.Type);
-    return p;
+std::vector<std::string> Parser::LocatedErrors() {
+  auto source = m_tokens != nullptr ? m_tokens->Source() : m_l->Source();
+  std::vector<std::string> messages;
+  messages.reserve(m_errors.size());
+  for (const auto &error : m_errors) {
+    if (error.m_offset == Token::NoOffset) {
+      messages.push_back(error.m_message);
+      continue;
+    }
+    auto position = source->Locate(error.m_offset);
+    messages.push_back(std::to_string(position.Line) + ":" +
+                       std::to_string(position.Column) + ": " +
+                       error.m_message);
   }
+  return messages;
+}
 
-  catch (std::out_of_range &err) {
-    return LOWEST;
-  }
+void Parser::addError(std::string message, const Token::Token &at) {
+  m_errors.push_back({.m_message = std::move(message), .m_offset = at.Start});
 }
 
-std::vector<std::string> Parser::Errors() { return m_errors; }
 void Parser::peekError(Token::TokenType t) {
   std::string msg = "Expect next token to be " + Token::tokenStringMap.at(t) +
                     ", got " + Token::tokenStringMap.at(m_peekToken.Type) +
                     " instead";
-  m_errors.push_back(msg);
+  addError(msg, m_peekToken);
 }
 
 void Parser::noPrefixParseFnError(Token::TokenType t) {
   std::string msg =
     "no prefix parse function for " + Token::tokenStringMap.at(t) + " found";
-  m_errors.push_back(msg);
+  addError(msg, m_curToken);
 }
 
+// both follow a failed expectPeek, the token that wasn't expected is next
 void Parser::malformedFunctionParameterListError() {
-  m_errors.emplace_back("Malformed Function Parameter List Error.");
+  addError("Malformed Function Parameter List Error.", m_peekToken);
 }
 
 void Parser::malformedExpressionListError() {
-  m_errors.emplace_back("Malformed expression list error.");
+  addError("Malformed expression list error.", m_peekToken);
 }
 
 } // namespace Parser
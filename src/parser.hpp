@@ -1,8 +1,8 @@
 #include "ast.hpp"
 #include "lexer.hpp"
 #include "token.hpp"
+#include <array>
 #include <memory>
-#include <unordered_map>
 namespace Parser {
 
 enum Precedence : std::uint8_t {
@@ -17,25 +17,48 @@ enum Precedence : std::uint8_t {
   INDEX
 };
 
-const std::unordered_map<Token::TokenType, Precedence> precedences = {
-  {Token::EQ, EQUALS},      {Token::NOT_EQ, EQUALS},
-  {Token::LT, LESSGREATER}, {Token::GT, LESSGREATER},
-  {Token::PLUS, SUM},       {Token::MINUS, SUM},
-  {Token::SLASH, PRODUCT},  {Token::ASTERISK, PRODUCT},
-  {Token::LPAREN, CALL},    {Token::LBRACKET, INDEX}};
+// Binding power of every token type when it shows up as an infix operator,
+// LOWEST for the ones that can't
+using PrecedenceTable = std::array<Precedence, Token::TokenTypeCount>;
+constexpr PrecedenceTable precedences = [] {
+  PrecedenceTable table{};
+  table.fill(LOWEST);
+  table[Token::EQ] = EQUALS;
+  table[Token::NOT_EQ] = EQUALS;
+  table[Token::LT] = LESSGREATER;
+  table[Token::GT] = LESSGREATER;
+  table[Token::PLUS] = SUM;
+  table[Token::MINUS] = SUM;
+  table[Token::SLASH] = PRODUCT;
+  table[Token::ASTERISK] = PRODUCT;
+  table[Token::LPAREN] = CALL;
+  table[Token::LBRACKET] = INDEX;
+  return table;
+}();
+
+// What went wrong and the token it was noticed at
+struct ParseError {
+  std::string m_message;
+  Token::Offset m_offset;
+};
 
 struct Parser {
   using prefixParseFn = std::unique_ptr<Ast::IExpression> (Parser::*)();
   using infixParseFn = std::unique_ptr<Ast::IExpression> (Parser::*)(
     std::unique_ptr<Ast::IExpression> expr);
 
-  Lexer::Lexer &m_l;
+  // where the tokens come from, pulled from m_l as they are needed or read
+  // from m_tokens by index when it was all lexed up front
+  Lexer::Lexer *m_l = nullptr;
+  const Lexer::TokenBuffer *m_tokens = nullptr;
+  Lexer::TokenBuffer::Cursor m_cursor;
   Token::Token m_curToken;
   Token::Token m_peekToken;
-  std::unordered_map<Token::TokenType, prefixParseFn> m_prefixParseFns;
-  std::unordered_map<Token::TokenType, infixParseFn> m_infixParseFns;
-  std::vector<std::string> m_errors;
-  explicit Parser(Lexer::Lexer &lexer);
+  std::vector<ParseError> m_errors;
+  // nodes go in an arena owned by the Program, off only to compare against
+  bool m_useArena;
+  explicit Parser(Lexer::Lexer &lexer, bool useArena = true);
+  explicit Parser(const Lexer::TokenBuffer &tokens, bool useArena = true);
 
   void nextToken();
   Ast::Program ParseProgram();
@@ -55,18 +78,15 @@ struct Parser {
   std::unique_ptr<Ast::BlockStatement> parseBlockStatement();
   std::unique_ptr<Ast::IExpression> parseIfExpression();
   std::unique_ptr<Ast::IExpression> parseFunctionLiteral();
-  std::vector<std::unique_ptr<Ast::Identifier>> parseFunctionParameters();
+  Ast::NodeList<Ast::Identifier> parseFunctionParameters();
   std::unique_ptr<Ast::IExpression>
   parseCallExpression(std::unique_ptr<Ast::IExpression> function);
   std::unique_ptr<Ast::IExpression> parseStringLiteral();
   std::unique_ptr<Ast::IExpression> parseArrayLiteral();
-  std::vector<std::unique_ptr<Ast::IExpression>>
-  parseExpressionList(Token::TokenType end);
+  Ast::NodeList<Ast::IExpression> parseExpressionList(Token::TokenType end);
   std::unique_ptr<Ast::IExpression>
   parseIndexExpression(std::unique_ptr<Ast::IExpression> left);
   std::unique_ptr<Ast::IExpression> ParseHashLiteral();
-  void registerPrefix(Token::TokenType tokenType, prefixParseFn fn);
-  void registerInfix(Token::TokenType, infixParseFn fn);
 
   bool curTokenIs(Token::TokenType t);
   bool peekTokenIs(Token::TokenType t);
@@ -76,6 +96,9 @@ struct Parser {
   Precedence curPrecedence();
 
   std::vector<std::string> Errors();
+  // the messages prefixed with the line and column they were found at
+  std::vector<std::string> LocatedErrors();
+  void addError(std::string message, const Token::Token &at);
   void peekError(Token::TokenType t);
   void noPrefixParseFnError(Token::TokenType t);
   void malformedFunctionParameterListError();
@@ -1,37 +1,181 @@
 #include "repl.hpp"
 #include "ast.hpp"
+#include "compiler.hpp"
 #include "evaluator.hpp"
+#include "gc.hpp"
 #include "lexer.hpp"
 #include "object.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "script.hpp"
+#include "stack_evaluator.hpp"
+#include "vm.hpp"
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
 
 namespace Repl {
-void Start() {
+
+namespace {
+
+// What has to outlive a single line, for whichever engine runs them
+class Session {
+private:
+  Engine m_engine;
+  Evaluator::Evaluator m_evaluator;
+  Evaluator::StackEvaluator m_stackEvaluator;
+  // pinned, so it stays a root of the collector for the whole session
+  std::shared_ptr<Object::Environment> m_env =
+    Gc::Pin(Object::New<Object::Environment>());
+  Compiler::State m_compilerState = Compiler::NewState();
+  Vm::Globals m_globals;
+
+public:
+  explicit Session(Engine engine) : m_engine(engine) {}
+
+  // Prints what went wrong and returns false when the vm's compiler
+  // rejects the program
+  bool Run(Ast::Program *program, Object::Value &evaluated) {
+    if (m_engine == Engine::VM) {
+      Compiler::Compiler compiler(m_compilerState);
+      if (!compiler.Compile(program)) {
+        std::cout << "Woops! Compilation failed:\n";
+        for (const auto &error : compiler.Errors()) {
+          std::cout << "\t" << error << '\n';
+        }
+        return false;
+      }
+      m_compilerState = compiler.GetState();
+      Vm::Vm machine(compiler.GetBytecode(), m_globals);
+      if (auto err = machine.Run()) {
+        evaluated = err;
+      } else {
+        evaluated = machine.LastPoppedStackElem();
+      }
+    } else if (m_engine == Engine::STACK) {
+      evaluated = m_stackEvaluator.Eval(program, m_env);
+    } else {
+      evaluated = m_evaluator.Eval(program, m_env);
+    }
+    return true;
+  }
+};
+
+// An error the evaluator placed is prefixed with its line and column in
+// the source it was placed in, which needn't be the line just read
+void printValue(const Object::Value &evaluated) {
+  if (evaluated == nullptr || evaluated.get() == nullptr) {
+    return;
+  }
+  if (evaluated.Type() == Object::ObjectType::ERROR_OBJ) {
+    const auto *err = static_cast<Object::Error *>(evaluated.get());
+    if (err->m_offset != Token::NoOffset && err->m_source != nullptr) {
+      auto position = err->m_source->Locate(err->m_offset);
+      std::cout << position.Line << ':' << position.Column << ": ";
+    }
+  }
+  std::cout << evaluated.get()->Inspect() << '\n';
+}
+
+using Clock = std::chrono::steady_clock;
+
+double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+    .count();
+}
+
+} // namespace
+
+void Start(Engine engine) {
 
   std::string scanned;
-  Evaluator::Evaluator evaluator;
-  std::shared_ptr<Object::Environment> env =
-    std::make_shared<Object::Environment>();
+  Session session(engine);
   while (true) {
     std::cout << PROMPT;
-    std::getline(std::cin, scanned);
+    if (!std::getline(std::cin, scanned)) {
+      return;
+    }
 
     Lexer::Lexer l(scanned);
     Parser::Parser p(l);
     Ast::Program program = p.ParseProgram();
     if (std::ssize(p.Errors()) != 0) {
-      printParserErrors(p.Errors());
+      printParserErrors(p.LocatedErrors());
       continue;
     }
-    auto evaluated = evaluator.Eval(&program, env);
-    if (evaluated != nullptr && evaluated.get() != nullptr) {
-      std::cout << evaluated.get()->Inspect() << '\n';
+    Optimizer::Optimizer().Optimize(&program);
+
+    Object::Value evaluated;
+    if (session.Run(&program, evaluated)) {
+      printValue(evaluated);
     }
   }
 }
 
+int RunFile(const std::string &path, Engine engine, bool timed) {
+  std::string error;
+  auto loadStart = Clock::now();
+  std::shared_ptr<Token::Source> source = Script::Load(path, error);
+  if (source == nullptr) {
+    std::cerr << error << '\n';
+    return 1;
+  }
+  double loadTime = millisSince(loadStart);
+
+  // Lexed up front, on several threads for a big script, unless it is too
+  // big for the buffer's offsets and the parser has to pull its tokens from
+  // the lexer as it goes
+  auto lexStart = Clock::now();
+  std::optional<Lexer::TokenBuffer> tokens;
+  if (source->Text.size() <= Lexer::TokenBuffer::MaxInput) {
+    tokens = Lexer::TokenBuffer::Tokenize(source);
+  }
+  double lexTime = millisSince(lexStart);
+
+  auto parseStart = Clock::now();
+  std::optional<Lexer::Lexer> lexer;
+  if (!tokens) {
+    lexer.emplace(source);
+  }
+  auto p = tokens ? Parser::Parser(*tokens) : Parser::Parser(*lexer);
+  Ast::Program program = p.ParseProgram();
+  if (std::ssize(p.Errors()) != 0) {
+    printParserErrors(p.LocatedErrors());
+    return 1;
+  }
+  Optimizer::Optimizer().Optimize(&program);
+  double parseTime = millisSince(parseStart);
+
+  auto evalStart = Clock::now();
+  Session session(engine);
+  Object::Value evaluated;
+  bool ran = session.Run(&program, evaluated);
+  double evalTime = millisSince(evalStart);
+  if (ran) {
+    printValue(evaluated);
+  }
+  bool failed = !ran || (evaluated != nullptr &&
+                         evaluated.Type() == Object::ObjectType::ERROR_OBJ);
+
+  if (timed) {
+    std::cerr << std::fixed << std::setprecision(3)
+              << "load  " << loadTime << " ms, " << source->Text.size()
+              << " bytes " << (source->Mapping ? "mapped" : "read") << '\n'
+              << "lex   " << lexTime << " ms, "
+              << (tokens ? std::to_string(tokens->Size()) + " tokens in " +
+                             std::to_string(tokens->Parts()) + " parts"
+                         : std::string("while parsing"))
+              << '\n'
+              << "parse " << parseTime << " ms, optimizing too\n"
+              << "eval  " << evalTime << " ms\n";
+  }
+  return failed ? 1 : 0;
+}
+
 void printParserErrors(const std::vector<std::string> &errors) // namespace Repl
 {
   std::cout << "Woops! We ran into some monkey business here!\n"
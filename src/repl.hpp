@@ -1,10 +1,19 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 namespace Repl {
 
+enum class Engine : std::uint8_t { EVALUATOR, VM, STACK };
+
 const std::string PROMPT = ">>";
 void printParserErrors(const std::vector<std::string> &errors);
-void Start();
+void Start(Engine engine = Engine::EVALUATOR);
+// Runs a whole script file, "-" for stdin, as one program. With timed, how
+// long loading, lexing, parsing and evaluating took goes to stderr. Returns
+// the exit status, 1 when the script doesn't parse or compile or ends in an
+// error.
+int RunFile(const std::string &path, Engine engine = Engine::EVALUATOR,
+            bool timed = false);
 
 } // namespace Repl
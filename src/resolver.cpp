@@ -0,0 +1,238 @@
+#include "resolver.hpp"
+#include "ast.hpp"
+#include "builtins.hpp"
+#include <memory>
+#include <utility>
+namespace Resolver {
+
+Resolver::Resolver(std::shared_ptr<Ast::ScopeLayout> globals)
+  : m_globals(std::move(globals)) {}
+
+void Resolver::Resolve(Ast::INode *node) {
+  if (node == nullptr) {
+    return;
+  }
+
+  switch (node->Type()) {
+  case Ast::Type::PROGRAM: {
+    auto *program = Ast::Cast<Ast::Program>(node);
+    m_scopes = {m_globals.get()};
+    for (auto &statement : program->m_statements) {
+      declareLets(statement.get(), *m_globals);
+    }
+    for (auto &statement : program->m_statements) {
+      Resolve(statement.get());
+    }
+    m_scopes.clear();
+    return;
+  }
+  case Ast::Type::EXPRESSION_STATEMENT: {
+    Resolve(Ast::Cast<Ast::ExpressionStatement>(node)->m_expression.get());
+    return;
+  }
+  case Ast::Type::BLOCK_STATEMENT: {
+    for (auto &statement :
+         Ast::Cast<Ast::BlockStatement>(node)->m_statements) {
+      Resolve(statement.get());
+    }
+    return;
+  }
+  case Ast::Type::LET_STATEMENT: {
+    auto *letStmt = Ast::Cast<Ast::LetStatement>(node);
+    Resolve(letStmt->m_expression.get());
+    if (!m_scopes.empty()) {
+      letStmt->m_name->m_depth = 0;
+      letStmt->m_name->m_slot =
+        m_scopes.back()->Declare(letStmt->m_name->m_symbol);
+    }
+    return;
+  }
+  case Ast::Type::RETURN_STATEMENT: {
+    Resolve(Ast::Cast<Ast::ReturnStatement>(node)->m_returnValue.get());
+    return;
+  }
+  case Ast::Type::IDENTIFIER: {
+    resolveIdentifier(Ast::Cast<Ast::Identifier>(node));
+    return;
+  }
+  case Ast::Type::PREFIX_EXPRESSION: {
+    Resolve(Ast::Cast<Ast::PrefixExpression>(node)->m_right.get());
+    return;
+  }
+  case Ast::Type::INFIX_EXPRESSION: {
+    auto *infixExpr = Ast::Cast<Ast::InfixExpression>(node);
+    Resolve(infixExpr->m_left.get());
+    Resolve(infixExpr->m_right.get());
+    return;
+  }
+  case Ast::Type::IF_EXPRESSION: {
+    auto *ifExpr = Ast::Cast<Ast::IfExpression>(node);
+    Resolve(ifExpr->m_condition.get());
+    Resolve(ifExpr->m_consequence.get());
+    Resolve(ifExpr->m_alternative.get());
+    return;
+  }
+  case Ast::Type::FUNCTION_LITERAL: {
+    resolveFunction(Ast::Cast<Ast::FunctionLiteral>(node));
+    return;
+  }
+  case Ast::Type::CALL_EXPRESSION: {
+    auto *callExpr = Ast::Cast<Ast::CallExpression>(node);
+    Resolve(callExpr->m_function.get());
+    for (auto &arg : callExpr->m_arguments) {
+      Resolve(arg.get());
+    }
+    return;
+  }
+  case Ast::Type::ARRAY_LITERAL: {
+    for (auto &element :
+         Ast::Cast<Ast::ArrayLiteral>(node)->m_elements) {
+      Resolve(element.get());
+    }
+    return;
+  }
+  case Ast::Type::INDEX_EXPRESSION: {
+    auto *idxExp = Ast::Cast<Ast::IndexExpression>(node);
+    Resolve(idxExp->m_left.get());
+    Resolve(idxExp->m_index.get());
+    return;
+  }
+  case Ast::Type::HASH_EXPRESSION: {
+    for (auto &[key, value] :
+         Ast::Cast<Ast::HashLiteral>(node)->m_pairs) {
+      Resolve(key.get());
+      Resolve(value.get());
+    }
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+void Resolver::resolveIdentifier(Ast::Identifier *ident) {
+  ident->m_depth = -1;
+  ident->m_slot = -1;
+  ident->m_builtin = -1;
+  for (size_t i = m_scopes.size(); i > 0; i--) {
+    int slot = m_scopes[i - 1]->Find(ident->m_symbol);
+    if (slot >= 0) {
+      ident->m_depth = static_cast<int>(m_scopes.size() - i);
+      ident->m_slot = slot;
+      return;
+    }
+  }
+  for (int i = 0; const auto &def : Builtins::builtinList) {
+    if (def.name == ident->m_symbol) {
+      ident->m_builtin = i;
+      return;
+    }
+    i++;
+  }
+}
+
+void Resolver::resolveFunction(Ast::FunctionLiteral *fun) {
+  if (!m_scopes.empty()) {
+    m_scopes.back()->m_captured = true;
+  }
+  auto layout = std::make_shared<Ast::ScopeLayout>();
+  for (auto &param : fun->m_parameters) {
+    param->m_depth = 0;
+    param->m_slot = layout->Declare(param->m_symbol);
+  }
+  if (fun->m_body != nullptr) {
+    declareLets(fun->m_body.get(), *layout);
+  }
+
+  m_scopes.push_back(layout.get());
+  Resolve(fun->m_body.get());
+  m_scopes.pop_back();
+  fun->m_layout = std::move(layout);
+}
+
+// Every let in a scope gets its slot before anything is resolved, so a
+// function can refer to names that are bound later on in its scope.
+// Nested function literals are left alone, they get a scope of their own.
+void Resolver::declareLets(Ast::INode *node, Ast::ScopeLayout &scope) {
+  if (node == nullptr) {
+    return;
+  }
+
+  switch (node->Type()) {
+  case Ast::Type::EXPRESSION_STATEMENT: {
+    declareLets(
+      Ast::Cast<Ast::ExpressionStatement>(node)->m_expression.get(),
+      scope);
+    return;
+  }
+  case Ast::Type::BLOCK_STATEMENT: {
+    for (auto &statement :
+         Ast::Cast<Ast::BlockStatement>(node)->m_statements) {
+      declareLets(statement.get(), scope);
+    }
+    return;
+  }
+  case Ast::Type::LET_STATEMENT: {
+    auto *letStmt = Ast::Cast<Ast::LetStatement>(node);
+    scope.Declare(letStmt->m_name->m_symbol);
+    declareLets(letStmt->m_expression.get(), scope);
+    return;
+  }
+  case Ast::Type::RETURN_STATEMENT: {
+    declareLets(
+      Ast::Cast<Ast::ReturnStatement>(node)->m_returnValue.get(), scope);
+    return;
+  }
+  case Ast::Type::PREFIX_EXPRESSION: {
+    declareLets(Ast::Cast<Ast::PrefixExpression>(node)->m_right.get(),
+                scope);
+    return;
+  }
+  case Ast::Type::INFIX_EXPRESSION: {
+    auto *infixExpr = Ast::Cast<Ast::InfixExpression>(node);
+    declareLets(infixExpr->m_left.get(), scope);
+    declareLets(infixExpr->m_right.get(), scope);
+    return;
+  }
+  case Ast::Type::IF_EXPRESSION: {
+    auto *ifExpr = Ast::Cast<Ast::IfExpression>(node);
+    declareLets(ifExpr->m_condition.get(), scope);
+    declareLets(ifExpr->m_consequence.get(), scope);
+    declareLets(ifExpr->m_alternative.get(), scope);
+    return;
+  }
+  case Ast::Type::CALL_EXPRESSION: {
+    auto *callExpr = Ast::Cast<Ast::CallExpression>(node);
+    declareLets(callExpr->m_function.get(), scope);
+    for (auto &arg : callExpr->m_arguments) {
+      declareLets(arg.get(), scope);
+    }
+    return;
+  }
+  case Ast::Type::ARRAY_LITERAL: {
+    for (auto &element :
+         Ast::Cast<Ast::ArrayLiteral>(node)->m_elements) {
+      declareLets(element.get(), scope);
+    }
+    return;
+  }
+  case Ast::Type::INDEX_EXPRESSION: {
+    auto *idxExp = Ast::Cast<Ast::IndexExpression>(node);
+    declareLets(idxExp->m_left.get(), scope);
+    declareLets(idxExp->m_index.get(), scope);
+    return;
+  }
+  case Ast::Type::HASH_EXPRESSION: {
+    for (auto &[key, value] :
+         Ast::Cast<Ast::HashLiteral>(node)->m_pairs) {
+      declareLets(key.get(), scope);
+      declareLets(value.get(), scope);
+    }
+    return;
+  }
+  default:
+    return;
+  }
+}
+
+} // namespace Resolver
@@ -0,0 +1,26 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <vector>
+namespace Resolver {
+
+// Annotates every Identifier with the (depth, slot) address it will have at
+// runtime, so the evaluator can index environments instead of hashing names.
+// Depth counts function scopes outwards from the one the identifier is in,
+// blocks do not open a scope of their own, the same as in the evaluator.
+class Resolver {
+public:
+  // globals is the layout of the environment the program will run in
+  explicit Resolver(std::shared_ptr<Ast::ScopeLayout> globals);
+  void Resolve(Ast::INode *node);
+
+private:
+  std::vector<Ast::ScopeLayout *> m_scopes;
+  std::shared_ptr<Ast::ScopeLayout> m_globals;
+
+  void resolveIdentifier(Ast::Identifier *ident);
+  void resolveFunction(Ast::FunctionLiteral *fun);
+  void declareLets(Ast::INode *node, Ast::ScopeLayout &scope);
+};
+
+} // namespace Resolver
@@ -0,0 +1,77 @@
+#include "script.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Script {
+
+namespace {
+
+constexpr std::size_t BLOCK = std::size_t{64} * 1024;
+
+// Maps the whole of a regular file, false when it can't be
+bool mapFile(int fd, std::size_t size, Token::Source &source) {
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  // the lexer reads front to back once
+  madvise(data, size, MADV_SEQUENTIAL);
+  source.Mapping = std::shared_ptr<const void>(
+    data, [size](const void *ptr) { munmap(const_cast<void *>(ptr), size); });
+  source.Text = {static_cast<const char *>(data), size};
+  return true;
+}
+
+bool readAll(int fd, Token::Source &source) {
+  std::size_t used = 0;
+  while (true) {
+    source.Owned.resize(used + BLOCK);
+    ssize_t got = read(fd, source.Owned.data() + used, BLOCK);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      source.Owned.resize(used);
+      source.Text = source.Owned;
+      return got == 0;
+    }
+    used += static_cast<std::size_t>(got);
+  }
+}
+
+} // namespace
+
+std::shared_ptr<Token::Source> Load(const std::string &path,
+                                    std::string &error) {
+  bool isStdin = path == "-";
+  int fd = isStdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error = path + ": " + std::strerror(errno);
+    return nullptr;
+  }
+  auto source = std::make_shared<Token::Source>();
+  struct stat info{};
+  bool ok = fstat(fd, &info) == 0;
+  if (ok) {
+    auto size = static_cast<std::size_t>(info.st_size);
+    // an empty file can't be mapped and there is nothing to read
+    if (!S_ISREG(info.st_mode) || size == 0 || !mapFile(fd, size, *source)) {
+      ok = readAll(fd, *source);
+    }
+  }
+  if (!ok) {
+    error = path + ": " + std::strerror(errno);
+  }
+  // the mapping stays valid once the file is closed
+  if (!isStdin) {
+    close(fd);
+  }
+  return ok ? source : nullptr;
+}
+
+} // namespace Script
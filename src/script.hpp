@@ -0,0 +1,14 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <token.hpp>
+namespace Script {
+
+// Reads a script for the lexer to work on in place. A regular file is mapped
+// read-only and never copied. Anything that can't be mapped, a pipe or "-"
+// for stdin, is read in blocks into the Source. On failure returns nullptr
+// and says why in error.
+std::shared_ptr<Token::Source> Load(const std::string &path,
+                                    std::string &error);
+
+} // namespace Script
@@ -0,0 +1,384 @@
+#include "stack_evaluator.hpp"
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "object.hpp"
+#include "resolver.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <format>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+namespace Evaluator {
+
+StackEvaluator::StackEvaluator(std::size_t maxDepth) : m_maxDepth(maxDepth) {}
+
+void StackEvaluator::TraceRoots(Gc::Heap &heap) const {
+  for (const auto &value : m_values) {
+    value.Trace(heap);
+  }
+  for (const auto &frame : m_frames) {
+    heap.Mark(frame.m_env);
+  }
+}
+
+Object::Value
+StackEvaluator::Eval(Ast::INode *node,
+                     const std::shared_ptr<Object::Environment> &env) {
+  return Eval(node, env.get());
+}
+
+Object::Value StackEvaluator::Eval(Ast::INode *node,
+                                   Object::Environment *env) {
+  if (node == nullptr) {
+    return nullptr;
+  }
+  if (node->Type() == Ast::Type::PROGRAM) {
+    Resolver::Resolver(env->Layout()).Resolve(node);
+  }
+  auto err = push(node, env);
+  while (err == nullptr && !m_frames.empty()) {
+    err = step();
+  }
+  if (Evaluator::isError(err)) {
+    locate(err);
+  }
+  // an error ends the whole evaluation, nothing is left to unwind to
+  Object::Value result = err != nullptr ? err : m_values.back();
+  m_frames.clear();
+  m_values.clear();
+  return result;
+}
+
+Object::Value StackEvaluator::push(Ast::INode *node,
+                                   Object::Environment *env) {
+  if (node == nullptr) {
+    m_values.emplace_back();
+    return nullptr;
+  }
+  if (m_frames.size() >= m_maxDepth) {
+    return Evaluator::newError("stack depth exceeded");
+  }
+  m_frames.push_back(
+    {.m_node = node, .m_env = env, .m_step = 0, .m_base = m_values.size()});
+  return nullptr;
+}
+
+void StackEvaluator::replace(Ast::INode *node) {
+  if (node == nullptr) {
+    complete(nullptr);
+    return;
+  }
+  auto &frame = m_frames.back();
+  m_values.resize(frame.m_base);
+  frame.m_node = node;
+  frame.m_step = 0;
+}
+
+Object::Value StackEvaluator::complete(Object::Value value) {
+  if (Evaluator::isError(value)) {
+    return value;
+  }
+  m_values.resize(m_frames.back().m_base);
+  m_frames.pop_back();
+  if (value == nullptr && !m_frames.empty() &&
+      m_frames.back().m_node->Type() != Ast::Type::PROGRAM) {
+    value = NULL_O;
+  }
+  m_values.push_back(std::move(value));
+  return nullptr;
+}
+
+Object::Value StackEvaluator::step() {
+  auto &frame = m_frames.back();
+  auto *node = frame.m_node;
+  auto *env = frame.m_env;
+  auto step = frame.m_step;
+  // evaluates the frame's children one after the other
+  auto next = [this, env](Ast::INode *child) {
+    m_frames.back().m_step++;
+    return push(child, env);
+  };
+
+  switch (node->Type()) {
+  case Ast::Type::PROGRAM:
+    return stepProgram(Ast::Cast<Ast::Program>(node));
+  case Ast::Type::IDENTIFIER:
+    return complete(identifier(Ast::Cast<Ast::Identifier>(node), env));
+  case Ast::Type::INTEGER_LITERAL:
+    return complete(
+      Object::Value::Int(Ast::Cast<Ast::IntegerLiteral>(node)->m_value));
+  case Ast::Type::BOOLEAN:
+    return complete(
+      Object::Value::Bool(Ast::Cast<Ast::Boolean>(node)->m_value));
+  case Ast::Type::STRING_LITERAL:
+    return complete(Object::New<Object::String>(
+      Ast::Cast<Ast::StringLiteral>(node)->m_value));
+  case Ast::Type::PREFIX_EXPRESSION: {
+    auto *prefixExpr = Ast::Cast<Ast::PrefixExpression>(node);
+    if (step == 0) {
+      return next(prefixExpr->m_right.get());
+    }
+    return complete(Evaluator::evalPrefixExpression(prefixExpr->m_operator,
+                                                    operand(0)));
+  }
+  case Ast::Type::INFIX_EXPRESSION: {
+    auto *infixExpr = Ast::Cast<Ast::InfixExpression>(node);
+    if (step == 0) {
+      return next(infixExpr->m_left.get());
+    }
+    if (step == 1) {
+      return next(infixExpr->m_right.get());
+    }
+    return complete(Evaluator::evalInfixExpression(
+      infixExpr->m_operator, operand(0), operand(1)));
+  }
+  case Ast::Type::BLOCK_STATEMENT:
+    return stepBlock(Ast::Cast<Ast::BlockStatement>(node));
+  case Ast::Type::IF_EXPRESSION: {
+    auto *ifExpr = Ast::Cast<Ast::IfExpression>(node);
+    if (step == 0) {
+      return next(ifExpr->m_condition.get());
+    }
+    // the branch taken is the if's value, it is evaluated in its place
+    if (Evaluator::isTruthy(operand(0).get())) {
+      replace(ifExpr->m_consequence.get());
+    } else if (ifExpr->m_alternative != nullptr) {
+      replace(ifExpr->m_alternative.get());
+    } else {
+      return complete(NULL_O);
+    }
+    return nullptr;
+  }
+  case Ast::Type::LET_STATEMENT: {
+    auto *letStmt = Ast::Cast<Ast::LetStatement>(node);
+    if (step == 0) {
+      return next(letStmt->m_expression.get());
+    }
+    if (letStmt->m_name->m_slot >= 0) {
+      env->SetAt(letStmt->m_name->m_slot, operand(0));
+    } else {
+      env->Set(letStmt->m_name->m_symbol, operand(0));
+    }
+    return complete(nullptr);
+  }
+  case Ast::Type::RETURN_STATEMENT:
+    return stepReturn(Ast::Cast<Ast::ReturnStatement>(node));
+  case Ast::Type::EXPRESSION_STATEMENT:
+    replace(Ast::Cast<Ast::ExpressionStatement>(node)->m_expression.get());
+    return nullptr;
+  case Ast::Type::FUNCTION_LITERAL: {
+    auto *fun = Ast::Cast<Ast::FunctionLiteral>(node);
+    return complete(Object::New<Object::Function>(prototype(fun), env));
+  }
+  case Ast::Type::CALL_EXPRESSION:
+    return stepCall(Ast::Cast<Ast::CallExpression>(node));
+  case Ast::Type::ARRAY_LITERAL: {
+    auto *arrLit = Ast::Cast<Ast::ArrayLiteral>(node);
+    if (step < arrLit->m_elements.size()) {
+      return next(arrLit->m_elements[step].get());
+    }
+    std::vector<Object::Value> elements(
+      m_values.begin() + static_cast<std::ptrdiff_t>(frame.m_base),
+      m_values.end());
+    return complete(Object::New<Object::Array>(elements));
+  }
+  case Ast::Type::INDEX_EXPRESSION: {
+    auto *idxExp = Ast::Cast<Ast::IndexExpression>(node);
+    if (step == 0) {
+      return next(idxExp->m_left.get());
+    }
+    if (step == 1) {
+      return next(idxExp->m_index.get());
+    }
+    return complete(Evaluator::evalIndexExpression(operand(0), operand(1)));
+  }
+  case Ast::Type::HASH_EXPRESSION:
+    return stepHash(Ast::Cast<Ast::HashLiteral>(node));
+  default:
+    return Evaluator::newError("unknown node");
+  }
+}
+
+// The frames the error ended are all still there, the top one is the node
+// it came out of. A statement's frame goes on to evaluate its expression,
+// so unlike in the evaluator that's the expression.
+void StackEvaluator::locate(const Object::Value &err) const {
+  if (!m_frames.empty()) {
+    Evaluator::locate(err, m_frames.back().m_node);
+  }
+}
+
+// Keeps only the result of the statement that finished last
+Object::Value StackEvaluator::stepProgram(Ast::Program *program) {
+  auto &frame = m_frames.back();
+  auto &statements = program->m_statements;
+  if (frame.m_step == Returning || frame.m_step == statements.size()) {
+    return complete(statements.empty() ? nullptr : m_values.back());
+  }
+  m_values.resize(frame.m_base);
+  // nothing is held between statements but the environment
+  Gc::Heap::Current().Safepoint();
+  auto index = frame.m_step++;
+  return push(statements[index].get(), frame.m_env);
+}
+
+Object::Value StackEvaluator::stepBlock(Ast::BlockStatement *block) {
+  auto &frame = m_frames.back();
+  auto &statements = block->m_statements;
+  if (statements.empty()) {
+    return complete(nullptr);
+  }
+  m_values.resize(frame.m_base);
+  if (frame.m_step == statements.size() - 1) {
+    // the last statement's value is the block's
+    replace(statements.back().get());
+    return nullptr;
+  }
+  auto index = frame.m_step++;
+  return push(statements[index].get(), frame.m_env);
+}
+
+// Whatever the return is nested in is dropped first, up to the call it
+// returns from or the program. The value is then evaluated right on top of
+// that frame, which makes a call in it a tail call.
+Object::Value StackEvaluator::stepReturn(Ast::ReturnStatement *returnStmt) {
+  auto *env = m_frames.back().m_env;
+  auto base = m_frames.back().m_base;
+  m_frames.pop_back();
+  while (!m_frames.empty()) {
+    auto &frame = m_frames.back();
+    if (frame.m_step == Running) {
+      break;
+    }
+    if (frame.m_node->Type() == Ast::Type::PROGRAM) {
+      frame.m_step = Returning;
+      break;
+    }
+    base = frame.m_base;
+    m_frames.pop_back();
+  }
+  m_values.resize(base);
+  return push(returnStmt->m_returnValue.get(), env);
+}
+
+Object::Value StackEvaluator::stepCall(Ast::CallExpression *callExpr) {
+  auto &frame = m_frames.back();
+  auto argc = callExpr->m_arguments.size();
+  if (frame.m_step == Running) {
+    return complete(m_values.back());
+  }
+  if (frame.m_step == 0) {
+    frame.m_step++;
+    return push(callExpr->m_function.get(), frame.m_env);
+  }
+  if (frame.m_step <= argc) {
+    auto index = frame.m_step++ - 1;
+    return push(callExpr->m_arguments[index].get(), frame.m_env);
+  }
+  return applyFunction(argc);
+}
+
+std::shared_ptr<const Object::FunctionPrototype>
+StackEvaluator::prototype(const Ast::FunctionLiteral *fun) {
+  auto [entry, inserted] = m_prototypes.try_emplace(fun);
+  auto shared = entry->second.lock();
+  if (shared == nullptr) {
+    shared = std::make_shared<const Object::FunctionPrototype>(fun);
+    entry->second = shared;
+  }
+  if (inserted && m_prototypes.size() >= m_sweepPrototypesAt) {
+    std::erase_if(m_prototypes,
+                  [](const auto &cached) { return cached.second.expired(); });
+    m_sweepPrototypesAt =
+      std::max(MinPrototypeSweep, 2 * m_prototypes.size());
+  }
+  return shared;
+}
+
+// The callee and its arguments are the operands of the call frame on top
+Object::Value StackEvaluator::applyFunction(std::size_t argc) {
+  auto fn = operand(0);
+  auto args = std::span<const Object::Value>(m_values).subspan(
+    m_frames.back().m_base + 1, argc);
+  switch (fn->Type()) {
+  case Object::ObjectType::FUNCTION_OBJ: {
+    auto *function = static_cast<Object::Function *>(fn.get());
+    if (argc != function->Parameters().size()) {
+      return Evaluator::newError(
+        std::format("wrong number of arguments: want={}, got={}",
+                    function->Parameters().size(), argc));
+    }
+    // fn and args are on the operand stack
+    Gc::Heap::Current().Safepoint();
+    auto *env = Object::New<Object::Environment>(function->m_env,
+                                                 function->Layout());
+    for (std::size_t i = 0; i < argc; i++) {
+      // the resolver puts the parameters in the first slots of the layout
+      if (function->Layout() != nullptr) {
+        env->SetAt(static_cast<int>(i), args[i]);
+      } else {
+        env->Set(function->Parameters()[i], args[i]);
+      }
+    }
+
+    // a call the body of the one below ends in takes that one's place
+    if (m_frames.size() >= 2 && m_frames[m_frames.size() - 2].m_step == Running) {
+      auto callerBase = m_frames[m_frames.size() - 2].m_base;
+      m_values.erase(
+        m_values.begin() + static_cast<std::ptrdiff_t>(callerBase),
+        m_values.begin() + static_cast<std::ptrdiff_t>(m_frames.back().m_base));
+      m_frames.erase(m_frames.end() - 2);
+      m_frames.back().m_base = callerBase;
+    }
+    m_frames.back().m_step = Running;
+    return push(function->Body(), env);
+  }
+  case Object::ObjectType::BUILTIN_OBJ: {
+    auto result = static_cast<Object::Builtin *>(fn.get())->m_fn(args);
+    return complete(std::move(result));
+  }
+  default:
+    return Evaluator::newError(
+      std::format("not a function: {}", Object::objectTypeToStr(fn->Type())));
+  }
+}
+
+// Keys and values are evaluated in turn, a key is checked before its value
+// is evaluated
+Object::Value StackEvaluator::stepHash(Ast::HashLiteral *hashLit) {
+  auto &frame = m_frames.back();
+  auto &pairs = hashLit->m_pairs;
+  if (frame.m_step % 2 == 1 && !Object::HashKeyOf(m_values.back())) {
+    return Evaluator::newError(
+      "unusable as hash key: " +
+      Object::objectTypeToStr(m_values.back()->Type()));
+  }
+  if (frame.m_step < 2 * pairs.size()) {
+    const auto &[key, value] = pairs[frame.m_step / 2];
+    auto *child = frame.m_step % 2 == 0 ? key.get() : value.get();
+    frame.m_step++;
+    return push(child, frame.m_env);
+  }
+  auto *hash = Object::New<Object::Hash>(pairs.size());
+  for (std::size_t i = 0; i < pairs.size(); i++) {
+    const auto &key = operand(2 * i);
+    hash->Set(*Object::HashKeyOf(key), key, operand(2 * i + 1));
+  }
+  return complete(hash);
+}
+
+Object::Value StackEvaluator::identifier(Ast::Identifier *ident,
+                                         Object::Environment *env) {
+  if (ident->m_depth >= 0) {
+    const auto &obj = env->GetAt(ident->m_depth, ident->m_slot);
+    if (obj != nullptr) {
+      return obj;
+    }
+  }
+  // builtins included, a let run since resolving can shadow them
+  return Evaluator::lookupIdentifier(ident, env);
+}
+
+} // namespace Evaluator
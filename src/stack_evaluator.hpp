@@ -0,0 +1,94 @@
+#pragma once
+#include "ast.hpp"
+#include "gc.hpp"
+#include "object.hpp"
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+namespace Evaluator {
+
+// Evaluates the AST with an explicit stack of frames instead of native
+// recursion, for scripts that can't be trusted not to recurse too deep.
+// Every node being evaluated has a frame saying how far along it is, and
+// the values its finished children produced sit on an operand stack. Once
+// there are maxDepth frames the evaluation stops with a "stack depth
+// exceeded" error rather than running the host out of stack.
+//
+// A call whose frame would sit right on the frame of the call it ends
+// replaces it, so tail recursion doesn't count against the depth.
+//
+// The operand stack and the environments of the frames are the roots, the
+// heap only collects when a function is applied or between top level
+// statements.
+class StackEvaluator : public Gc::RootSource {
+public:
+  static constexpr std::size_t DefaultMaxDepth = 1'000'000;
+
+  explicit StackEvaluator(std::size_t maxDepth = DefaultMaxDepth);
+
+  // env is pinned by the caller, typically the repl's global environment
+  Object::Value
+  Eval(Ast::INode *node, const std::shared_ptr<Object::Environment> &env);
+  Object::Value Eval(Ast::INode *node, Object::Environment *env);
+
+  void TraceRoots(Gc::Heap &heap) const override;
+  // entries in the prototype cache, live or not yet swept
+  [[nodiscard]] std::size_t CachedPrototypes() const {
+    return m_prototypes.size();
+  }
+
+private:
+  struct Frame {
+    Ast::INode *m_node;
+    Object::Environment *m_env;
+    // children evaluated so far, or one of the steps below
+    std::size_t m_step;
+    // height of the operand stack when the frame was pushed
+    std::size_t m_base;
+  };
+  // a call frame whose function body is running
+  static constexpr std::size_t Running = static_cast<std::size_t>(-1);
+  // a program frame whose return value is being evaluated
+  static constexpr std::size_t Returning = static_cast<std::size_t>(-2);
+
+  std::size_t m_maxDepth;
+  std::vector<Frame> m_frames;
+  std::vector<Object::Value> m_values;
+  // One prototype per literal for as long as a function made from it is
+  // alive. An expired entry's literal may be gone, its address reused.
+  // Expired entries are swept whenever the cache has doubled since the
+  // last sweep, so it stays in proportion to the prototypes still alive.
+  std::unordered_map<const Ast::FunctionLiteral *,
+                     std::weak_ptr<const Object::FunctionPrototype>>
+    m_prototypes;
+  static constexpr std::size_t MinPrototypeSweep = 64;
+  std::size_t m_sweepPrototypesAt = MinPrototypeSweep;
+
+  std::shared_ptr<const Object::FunctionPrototype>
+  prototype(const Ast::FunctionLiteral *fun);
+  // nullptr when the frame was pushed, else the error to stop with
+  Object::Value push(Ast::INode *node, Object::Environment *env);
+  // evaluates the top frame's node in its place
+  void replace(Ast::INode *node);
+  // pops the top frame leaving value as its result. Nothing (an empty body,
+  // a let) becomes null unless the program itself is what takes it.
+  Object::Value complete(Object::Value value);
+  // advances the top frame by one step, returns an error to stop with
+  Object::Value step();
+  void locate(const Object::Value &err) const;
+
+  Object::Value stepProgram(Ast::Program *program);
+  Object::Value stepBlock(Ast::BlockStatement *block);
+  Object::Value stepReturn(Ast::ReturnStatement *returnStmt);
+  Object::Value stepCall(Ast::CallExpression *callExpr);
+  Object::Value stepHash(Ast::HashLiteral *hashLit);
+  Object::Value applyFunction(std::size_t argc);
+
+  Object::Value identifier(Ast::Identifier *ident, Object::Environment *env);
+  Object::Value &operand(std::size_t index) {
+    return m_values[m_frames.back().m_base + index];
+  }
+};
+
+} // namespace Evaluator
@@ -0,0 +1,74 @@
+#include "symbol_table.hpp"
+#include <utility>
+namespace Compiler {
+
+SymbolTable::SymbolTable(std::shared_ptr<SymbolTable> outer)
+  : m_outer(std::move(outer)) {}
+
+Symbol SymbolTable::Define(Symbols::Symbol name) {
+  Symbol symbol{.name = name,
+                .scope = m_outer == nullptr ? SymbolScope::GLOBAL
+                                            : SymbolScope::LOCAL,
+                .index = m_numDefinitions};
+  // redefining a name in the same scope reuses its slot
+  if (auto search = m_store.find(name);
+      search != m_store.end() && search->second.scope == symbol.scope) {
+    return search->second;
+  }
+  m_store[name] = symbol;
+  m_numDefinitions++;
+  return symbol;
+}
+
+Symbol SymbolTable::DefineGlobal(Symbols::Symbol name) {
+  if (m_outer != nullptr) {
+    return m_outer->DefineGlobal(name);
+  }
+  return Define(name);
+}
+
+Symbol SymbolTable::DefineFunctionName(Symbols::Symbol name) {
+  Symbol symbol{.name = name, .scope = SymbolScope::FUNCTION, .index = 0};
+  m_store[name] = symbol;
+  return symbol;
+}
+
+Symbol SymbolTable::defineFree(const Symbol &original) {
+  m_freeSymbols.push_back(original);
+  Symbol symbol{.name = original.name,
+                .scope = SymbolScope::FREE,
+                .index = static_cast<int>(m_freeSymbols.size()) - 1};
+  m_store[original.name] = symbol;
+  return symbol;
+}
+
+SymbolTable::ResolveResult SymbolTable::Resolve(Symbols::Symbol name) {
+  if (auto search = m_store.find(name); search != m_store.end()) {
+    return {.symbol = search->second, .ok = true};
+  }
+  if (m_outer == nullptr) {
+    return {.symbol = {}, .ok = false};
+  }
+
+  auto outer = m_outer->Resolve(name);
+  if (!outer.ok) {
+    return outer;
+  }
+  if (outer.symbol.scope == SymbolScope::GLOBAL) {
+    return outer;
+  }
+  return {.symbol = defineFree(outer.symbol), .ok = true};
+}
+
+std::vector<std::string> SymbolTable::DefinedNames() const {
+  std::vector<std::string> names(static_cast<size_t>(m_numDefinitions));
+  for (const auto &[name, symbol] : m_store) {
+    if (symbol.scope == SymbolScope::GLOBAL ||
+        symbol.scope == SymbolScope::LOCAL) {
+      names[static_cast<size_t>(symbol.index)] = Symbols::Name(name);
+    }
+  }
+  return names;
+}
+
+} // namespace Compiler
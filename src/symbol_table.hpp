@@ -0,0 +1,50 @@
+#pragma once
+#include "symbols.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+namespace Compiler {
+
+enum class SymbolScope : std::uint8_t {
+  GLOBAL,
+  LOCAL,
+  FREE,
+  FUNCTION
+};
+
+struct Symbol {
+  Symbols::Symbol name;
+  SymbolScope scope;
+  int index;
+};
+
+class SymbolTable {
+public:
+  struct ResolveResult {
+    Symbol symbol;
+    bool ok;
+  };
+
+  SymbolTable() = default;
+  explicit SymbolTable(std::shared_ptr<SymbolTable> outer);
+
+  Symbol Define(Symbols::Symbol name);
+  // In the outermost table, for a name nothing encloses. Until a let binds
+  // it the slot is empty and the vm falls back to a builtin of that name.
+  Symbol DefineGlobal(Symbols::Symbol name);
+  Symbol DefineFunctionName(Symbols::Symbol name);
+  ResolveResult Resolve(Symbols::Symbol name);
+  // Names of the globals or locals defined in this table, indexed by slot
+  std::vector<std::string> DefinedNames() const;
+
+  std::shared_ptr<SymbolTable> m_outer;
+  std::vector<Symbol> m_freeSymbols;
+  int m_numDefinitions = 0;
+
+private:
+  Symbol defineFree(const Symbol &original);
+  std::unordered_map<Symbols::Symbol, Symbol> m_store;
+};
+
+} // namespace Compiler
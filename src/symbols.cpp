@@ -0,0 +1,60 @@
+#include "symbols.hpp"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Symbols {
+
+namespace {
+
+// Names live in a deque so the views keyed on them stay put as it grows
+struct Table {
+  std::shared_mutex m_mutex;
+  std::deque<std::string> m_names;
+  std::unordered_map<std::string_view, Symbol> m_ids;
+};
+
+Table &table() {
+  static Table table;
+  return table;
+}
+
+} // namespace
+
+Symbol Intern(std::string_view name) {
+  // each thread remembers what it has seen, the lexer threads of a
+  // TokenBuffer only take the lock for names new to them
+  thread_local std::unordered_map<std::string_view, Symbol> seen;
+  if (auto search = seen.find(name); search != seen.end()) {
+    return search->second;
+  }
+  auto &interned = table();
+  std::unordered_map<std::string_view, Symbol>::const_iterator found;
+  {
+    std::shared_lock lock(interned.m_mutex);
+    found = interned.m_ids.find(name);
+    if (found != interned.m_ids.end()) {
+      seen.emplace(found->first, found->second);
+      return found->second;
+    }
+  }
+  std::unique_lock lock(interned.m_mutex);
+  found = interned.m_ids.find(name);
+  if (found == interned.m_ids.end()) {
+    auto symbol = Symbol{static_cast<std::uint32_t>(interned.m_names.size())};
+    const auto &stored = interned.m_names.emplace_back(name);
+    found = interned.m_ids.emplace(stored, symbol).first;
+  }
+  seen.emplace(found->first, found->second);
+  return found->second;
+}
+
+std::string_view Name(Symbol symbol) {
+  auto &interned = table();
+  std::shared_lock lock(interned.m_mutex);
+  return interned.m_names[static_cast<std::size_t>(symbol)];
+}
+
+} // namespace Symbols
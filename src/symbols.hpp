@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <string_view>
+namespace Symbols {
+
+// An identifier's text interned once, when it is lexed. Equal names get
+// the same id for the life of the process, whichever thread lexed them, so
+// names are compared and hashed as integers from then on.
+enum class Symbol : std::uint32_t {};
+
+// what a token that isn't an IDENT has
+constexpr Symbol NoSymbol{std::numeric_limits<std::uint32_t>::max()};
+
+// Safe to call from any thread. Names are never given back.
+Symbol Intern(std::string_view name);
+// the text symbol was interned from, valid for the life of the process
+std::string_view Name(Symbol symbol);
+
+} // namespace Symbols
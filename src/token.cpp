@@ -1,11 +1,21 @@
 #include "token.hpp"
+#include <algorithm>
+#include <string_view>
 namespace Token {
 
-TokenType LookupIdent(const std::string &ident) {
-  if (auto search = keywords.find(ident); search != keywords.end()) {
-    return search->second;
-  }
-  return TokenType::IDENT;
+Position Source::Locate(Offset offset) const {
+  std::call_once(m_linesFound, [this] {
+    m_lineStarts.push_back(0);
+    for (auto pos = Text.find('\n'); pos != std::string_view::npos;
+         pos = Text.find('\n', pos + 1)) {
+      m_lineStarts.push_back(static_cast<Offset>(pos + 1));
+    }
+  });
+  auto line = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(),
+                               offset) -
+              1;
+  return {.Line = static_cast<std::uint32_t>(line - m_lineStarts.begin() + 1),
+          .Column = offset - *line + 1};
 }
 
 std::unordered_map<std::string, TokenType> vecToTokenMap() {
@@ -1,5 +1,14 @@
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <symbols.hpp>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 namespace Token {
@@ -40,9 +49,56 @@ enum TokenType {
   COLON,
 };
 
+// for tables indexed by TokenType, COLON has to stay the last type
+constexpr std::size_t TokenTypeCount = COLON + 1;
+
+// Where a token starts, in bytes into its Source's Text. Line and column
+// are only worked out from it when something is reported.
+using Offset = std::uint32_t;
+// unknown, or past the 4 GiB an Offset reaches
+constexpr Offset NoOffset = std::numeric_limits<Offset>::max();
+
+// 1 based, the column in bytes
+struct Position {
+  std::uint32_t Line;
+  std::uint32_t Column;
+};
+
+// Tokens don't own their text, Literal points into the Source the lexer
+// read it from
 struct Token {
   TokenType Type;
-  std::string Literal;
+  Offset Start = 0;
+  std::string_view Literal;
+  // the value of an INT token, -1 when the digits don't fit in a long
+  long int Int = 0;
+  // the interned Literal of an IDENT token
+  Symbols::Symbol Name = Symbols::NoSymbol;
+};
+
+// The text a lexer works on. Whoever keeps tokens after the lexer is gone
+// (the Program and its arena) holds on to this. Text is either Owned or a
+// file mapped into memory that Mapping keeps mapped, so a Source is only
+// ever passed around behind a pointer. Strings with escapes are the only
+// literals that aren't a slice of Text, their processed form is kept in
+// Decoded.
+struct Source {
+  std::string_view Text;
+  std::string Owned;
+  std::shared_ptr<const void> Mapping;
+  std::deque<std::string> Decoded;
+
+  Source() = default;
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+
+  // Where offset is in Text. The first call finds where every line
+  // starts, later ones binary search that.
+  [[nodiscard]] Position Locate(Offset offset) const;
+
+private:
+  mutable std::once_flag m_linesFound;
+  mutable std::vector<Offset> m_lineStarts;
 };
 
 struct StringTok {
@@ -98,10 +154,51 @@ const std::unordered_map<std::string, TokenType> tokenMap = vecToTokenMap();
 const std::unordered_map<TokenType, std::string> tokenStringMap =
   vecToTokenStringMap();
 
-const std::unordered_map<std::string, TokenType> keywords = {
-  {"fn", FUNCTION}, {"let", LET},   {"true", TRUE},    {"false", FALSE},
-  {"if", IF},       {"else", ELSE}, {"return", RETURN}};
+struct Keyword {
+  std::string_view Str;
+  TokenType Type;
+};
+
+constexpr std::array<Keyword, 7> keywords = {{{"fn", FUNCTION},
+                                              {"let", LET},
+                                              {"true", TRUE},
+                                              {"false", FALSE},
+                                              {"if", IF},
+                                              {"else", ELSE},
+                                              {"return", RETURN}}};
+
+// Perfect hash of the keywords, each lands in a slot of its own in
+// keywordTable. Any other identifier needs one comparison to rule out.
+constexpr std::size_t KeywordHash(std::string_view ident) {
+  return (2 * std::size_t{static_cast<unsigned char>(ident.front())} +
+          std::size_t{static_cast<unsigned char>(ident.back())} +
+          ident.size()) &
+         7;
+}
+
+constexpr std::array<Keyword, 8> keywordTable = [] {
+  std::array<Keyword, 8> table{};
+  for (const auto &keyword : keywords) {
+    table[KeywordHash(keyword.Str)] = keyword;
+  }
+  return table;
+}();
+
+static_assert(
+  [] {
+    for (const auto &keyword : keywords) {
+      if (keywordTable[KeywordHash(keyword.Str)].Str != keyword.Str) {
+        return false;
+      }
+    }
+    return true;
+  }(),
+  "two keywords hash to the same slot, change KeywordHash");
 
-TokenType LookupIdent(const std::string &ident);
+// ident is not empty
+constexpr TokenType LookupIdent(std::string_view ident) {
+  const auto &slot = keywordTable[KeywordHash(ident)];
+  return slot.Str == ident ? slot.Type : IDENT;
+}
 
 } // namespace Token
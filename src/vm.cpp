@@ -0,0 +1,511 @@
+#include "vm.hpp"
+#include "builtins.hpp"
+#include "code.hpp"
+#include "evaluator.hpp"
+#include "object.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <format>
+#include <memory>
+#include <span>
+#include <utility>
+namespace Vm {
+
+static std::shared_ptr<Object::Error> asError(const Object::Value &obj) {
+  if (obj != nullptr && obj->Type() == Object::ObjectType::ERROR_OBJ) {
+    return std::static_pointer_cast<Object::Error>(obj.Shared());
+  }
+  return nullptr;
+}
+
+static std::shared_ptr<Object::Error> stackOverflow() {
+  return Evaluator::Evaluator::newError("stack overflow");
+}
+
+Vm::Vm(const Compiler::Bytecode &bytecode, size_t maxFrames)
+  : Vm(bytecode, m_ownGlobals, maxFrames) {}
+
+Vm::Vm(const Compiler::Bytecode &bytecode, Globals &globals, size_t maxFrames)
+  : m_constants(bytecode.constants), m_globalNames(bytecode.globalNames),
+    m_globals(globals), m_heap(Gc::Heap::Current()),
+    m_stack(InitialStackSize), m_maxFrames(maxFrames) {
+  // the program ends on a return like a function does, so Run never has to
+  // check for running off the end of the instructions
+  auto instructions = bytecode.instructions;
+  instructions.push_back(Code::OpReturn);
+  auto mainFn =
+    std::make_shared<Object::CompiledFunction>(std::move(instructions), 0, 0);
+  auto *mainClosure =
+    Object::New<Object::Closure>(mainFn, std::vector<Object::Value>{});
+  m_frames.push_back({.cl = mainClosure, .ip = 0, .basePointer = 0});
+}
+
+Object::Value Vm::LastPoppedStackElem() {
+  return m_lastPopped;
+}
+
+void Vm::TraceRoots(Gc::Heap &heap) const {
+  for (size_t i = 0; i < m_sp; i++) {
+    m_stack[i].Trace(heap);
+  }
+  m_lastPopped.Trace(heap);
+  for (const auto &value : m_globals) {
+    value.Trace(heap);
+  }
+  for (const auto &constant : m_constants) {
+    constant.Trace(heap);
+  }
+  for (const auto &frame : m_frames) {
+    heap.Mark(frame.cl);
+  }
+}
+
+// A global read before any let bound it is the builtin of the same name,
+// which is kept in the slot from then on. A let that comes later overwrites
+// it, the same as it shadows the builtin in the evaluator.
+std::shared_ptr<Object::Error> Vm::bindBuiltin(size_t globalIndex) {
+  std::string name = globalIndex < m_globalNames.size()
+                       ? m_globalNames[globalIndex]
+                       : std::to_string(globalIndex);
+  for (const auto &def : Builtins::builtinList) {
+    if (Symbols::Name(def.name) == name) {
+      if (globalIndex >= m_globals.size()) {
+        m_globals.resize(globalIndex + 1);
+      }
+      m_globals[globalIndex] = def.builtin;
+      return nullptr;
+    }
+  }
+  return Evaluator::Evaluator::newError(
+    std::format("identifier not found: {}", name));
+}
+
+void Vm::push(Object::Value obj) {
+  pushSlot() = std::move(obj);
+}
+
+void Vm::reserveStack(size_t size) {
+  if (size > m_stack.size()) {
+    m_stack.resize(std::max(size, 2 * m_stack.size()));
+  }
+}
+
+// Null and false are the only values that aren't truthy, and the only null
+// and booleans there are the evaluator's
+static bool isTruthy(const Object::Value &value) {
+  if (value.IsInteger()) {
+    return true;
+  }
+  const auto *obj = value.get();
+  return obj != Evaluator::FALSE.get() && obj != Evaluator::NULL_O.get();
+}
+
+std::shared_ptr<Object::Error> Vm::Run() {
+  m_lastPopped = nullptr;
+  // The frame on top runs out of these, they are written back to it before
+  // a call and read again after anything that changes the frames
+  Object::Closure *cl = nullptr;
+  const std::uint8_t *ins = nullptr;
+  size_t ip = 0;
+  size_t bp = 0;
+  auto enterFrame = [&] {
+    const Frame &frame = m_frames.back();
+    cl = frame.cl;
+    ins = cl->m_fn->m_instructions.data();
+    ip = frame.ip;
+    bp = frame.basePointer;
+  };
+  auto readUint16 = [&] {
+    auto operand = static_cast<size_t>((ins[ip] << 8) | ins[ip + 1]);
+    ip += 2;
+    return operand;
+  };
+  auto readUint8 = [&] { return static_cast<size_t>(ins[ip++]); };
+
+  // Integer operands are worked on where they lie on the stack, the result
+  // takes the left one's slot. The right one is left behind above the top,
+  // an integer holds on to nothing.
+  auto integerInfix = [&](auto fn) {
+    auto &left = m_stack[m_sp - 2];
+    const auto &right = m_stack[m_sp - 1];
+    if (!left.IsInteger() || !right.IsInteger()) {
+      return false;
+    }
+    left.SetInt(fn(left.AsInteger(), right.AsInteger()));
+    m_sp--;
+    return true;
+  };
+  // A comparison that only decides a jump takes it right away instead of
+  // pushing a boolean for OpJumpNotTruthy to pop again
+  auto integerComparison = [&](auto fn) {
+    auto &left = m_stack[m_sp - 2];
+    const auto &right = m_stack[m_sp - 1];
+    if (!left.IsInteger() || !right.IsInteger()) {
+      return false;
+    }
+    bool result = fn(left.AsInteger(), right.AsInteger());
+    if (ins[ip] == Code::OpJumpNotTruthy) {
+      ip++;
+      auto pos = readUint16();
+      if (!result) {
+        ip = pos;
+      }
+      m_sp -= 2;
+      return true;
+    }
+    left = result ? Evaluator::TRUE : Evaluator::FALSE;
+    m_sp--;
+    return true;
+  };
+
+  enterFrame();
+  while (true) {
+    auto op = static_cast<Code::Opcode>(ins[ip++]);
+
+    switch (op) {
+    case Code::OpConstant: {
+      auto constIndex = readUint16();
+      pushSlot() = m_constants[constIndex];
+      break;
+    }
+    case Code::OpAdd:
+      if (integerInfix(std::plus<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::PLUS)) {
+        return err;
+      }
+      break;
+    case Code::OpSub:
+      if (integerInfix(std::minus<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::MINUS)) {
+        return err;
+      }
+      break;
+    case Code::OpMul:
+      if (integerInfix(std::multiplies<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::ASTERISK)) {
+        return err;
+      }
+      break;
+    case Code::OpDiv:
+      // dividing by zero is left to the evaluator's error
+      if (!m_stack[m_sp - 1].IsInteger() ||
+          m_stack[m_sp - 1].AsInteger() != 0) {
+        if (integerInfix(std::divides<>())) {
+          break;
+        }
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::SLASH)) {
+        return err;
+      }
+      break;
+    case Code::OpEqual:
+      if (integerComparison(std::equal_to<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::EQ)) {
+        return err;
+      }
+      break;
+    case Code::OpNotEqual:
+      if (integerComparison(std::not_equal_to<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::NOT_EQ)) {
+        return err;
+      }
+      break;
+    case Code::OpGreaterThan:
+      if (integerComparison(std::greater<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::GT)) {
+        return err;
+      }
+      break;
+    case Code::OpLessThan:
+      if (integerComparison(std::less<>())) {
+        break;
+      }
+      if (auto err = executeBinaryOperation(Ast::Operator::LT)) {
+        return err;
+      }
+      break;
+    case Code::OpPop: {
+      m_sp--;
+      m_lastPopped = std::move(m_stack[m_sp]);
+      break;
+    }
+    case Code::OpTrue:
+      pushSlot() = Evaluator::TRUE;
+      break;
+    case Code::OpFalse:
+      pushSlot() = Evaluator::FALSE;
+      break;
+    case Code::OpNull:
+      pushSlot() = Evaluator::NULL_O;
+      break;
+    case Code::OpBang: {
+      auto &operand = m_stack[m_sp - 1];
+      if (operand.IsInteger()) {
+        operand = Evaluator::FALSE;
+        break;
+      }
+      // anything else goes by the evaluator's rules, where !null is null
+      operand = Evaluator::Evaluator::evalPrefixExpression(
+        Ast::Operator::BANG, operand);
+      break;
+    }
+    case Code::OpMinus: {
+      auto &operand = m_stack[m_sp - 1];
+      if (operand.IsInteger()) {
+        operand.SetInt(-operand.AsInteger());
+        break;
+      }
+      auto result = Evaluator::Evaluator::evalPrefixExpression(
+        Ast::Operator::MINUS, operand);
+      if (auto err = asError(result)) {
+        return err;
+      }
+      operand = std::move(result);
+      break;
+    }
+    case Code::OpJump: {
+      ip = readUint16();
+      break;
+    }
+    case Code::OpJumpNotTruthy: {
+      auto pos = readUint16();
+      m_sp--;
+      if (!isTruthy(m_stack[m_sp])) {
+        ip = pos;
+      }
+      break;
+    }
+    case Code::OpSetGlobal: {
+      auto globalIndex = readUint16();
+      if (globalIndex >= m_globals.size()) {
+        m_globals.resize(globalIndex + 1);
+      }
+      m_sp--;
+      m_globals[globalIndex] = std::move(m_stack[m_sp]);
+      break;
+    }
+    case Code::OpGetGlobal: {
+      auto globalIndex = readUint16();
+      if (globalIndex >= m_globals.size() ||
+          m_globals[globalIndex] == nullptr) {
+        if (auto err = bindBuiltin(globalIndex)) {
+          return err;
+        }
+      }
+      pushSlot() = m_globals[globalIndex];
+      break;
+    }
+    case Code::OpSetLocal: {
+      auto localIndex = readUint8();
+      m_sp--;
+      m_stack[bp + localIndex] = std::move(m_stack[m_sp]);
+      break;
+    }
+    case Code::OpGetLocal: {
+      auto localIndex = readUint8();
+      auto &top = pushSlot();
+      const auto &local = m_stack[bp + localIndex];
+      // a let in a branch that was not taken leaves its slot empty
+      top = local != nullptr ? local : Evaluator::NULL_O;
+      break;
+    }
+    case Code::OpGetFree: {
+      auto freeIndex = readUint8();
+      pushSlot() = cl->m_free[freeIndex];
+      break;
+    }
+    case Code::OpCurrentClosure: {
+      pushSlot() = cl;
+      break;
+    }
+    case Code::OpArray: {
+      auto numElements = readUint16();
+      std::vector<Object::Value> elements(
+        std::make_move_iterator(m_stack.begin() +
+                                static_cast<long>(m_sp - numElements)),
+        std::make_move_iterator(m_stack.begin() + static_cast<long>(m_sp)));
+      m_sp -= numElements;
+      push(Object::New<Object::Array>(std::move(elements)));
+      break;
+    }
+    case Code::OpHash: {
+      auto numElements = readUint16();
+      auto *hash = Object::New<Object::Hash>(numElements / 2);
+      for (size_t i = m_sp - numElements; i < m_sp; i += 2) {
+        auto hashKey = Object::HashKeyOf(m_stack[i]);
+        if (!hashKey) {
+          return Evaluator::Evaluator::newError(
+            "unusable as hash key: " +
+            Object::objectTypeToStr(m_stack[i].Type()));
+        }
+        hash->Set(*hashKey, std::move(m_stack[i]), std::move(m_stack[i + 1]));
+      }
+      m_sp -= numElements;
+      push(hash);
+      break;
+    }
+    case Code::OpIndex: {
+      m_sp--;
+      auto index = std::move(m_stack[m_sp]);
+      m_sp--;
+      auto left = std::move(m_stack[m_sp]);
+      auto result = Evaluator::Evaluator::evalIndexExpression(left, index);
+      if (auto err = asError(result)) {
+        return err;
+      }
+      push(std::move(result));
+      break;
+    }
+    case Code::OpCall:
+    case Code::OpTailCall: {
+      auto numArgs = readUint8();
+      m_frames.back().ip = ip;
+      if (auto err = executeCall(numArgs, op == Code::OpTailCall)) {
+        return err;
+      }
+      enterFrame();
+      break;
+    }
+    case Code::OpReturnValue:
+    case Code::OpReturn: {
+      Object::Value returnValue = Evaluator::NULL_O;
+      if (op == Code::OpReturnValue) {
+        m_sp--;
+        returnValue = std::move(m_stack[m_sp]);
+      }
+      // a return at the top level ends the program, the one at the end of
+      // it leaves the value of the last expression statement
+      if (m_frames.size() == 1) {
+        if (op == Code::OpReturnValue) {
+          m_lastPopped = std::move(returnValue);
+        }
+        return nullptr;
+      }
+      m_sp = bp - 1;
+      m_frames.pop_back();
+      m_stack[m_sp++] = std::move(returnValue);
+      enterFrame();
+      break;
+    }
+    case Code::OpClosure: {
+      auto constIndex = readUint16();
+      auto numFree = readUint8();
+      if (auto err = pushClosure(constIndex, numFree)) {
+        return err;
+      }
+      break;
+    }
+    default:
+      return Evaluator::Evaluator::newError(
+        std::format("unknown opcode: {}", static_cast<int>(op)));
+    }
+  }
+}
+
+// What the fast paths in Run leave over, the evaluator's rules for every
+// other pair of operands
+std::shared_ptr<Object::Error>
+Vm::executeBinaryOperation(Ast::Operator infixOp) {
+  auto &left = m_stack[m_sp - 2];
+  auto &right = m_stack[m_sp - 1];
+  auto result =
+    Evaluator::Evaluator::evalInfixExpression(infixOp, left, right);
+  if (auto err = asError(result)) {
+    return err;
+  }
+  m_sp--;
+  right = nullptr;
+  left = std::move(result);
+  return nullptr;
+}
+
+std::shared_ptr<Object::Error> Vm::executeCall(size_t numArgs, bool tail) {
+  const auto &callee = m_stack[m_sp - 1 - numArgs];
+  switch (callee->Type()) {
+  case Object::ObjectType::CLOSURE_OBJ: {
+    auto *cl = static_cast<Object::Closure *>(callee.get());
+    if (static_cast<int>(numArgs) != cl->m_fn->m_numParameters) {
+      return Evaluator::Evaluator::newError(
+        std::format("wrong number of arguments: want={}, got={}",
+                    cl->m_fn->m_numParameters, numArgs));
+    }
+    // the top level has no caller to take the place of
+    tail = tail && m_frames.size() > 1;
+    if (!tail && m_frames.size() >= m_maxFrames) {
+      return stackOverflow();
+    }
+    auto basePointer = m_sp - numArgs;
+    if (tail) {
+      // the callee and its arguments replace the caller's
+      auto first = m_stack.begin() + static_cast<long>(basePointer - 1);
+      basePointer = m_frames.back().basePointer;
+      std::move(first, m_stack.begin() + static_cast<long>(m_sp),
+                m_stack.begin() + static_cast<long>(basePointer - 1));
+      m_sp = basePointer + numArgs;
+    }
+    auto numLocals = static_cast<size_t>(cl->m_fn->m_numLocals);
+    reserveStack(basePointer + numLocals);
+    // clear locals left over from earlier calls
+    for (size_t i = m_sp; i < basePointer + numLocals; i++) {
+      m_stack[i] = nullptr;
+    }
+    m_sp = basePointer + numLocals;
+    // the callee and its arguments are on the stack, so all that is live
+    // is reachable from here
+    m_heap.Safepoint();
+    if (tail) {
+      m_frames.back() = {.cl = cl, .ip = 0, .basePointer = basePointer};
+    } else {
+      m_frames.push_back({.cl = cl, .ip = 0, .basePointer = basePointer});
+    }
+    return nullptr;
+  }
+  case Object::ObjectType::BUILTIN_OBJ: {
+    auto *builtin = static_cast<Object::Builtin *>(callee.get());
+    auto result = builtin->m_fn(
+      std::span<const Object::Value>(m_stack).subspan(m_sp - numArgs, numArgs));
+    m_sp = m_sp - numArgs - 1;
+    if (auto err = asError(result)) {
+      return err;
+    }
+    push(result != nullptr ? std::move(result) : Evaluator::NULL_O);
+    return nullptr;
+  }
+  default:
+    return Evaluator::Evaluator::newError(std::format(
+      "not a function: {}", Object::objectTypeToStr(callee->Type())));
+  }
+}
+
+std::shared_ptr<Object::Error> Vm::pushClosure(size_t constIndex,
+                                               size_t numFree) {
+  const auto &constant = m_constants[constIndex];
+  if (constant->Type() != Object::ObjectType::COMPILED_FUNCTION_OBJ) {
+    return Evaluator::Evaluator::newError(
+      std::format("not a function: {}",
+                  Object::objectTypeToStr(constant->Type())));
+  }
+  auto fn =
+    std::static_pointer_cast<Object::CompiledFunction>(constant.Shared());
+  std::vector<Object::Value> freeVars(
+    m_stack.begin() + static_cast<long>(m_sp - numFree),
+    m_stack.begin() + static_cast<long>(m_sp));
+  m_sp -= numFree;
+  push(Object::New<Object::Closure>(fn, std::move(freeVars)));
+  return nullptr;
+}
+
+} // namespace Vm
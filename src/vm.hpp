@@ -0,0 +1,76 @@
+#pragma once
+#include "ast.hpp"
+#include "code.hpp"
+#include "compiler.hpp"
+#include "gc.hpp"
+#include "object.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+namespace Vm {
+
+using Globals = std::vector<Object::Value>;
+
+struct Frame {
+  Object::Closure *cl;
+  size_t ip;
+  size_t basePointer;
+};
+
+// The stack, the globals and the closures of the frames are the vm's roots.
+// The heap collects when a closure is called.
+class Vm : public Gc::RootSource {
+public:
+  // Calls nested deeper than this stop with a stack overflow. A tail call
+  // takes the place of its caller's frame, so it doesn't count.
+  static constexpr size_t DefaultMaxFrames = 1'000'000;
+
+  explicit Vm(const Compiler::Bytecode &bytecode,
+              size_t maxFrames = DefaultMaxFrames);
+  // Globals are kept by the caller so the repl can carry them across lines
+  Vm(const Compiler::Bytecode &bytecode, Globals &globals,
+     size_t maxFrames = DefaultMaxFrames);
+
+  // Returns nullptr on success, otherwise the error that stopped execution
+  std::shared_ptr<Object::Error> Run();
+  // Value of the last expression statement, nullptr if there was none
+  Object::Value LastPoppedStackElem();
+
+  void TraceRoots(Gc::Heap &heap) const override;
+
+private:
+  std::vector<Object::Value> m_constants;
+  std::vector<std::string> m_globalNames;
+  Globals m_ownGlobals;
+  Globals &m_globals;
+  Gc::Heap &m_heap;
+
+  // grows as calls need it, the frames are what is limited
+  static constexpr size_t InitialStackSize = 1024;
+  std::vector<Object::Value> m_stack;
+  size_t m_sp = 0; // always points to the next free slot
+  Object::Value m_lastPopped;
+
+  std::vector<Frame> m_frames;
+  size_t m_maxFrames;
+
+  // the slot on top, made room for
+  Object::Value &pushSlot() {
+    if (m_sp == m_stack.size()) {
+      reserveStack(m_sp + 1);
+    }
+    return m_stack[m_sp++];
+  }
+  void push(Object::Value obj);
+  // makes room for at least size values
+  void reserveStack(size_t size);
+  // nullptr once the global holds the builtin of its name
+  std::shared_ptr<Object::Error> bindBuiltin(size_t globalIndex);
+  std::shared_ptr<Object::Error> executeBinaryOperation(Ast::Operator infixOp);
+  // a tail call reuses the frame on top, see Compiler::markTailCalls
+  std::shared_ptr<Object::Error> executeCall(size_t numArgs, bool tail);
+  std::shared_ptr<Object::Error> pushClosure(size_t constIndex,
+                                             size_t numFree);
+};
+
+} // namespace Vm
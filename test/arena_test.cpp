@@ -0,0 +1,64 @@
+#include "arena.hpp"
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+static Ast::Program parse(const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  return p.ParseProgram();
+}
+
+TEST(Arena, AllocationsAreAligned) {
+  Ast::Arena arena;
+  for (std::size_t align = 1; align <= 16; align *= 2) {
+    auto *ptr = arena.Allocate(3, align);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % align, 0);
+  }
+  // bigger than a chunk
+  auto *big = arena.Allocate(1024 * 1024, 16);
+  ASSERT_NE(big, nullptr);
+  ASSERT_EQ(reinterpret_cast<std::uintptr_t>(big) % 16, 0);
+  ASSERT_GE(arena.BytesAllocated(), 1024 * 1024);
+}
+
+TEST(Arena, ParsedNodesLiveInTheProgramArena) {
+  auto program = parse("let add = fn(a, b) { a + b }; add(1, [2, 3][0]);");
+  ASSERT_NE(program.m_arena, nullptr);
+  ASSERT_GT(program.m_arena->BytesAllocated(), 0);
+  for (const auto &stmt : program.m_statements) {
+    ASSERT_EQ(Ast::ArenaOf(stmt.get()), program.m_arena);
+  }
+
+  // nodes built by hand stay on the heap
+  Token::Token tok = {.Type = Token::IDENT, .Literal = "x"};
+  auto ident = std::make_unique<Ast::Identifier>(tok, Symbols::Intern("x"));
+  ASSERT_EQ(Ast::ArenaOf(ident.get()), nullptr);
+}
+
+TEST(Arena, FunctionsKeepTheirArenaAlive) {
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  Evaluator::Evaluator evaluator;
+  std::weak_ptr<Ast::Arena> arena;
+  {
+    auto program =
+      parse("let make = fn(x) { fn(y) { let z = x * y; z + 1 } }; "
+            "let f = make(3);");
+    arena = program.m_arena;
+    evaluator.Eval(&program, env);
+  }
+  ASSERT_FALSE(arena.expired());
+
+  auto program = parse("f(4)");
+  auto result = evaluator.Eval(&program, env);
+  ASSERT_NE(result, nullptr);
+  ASSERT_EQ(result->Inspect(), "13");
+}
@@ -6,11 +6,12 @@ TEST(TestString, Works) {
     Token::Token tok = {.Type = Token::LET, .Literal = "let"};
 
     Token::Token firstTok = {.Type = Token::IDENT, .Literal = "myVar"};
-    auto firstIdent = std::make_unique<Ast::Identifier>(firstTok, "myVar");
+    auto firstIdent = std::make_unique<Ast::Identifier>(
+        firstTok, Symbols::Intern("myVar"));
 
     Token::Token secondTok = {.Type = Token::IDENT, .Literal = "anotherVar"};
-    auto secondIdent =
-        std::make_unique<Ast::Identifier>(secondTok, "anotherVar");
+    auto secondIdent = std::make_unique<Ast::Identifier>(
+        secondTok, Symbols::Intern("anotherVar"));
 
     auto lStmt = std::make_unique<Ast::LetStatement>(tok);
     lStmt->m_name = std::move(firstIdent);
@@ -24,3 +25,23 @@ TEST(TestString, Works) {
 
     ASSERT_EQ(p.String(), "let myVar = anotherVar;");
 }
+
+TEST(TestVisitor, DispatchesOnTheTypeTag) {
+    Token::Token tok = {.Type = Token::INT, .Literal = "5"};
+    auto literal = std::make_unique<Ast::IntegerLiteral>(tok, 5);
+    Ast::INode *node = literal.get();
+
+    ASSERT_EQ(node->Type(), Ast::Type::INTEGER_LITERAL);
+    ASSERT_EQ(Ast::As<Ast::IntegerLiteral>(node), literal.get());
+    ASSERT_EQ(Ast::As<Ast::Identifier>(node), nullptr);
+    ASSERT_EQ(Ast::As<Ast::Identifier>(nullptr), nullptr);
+    ASSERT_EQ(Ast::Cast<Ast::IntegerLiteral>(node)->m_value, 5);
+
+    // every other node converts to the INode overload
+    struct Summer : Ast::Visitor<Summer, long> {
+        long Visit(Ast::IntegerLiteral *integer) { return integer->m_value; }
+        long Visit(Ast::Identifier * /*ident*/) { return 0; }
+        long Visit(Ast::INode * /*node*/) { return -1000; }
+    };
+    ASSERT_EQ(Summer().Dispatch(node), 5);
+}
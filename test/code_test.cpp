@@ -0,0 +1,76 @@
+#include "code.hpp"
+#include <format>
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(Code, Make) {
+  struct test {
+    Code::Opcode op;
+    std::vector<int> operands;
+    Code::Instructions expected;
+  };
+
+  std::vector<test> tests = {
+    {.op = Code::OpConstant,
+     .operands = {65534},
+     .expected = {Code::OpConstant, 255, 254}},
+    {.op = Code::OpAdd, .operands = {}, .expected = {Code::OpAdd}},
+    {.op = Code::OpGetLocal,
+     .operands = {255},
+     .expected = {Code::OpGetLocal, 255}},
+    {.op = Code::OpClosure,
+     .operands = {65534, 255},
+     .expected = {Code::OpClosure, 255, 254, 255}},
+  };
+
+  for (const auto &tst : tests) {
+    auto instruction = Code::Make(tst.op, tst.operands);
+    ASSERT_EQ(instruction, tst.expected)
+      << std::format("wrong instruction for {}",
+                     Code::Lookup(tst.op)->Name);
+  }
+}
+
+TEST(Code, InstructionsString) {
+  std::vector<Code::Instructions> instructions = {
+    Code::Make(Code::OpAdd),
+    Code::Make(Code::OpGetLocal, {1}),
+    Code::Make(Code::OpConstant, {2}),
+    Code::Make(Code::OpConstant, {65535}),
+    Code::Make(Code::OpClosure, {65535, 255}),
+  };
+  std::string expected = "0000 OpAdd\n"
+                         "0001 OpGetLocal 1\n"
+                         "0003 OpConstant 2\n"
+                         "0006 OpConstant 65535\n"
+                         "0009 OpClosure 65535 255\n";
+
+  Code::Instructions concatted;
+  for (const auto &ins : instructions) {
+    concatted.insert(concatted.end(), ins.begin(), ins.end());
+  }
+  ASSERT_EQ(Code::String(concatted), expected);
+}
+
+TEST(Code, ReadOperands) {
+  struct test {
+    Code::Opcode op;
+    std::vector<int> operands;
+    int bytesRead;
+  };
+
+  std::vector<test> tests = {
+    {.op = Code::OpConstant, .operands = {65535}, .bytesRead = 2},
+    {.op = Code::OpGetLocal, .operands = {255}, .bytesRead = 1},
+    {.op = Code::OpClosure, .operands = {65535, 255}, .bytesRead = 3},
+  };
+
+  for (const auto &tst : tests) {
+    auto instruction = Code::Make(tst.op, tst.operands);
+    const auto *def = Code::Lookup(tst.op);
+    ASSERT_NE(def, nullptr);
+    auto read = Code::ReadOperands(*def, instruction, 1);
+    ASSERT_EQ(read.bytesRead, tst.bytesRead);
+    ASSERT_EQ(read.operands, tst.operands);
+  }
+}
@@ -0,0 +1,118 @@
+#include "compiler.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+static Object::Value eval(Evaluator::Evaluator &evaluator,
+                          const std::shared_ptr<Object::Environment> &env,
+                          const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  return evaluator.Eval(&program, env);
+}
+
+// binary recursion, lots of calls and garbage without a deep stack
+static const std::string churn =
+  "let t = fn(d) { if (d == 0) { [1, \"a\" + \"b\"] } "
+  "else { t(d - 1); t(d - 1) } }; len(t(14))";
+
+TEST(Gc, ClosuresKeepTheirScopeAlive) {
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = eval(evaluator, env,
+                     "let adder = fn(a) { fn(b) { fn(c) { a + b + c } } };"
+                     "let addThree = adder(1)(2);");
+  Gc::Heap::Current().Collect();
+  result = eval(evaluator, env, "addThree(3)");
+  ASSERT_TRUE(result.IsInteger()) << result->Inspect();
+  ASSERT_EQ(result.AsInteger(), 6);
+}
+
+TEST(Gc, KeepsWhatTheGlobalsReach) {
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  eval(evaluator, env, "let keep = [1, \"two\", {\"three\": 3}];");
+  std::shared_ptr<Object::IObject> pinned =
+    eval(evaluator, env, "\"pin\" + \"ned\"");
+  Gc::Heap::Current().Collect();
+  ASSERT_EQ(eval(evaluator, env, "keep")->Inspect(),
+            "[1,two,{three: 3}]");
+  ASSERT_EQ(pinned->Inspect(), "pinned");
+}
+
+TEST(Gc, FreesUnreachableCycles) {
+  auto &heap = Gc::Heap::Current();
+  heap.Collect();
+  auto freed = heap.Statistics().m_freedObjects;
+  {
+    Evaluator::Evaluator evaluator;
+    auto env = Gc::Pin(Object::New<Object::Environment>());
+    // the function and the environment it is stored in point at each other
+    eval(evaluator, env, "let f = fn() { f }; let g = fn(x) { fn() { x } };"
+                         "let h = g(1);");
+  }
+  heap.Collect();
+  // the global environment, f, g, h, and the call's environment
+  ASSERT_GE(heap.Statistics().m_freedObjects - freed, 5);
+}
+
+// more pins than a 16 bit count holds, it must not wrap to unpinned
+TEST(Gc, ManyPinsKeepAnObjectAlive) {
+  auto &heap = Gc::Heap::Current();
+  heap.Collect();
+  auto freed = heap.Statistics().m_freedObjects;
+  auto *str = Object::New<Object::String>("pinned");
+  constexpr int pins = 1 << 16;
+  for (int i = 0; i < pins; i++) {
+    Gc::Heap::Pin(str);
+  }
+  heap.Collect();
+  ASSERT_EQ(heap.Statistics().m_freedObjects, freed);
+  ASSERT_EQ(str->Inspect(), "pinned");
+  for (int i = 0; i < pins; i++) {
+    Gc::Heap::Unpin(str);
+  }
+  heap.Collect();
+  ASSERT_EQ(heap.Statistics().m_freedObjects, freed + 1);
+}
+
+TEST(Gc, CollectsWhileEvaluating) {
+  auto &heap = Gc::Heap::Current();
+  auto before = heap.Statistics();
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = eval(evaluator, env, churn);
+  ASSERT_TRUE(result.IsInteger()) << result->Inspect();
+  ASSERT_EQ(result.AsInteger(), 2);
+
+  const auto &after = heap.Statistics();
+  ASSERT_GT(after.m_collections, before.m_collections);
+  ASSERT_GT(after.m_freedObjects, before.m_freedObjects);
+  ASSERT_LT(after.m_liveBytes,
+            after.m_allocatedBytes - before.m_allocatedBytes);
+}
+
+TEST(Gc, CollectsWhileRunningTheVm) {
+  auto &heap = Gc::Heap::Current();
+  auto before = heap.Statistics();
+  Lexer::Lexer l(churn);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Compiler::Compiler compiler;
+  ASSERT_TRUE(compiler.Compile(&program));
+  Vm::Vm vm(compiler.GetBytecode());
+  auto err = vm.Run();
+  ASSERT_EQ(err, nullptr) << err->Inspect();
+  auto result = vm.LastPoppedStackElem();
+  ASSERT_TRUE(result.IsInteger());
+  ASSERT_EQ(result.AsInteger(), 2);
+  ASSERT_GT(heap.Statistics().m_collections, before.m_collections);
+}
@@ -0,0 +1,81 @@
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+static std::string optimized(const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Optimizer::Optimizer().Optimize(&program);
+  return program.String();
+}
+
+static std::string evalToString(const std::string &input, bool optimize) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  if (optimize) {
+    Optimizer::Optimizer().Optimize(&program);
+  }
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&program, env);
+  return result != nullptr ? result->Inspect() : "";
+}
+
+TEST(Optimizer, FoldsAndPrunes) {
+  struct test {
+    const std::string input;
+    const std::string expected;
+  };
+  std::vector<test> tests{
+    {.input = "2 * 60 * 60", .expected = "7200"},
+    {.input = "-(1 + 2) < 4", .expected = "true"},
+    {.input = "!true == false", .expected = "true"},
+    {.input = R"("a" + "b" == "ab")", .expected = "true"},
+    {.input = "x * 2 * 60", .expected = "((x * 2) * 60)"},
+    {.input = "x * (2 * 60)", .expected = "(x * 120)"},
+    // runtime errors are left to happen at runtime
+    {.input = "1 / 0", .expected = "(1 / 0)"},
+    {.input = "1 + true", .expected = "(1 + true)"},
+    {.input = "true + false", .expected = "(true + false)"},
+    {.input = "let a = if (1 < 2) { 10 } else { 20 };",
+     .expected = "let a = 10;"},
+    {.input = "if (false) { 10 }", .expected = "iffalse 10"},
+    {.input = "if (false) { a } else { let b = 1; b }; 3",
+     .expected = "let b = 1;b3"},
+    {.input = "5; true; fn(x) { x }; x", .expected = "x"},
+    {.input = "fn() { 1; if (true) { return 2 * 3; } 4 }",
+     .expected = "fn() return 6;4"},
+  };
+  for (const auto &tst : tests) {
+    ASSERT_EQ(optimized(tst.input), tst.expected) << tst.input;
+  }
+}
+
+TEST(Optimizer, KeepsResults) {
+  std::vector<std::string> inputs{
+    "2 * 60 * 60",
+    "if (1 > 2) { 10 }",
+    "if (1 < 2) { }",
+    "let f = fn(x) { if (true) { let y = x * 2; return y; } 0 }; f(3);",
+    "let f = fn(x) { if (false) { 1 } else { x + 2 * 3 } }; f(1);",
+    "let f = fn() { 5; 6; }; f();",
+    "10 / (5 - 5)",
+    "5 + true; 5;",
+    R"("Hello" - "World")",
+    "-true",
+    "!!5",
+  };
+  for (const auto &input : inputs) {
+    ASSERT_EQ(evalToString(input, true), evalToString(input, false)) << input;
+  }
+}
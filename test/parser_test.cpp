@@ -17,7 +17,7 @@ static void testLetStatement(std::unique_ptr<Ast::IStatement> &s,
   Ast::LetStatement *letStmt = dynamic_cast<Ast::LetStatement *>(stmt);
   if (letStmt != nullptr) {
     ASSERT_EQ(s->TokenLiteral(), "let");
-    ASSERT_EQ(letStmt->m_name->m_value, name);
+    ASSERT_EQ(letStmt->m_name->Name(), name);
     ASSERT_EQ(letStmt->m_name->TokenLiteral(), name);
   } else {
     ASSERT_TRUE(false) << "nullptr into testLetStatement";
@@ -26,8 +26,8 @@ static void testLetStatement(std::unique_ptr<Ast::IStatement> &s,
 
 static void checkParserErrors(const Parser::Parser &p) {
   std::string errors;
-  for (const std::string &error : p.m_errors) {
-    errors.append("ParserError:" + error + "\n");
+  for (const auto &error : p.m_errors) {
+    errors.append("ParserError:" + error.m_message + "\n");
   }
   ASSERT_EQ(std::ssize(p.m_errors), 0) << errors << '\n';
 }
@@ -67,8 +67,9 @@ static void testIdentifier(Ast::IExpression &exp, const std::string &value) {
   try {
     auto ident = dynamic_cast<Ast::Identifier &>(exp);
 
-    ASSERT_EQ(value, ident.m_value)
-      << "ident->value not " << value << "got=" << ident.m_value;
+    ASSERT_EQ(value, ident.Name())
+      << "ident->value not " << value << "got=" << ident.Name();
+    ASSERT_EQ(ident.m_symbol, Symbols::Intern(value));
 
     ASSERT_EQ(value, ident.TokenLiteral())
       << "ident->TokenLiteral() not " << value
@@ -100,6 +101,7 @@ static void testInfixExpression(Ast::IExpression *exp, variant left,
   testLiteralExpression(*opExp->m_right, std::move(right));
   ASSERT_EQ(opExp->m_op, op)
     << "exp.Operator is not " << op << ". got=" << opExp->m_op;
+  ASSERT_EQ(Ast::OperatorString(opExp->m_operator), op);
 }
 
 TEST(Parser, LetStatements) {
@@ -236,7 +238,7 @@ TEST(Parser, IdentifierExpression) {
   auto ident = dynamic_cast<Ast::Identifier *>(iExp);
   ASSERT_TRUE(ident != nullptr);
 
-  ASSERT_TRUE(ident->m_value == "foobar");
+  ASSERT_TRUE(ident->Name() == "foobar");
   ASSERT_TRUE(ident->TokenLiteral() == "foobar");
 }
 
@@ -322,6 +324,7 @@ TEST(Parser, ParsingPrefixExpressions) {
     ASSERT_TRUE(exp != nullptr);
 
     ASSERT_EQ(exp->m_op, test.op);
+    ASSERT_EQ(Ast::OperatorString(exp->m_operator), test.op);
     testLiteralExpression(*exp->m_right, test.value);
   }
 }
@@ -805,6 +808,15 @@ TEST(Parser, ParsingHashLiterals) {
   }
 }
 
+TEST(Parser, ParsingHashLiteralsKeepsSourceOrder) {
+  std::string input = "{\"b\": 1, \"a\": 2, 3: x, true: \"c\"}";
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  checkParserErrors(p);
+  ASSERT_EQ(program.String(), "{b:1,a:2,3:x,true:c}");
+}
+
 TEST(Parser, ParsingEmptyHashLiterals) {
   std::string input = "{}";
   Lexer::Lexer l(input);
@@ -822,3 +834,17 @@ TEST(Parser, ParsingEmptyHashLiterals) {
   ASSERT_EQ(std::ssize(hash->m_pairs), 0)
     << "hash.Pairs length should be 3, got=" << std::ssize(hash->m_pairs);
 }
+
+TEST(Parser, ErrorsSayWhere) {
+  std::string input = "let x = 5;\nlet = 10;\n  let y 3;";
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  p.ParseProgram();
+  std::vector<std::string> expected = {
+    "2:5: Expect next token to be IDENT, got = instead",
+    "2:5: no prefix parse function for = found",
+    "3:9: Expect next token to be =, got INT instead",
+  };
+  ASSERT_EQ(p.LocatedErrors(), expected);
+  ASSERT_EQ(p.Errors()[0], "Expect next token to be IDENT, got = instead");
+}
@@ -0,0 +1,143 @@
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "stack_evaluator.hpp"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+static std::string evalToString(const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&program, env);
+  return result != nullptr ? result->Inspect() : "";
+}
+
+TEST(Resolver, AnnotatesDepthAndSlot) {
+  std::string input = "let a = 1; let f = fn(x) { let y = x; fn(z) { a + y + "
+                      "z } }; len";
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  auto globals = std::make_shared<Ast::ScopeLayout>();
+  Resolver::Resolver(globals).Resolve(&program);
+
+  ASSERT_EQ(globals->Find(Symbols::Intern("a")), 0);
+  ASSERT_EQ(globals->Find(Symbols::Intern("f")), 1);
+
+  auto *outer = dynamic_cast<Ast::FunctionLiteral *>(
+    dynamic_cast<Ast::LetStatement *>(program.m_statements[1].get())
+      ->m_expression.get());
+  ASSERT_NE(outer, nullptr);
+  ASSERT_EQ(outer->m_layout->Find(Symbols::Intern("x")), 0);
+  ASSERT_EQ(outer->m_layout->Find(Symbols::Intern("y")), 1);
+
+  auto *inner = dynamic_cast<Ast::FunctionLiteral *>(
+    dynamic_cast<Ast::ExpressionStatement *>(
+      outer->m_body->m_statements[1].get())
+      ->m_expression.get());
+  ASSERT_NE(inner, nullptr);
+
+  // a + y + z parses as ((a + y) + z)
+  auto *sum = dynamic_cast<Ast::InfixExpression *>(
+    dynamic_cast<Ast::ExpressionStatement *>(
+      inner->m_body->m_statements[0].get())
+      ->m_expression.get());
+  auto *left = dynamic_cast<Ast::InfixExpression *>(sum->m_left.get());
+  auto *a = dynamic_cast<Ast::Identifier *>(left->m_left.get());
+  auto *y = dynamic_cast<Ast::Identifier *>(left->m_right.get());
+  auto *z = dynamic_cast<Ast::Identifier *>(sum->m_right.get());
+  ASSERT_EQ(a->m_depth, 2);
+  ASSERT_EQ(a->m_slot, 0);
+  ASSERT_EQ(y->m_depth, 1);
+  ASSERT_EQ(y->m_slot, 1);
+  ASSERT_EQ(z->m_depth, 0);
+  ASSERT_EQ(z->m_slot, 0);
+
+  auto *len = dynamic_cast<Ast::Identifier *>(
+    dynamic_cast<Ast::ExpressionStatement *>(program.m_statements[2].get())
+      ->m_expression.get());
+  ASSERT_EQ(len->m_depth, -1);
+  ASSERT_GE(len->m_builtin, 0);
+}
+
+TEST(Resolver, EvaluatorScoping) {
+  struct test {
+    const std::string input;
+    const std::string expected;
+  };
+  std::vector<test> tests = {
+    {.input = "let x = 1; let f = fn(x) { x }; f(2) + x", .expected = "3"},
+    {.input = "let x = 1; let x = x + 1; x", .expected = "2"},
+    {.input = "let x = 1; let f = fn() { let x = x + 10; x }; f() + x",
+     .expected = "12"},
+    {.input = "let x = 1; let f = fn(c) { if (c) { let x = 5; } x }; f(false)",
+     .expected = "1"},
+    {.input = "let x = 1; let f = fn(c) { if (c) { let x = 5; } x }; f(true)",
+     .expected = "5"},
+    {.input = "let f = fn() { g() }; let g = fn() { 7 }; f()", .expected = "7"},
+    {.input = "let count = fn(n) { if (n == 0) { 0 } else { 1 + count(n - 1) "
+              "} }; count(20)",
+     .expected = "20"},
+    {.input = "let len = fn(x) { 42 }; len([1])", .expected = "42"},
+    {.input = "len([1, 2])", .expected = "2"},
+    {.input = "let f = fn() { missing }; f()",
+     .expected = "Error: identifier not found: missing"},
+    // an empty block binds null, the name is still bound
+    {.input = "let l = fn() { }(); l", .expected = "null"},
+    {.input = "let l = if (true) { }; l", .expected = "null"},
+    {.input = "let f = fn(x) { x }; f(if (true) { })", .expected = "null"},
+  };
+  for (const auto &tst : tests) {
+    ASSERT_EQ(evalToString(tst.input), tst.expected) << tst.input;
+  }
+}
+
+TEST(Resolver, GlobalsPersistAcrossPrograms) {
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  Evaluator::Evaluator evaluator;
+  for (const std::string input : {"let a = 5;", "let b = fn() { a };"}) {
+    Lexer::Lexer l(input);
+    Parser::Parser p(l);
+    Ast::Program program = p.ParseProgram();
+    evaluator.Eval(&program, env);
+  }
+  Lexer::Lexer l("b() + a");
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  auto result = evaluator.Eval(&program, env);
+  ASSERT_NE(result, nullptr);
+  ASSERT_EQ(result->Inspect(), "10");
+}
+
+// A builtin a function was resolved against gives way to a global of the
+// same name bound by a later program, as on the next line of the repl
+template <typename Engine> static void expectLaterLetsShadowBuiltins() {
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  Engine evaluator;
+  auto eval = [&](const std::string &input) {
+    Lexer::Lexer l(input);
+    Parser::Parser p(l);
+    Ast::Program program = p.ParseProgram();
+    auto result = evaluator.Eval(&program, env);
+    return result != nullptr ? result->Inspect() : "";
+  };
+  eval("let f = fn() { 10 };");
+  eval(R"(let g = fn() { f() + len("ab") };)");
+  ASSERT_EQ(eval("g()"), "12");
+  eval("let len = fn(x) { 100 };");
+  ASSERT_EQ(eval("g()"), "110");
+}
+
+TEST(Resolver, LaterLetsShadowBuiltins) {
+  expectLaterLetsShadowBuiltins<Evaluator::Evaluator>();
+  expectLaterLetsShadowBuiltins<Evaluator::StackEvaluator>();
+}
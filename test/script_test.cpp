@@ -0,0 +1,108 @@
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "repl.hpp"
+#include "script.hpp"
+
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+static const std::string program = "let add = fn(a, b) { a + b };\n"
+                                   "let s = \"mapped\";\n"
+                                   "add(40, 2)\n";
+
+static std::string writeTemp(const std::string &contents) {
+  char path[] = "/tmp/script_testXXXXXX";
+  int fd = mkstemp(path);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(write(fd, contents.data(), contents.size()),
+            static_cast<ssize_t>(contents.size()));
+  close(fd);
+  return path;
+}
+
+TEST(Script, FilesAreMappedAndLexedInPlace) {
+  std::string path = writeTemp(program);
+  std::string error;
+  auto source = Script::Load(path, error);
+  unlink(path.c_str());
+  ASSERT_NE(source, nullptr) << error;
+  ASSERT_NE(source->Mapping, nullptr);
+  ASSERT_TRUE(source->Owned.empty());
+  ASSERT_EQ(source->Text, program);
+
+  Lexer::Lexer l(source);
+  const char *begin = source->Text.data();
+  const char *end = begin + source->Text.size();
+  for (auto tok = l.NextToken(); tok.Type != Token::EOF_; tok = l.NextToken()) {
+    ASSERT_GE(tok.Literal.data(), begin);
+    ASSERT_LE(tok.Literal.data() + tok.Literal.size(), end);
+  }
+
+  // the program keeps the mapping alive once the lexer and the source are
+  // let go of
+  Ast::Program parsed = [&] {
+    Lexer::Lexer again(std::move(source));
+    Parser::Parser p(again);
+    Ast::Program parsed = p.ParseProgram();
+    EXPECT_TRUE(p.Errors().empty());
+    return parsed;
+  }();
+  l = Lexer::Lexer("");
+  Evaluator::Evaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&parsed, env);
+  ASSERT_TRUE(result.IsInteger());
+  ASSERT_EQ(result.AsInteger(), 42);
+}
+
+TEST(Script, PipesAreRead) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], program.data(), program.size()),
+            static_cast<ssize_t>(program.size()));
+  close(fds[1]);
+  std::string error;
+  auto source = Script::Load("/dev/fd/" + std::to_string(fds[0]), error);
+  close(fds[0]);
+  ASSERT_NE(source, nullptr) << error;
+  ASSERT_EQ(source->Mapping, nullptr);
+  ASSERT_EQ(source->Text, program);
+}
+
+TEST(Script, EmptyAndMissingFiles) {
+  std::string path = writeTemp("");
+  std::string error;
+  auto source = Script::Load(path, error);
+  unlink(path.c_str());
+  ASSERT_NE(source, nullptr) << error;
+  ASSERT_TRUE(source->Text.empty());
+
+  ASSERT_EQ(Script::Load(path, error), nullptr);
+  ASSERT_NE(error.find(path), std::string::npos);
+}
+
+TEST(Script, ErrorsFailTheRun) {
+  auto run = [](const std::string &program, Repl::Engine engine) {
+    std::string path = writeTemp(program);
+    int status = Repl::RunFile(path, engine);
+    unlink(path.c_str());
+    return status;
+  };
+  for (auto engine :
+       {Repl::Engine::EVALUATOR, Repl::Engine::VM, Repl::Engine::STACK}) {
+    ASSERT_EQ(run("1 + 1", engine), 0);
+    ASSERT_EQ(run("5 / 0", engine), 1);
+    ASSERT_EQ(run("let a = ;", engine), 1);
+  }
+  // recursion this deep would crash the evaluator, the others stop it
+  std::string deep = "let f = fn(n) { 1 + f(n + 1) }; f(0)";
+  ASSERT_EQ(run(deep, Repl::Engine::VM), 1);
+  ASSERT_EQ(run(deep, Repl::Engine::STACK), 1);
+}
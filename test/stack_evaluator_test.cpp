@@ -0,0 +1,162 @@
+#include "ast.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "stack_evaluator.hpp"
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+static std::string
+evalToString(const std::string &input,
+             std::size_t maxDepth = Evaluator::StackEvaluator::DefaultMaxDepth) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Evaluator::StackEvaluator evaluator(maxDepth);
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&program, env);
+  return result != nullptr ? result->Inspect() : "";
+}
+
+TEST(StackEvaluator, MatchesTheEvaluator) {
+  struct test {
+    const std::string input;
+    const std::string expected;
+  };
+  std::vector<test> tests{
+    {.input = "5 + 5 * 2 - -1", .expected = "16"},
+    {.input = "!(1 < 2) == false", .expected = "true"},
+    {.input = "if (1 > 2) { 10 }", .expected = "null"},
+    {.input = "if (1 < 2) { 10 } else { 20 }", .expected = "10"},
+    {.input = "if (10 > 1) { if (10 > 1) { return 10; } return 1; }",
+     .expected = "10"},
+    {.input = "let f = fn() { [1, if (true) { return 3; }, 5] }; f();",
+     .expected = "3"},
+    {.input = "let a = 5; let b = a * 2; a + b;", .expected = "15"},
+    {.input = "let newAdder = fn(x) { fn(y) { x + y } };"
+              "let addTwo = newAdder(2); addTwo(3);",
+     .expected = "5"},
+    {.input = R"("Hello" + " " + "World")", .expected = "Hello World"},
+    {.input = "let a = [1, 2 * 2, 3]; a[1] + len(a) + first(rest(a));",
+     .expected = "11"},
+    {.input = R"({"one": 1, true: 2, 3: 3}[true])", .expected = "2"},
+    {.input = "let fib = fn(x) { if (x < 2) { x } else { "
+              "fib(x - 1) + fib(x - 2) } }; fib(15);",
+     .expected = "610"},
+    {.input = "5 + true; 5;", .expected = "Error: type mismatch: INTEGER + "
+                                          "BOOLEAN"},
+    {.input = R"({[1]: 1 / 0})",
+     .expected = "Error: unusable as hash key: ARRAY"},
+    {.input = "foobar", .expected = "Error: identifier not found: foobar"},
+    {.input = "let newAdder = fn(x) { fn(y) { x + y } };"
+              "let a = newAdder(1); let b = newAdder(10); a(2) + b(3);",
+     .expected = "16"},
+    {.input = "let make = fn() { fn(x) { x * 2 } }; make(); make();",
+     .expected = "fn(x) {\n(x * 2)\n}"},
+    {.input = "fn(a) { a; }();",
+     .expected = "Error: wrong number of arguments: want=1, got=0"},
+    {.input = "let l = fn() { }(); l", .expected = "null"},
+    {.input = "let l = if (true) { }; l", .expected = "null"},
+  };
+  for (const auto &tst : tests) {
+    ASSERT_EQ(evalToString(tst.input), tst.expected) << tst.input;
+  }
+}
+
+// What an empty body or a let leaves is null by the time a builtin, an
+// operator or a literal gets it, a builtin given nothing used to crash
+TEST(StackEvaluator, NothingIsPassedOnAsNull) {
+  ASSERT_EQ(evalToString("len(fn() { }())"),
+            "Error: argument to 'len' not supported, got NULL");
+  ASSERT_EQ(evalToString("[fn() { let a = 1; }(), if (true) { }]"),
+            "[null,null]");
+  ASSERT_EQ(evalToString("-fn() { }()"), "Error: unknown operator: -NULL");
+  ASSERT_EQ(evalToString("let a = 1;"), "");
+}
+
+TEST(StackEvaluator, ErrorPositions) {
+  std::string input = "let a = 1;\nlet f = fn() {\n  let b = 2;\n"
+                      "  a + true\n};\nf()";
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Evaluator::StackEvaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto result = evaluator.Eval(&program, env);
+  ASSERT_EQ(result.Type(), Object::ObjectType::ERROR_OBJ);
+  const auto *err = static_cast<Object::Error *>(result.get());
+  ASSERT_EQ(err->m_source, program.m_source);
+  auto position = err->m_source->Locate(err->m_offset);
+  // the + that failed, a step further in than the evaluator's statement
+  ASSERT_EQ(position.Line, 4);
+  ASSERT_EQ(position.Column, 5);
+}
+
+TEST(StackEvaluator, ErrorPositionsAcrossPrograms) {
+  Evaluator::StackEvaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  Lexer::Lexer defineLexer("let f = fn(x) {          x + true };");
+  Parser::Parser defineParser(defineLexer);
+  auto define = std::make_unique<Ast::Program>(defineParser.ParseProgram());
+  evaluator.Eval(define.get(), env);
+  auto defined = define->m_source;
+  define.reset();
+
+  Lexer::Lexer callLexer("f(1)");
+  Parser::Parser callParser(callLexer);
+  Ast::Program call = callParser.ParseProgram();
+  auto result = evaluator.Eval(&call, env);
+  ASSERT_EQ(result.Type(), Object::ObjectType::ERROR_OBJ);
+  const auto *err = static_cast<Object::Error *>(result.get());
+  ASSERT_EQ(err->m_source, defined);
+  auto position = err->m_source->Locate(err->m_offset);
+  // the + itself
+  ASSERT_EQ(position.Line, 1);
+  ASSERT_EQ(position.Column, 28);
+}
+
+TEST(StackEvaluator, DeepRecursion) {
+  // far deeper than native recursion in the evaluator could go
+  ASSERT_EQ(evalToString("let sum = fn(n) { if (n == 0) { 0 } else { "
+                         "n + sum(n - 1) } }; sum(100000);"),
+            "5000050000");
+  ASSERT_EQ(evalToString("let sum = fn(n) { if (n == 0) { 0 } else { "
+                         "n + sum(n - 1) } }; sum(100000);",
+                         1000),
+            "Error: stack depth exceeded");
+  ASSERT_EQ(evalToString("let f = fn(n) { 1 + f(n + 1) }; f(0);"),
+            "Error: stack depth exceeded");
+}
+
+TEST(StackEvaluator, TailCallsDontCountAgainstTheDepth) {
+  ASSERT_EQ(evalToString("let loop = fn(n, acc) { if (n == 0) { acc } else { "
+                         "loop(n - 1, acc + 1) } }; loop(100000, 0);",
+                         100),
+            "100000");
+  ASSERT_EQ(evalToString("let loop = fn(n) { if (n > 0) { return loop(n - 1); "
+                         "} 7 }; loop(100000);",
+                         100),
+            "7");
+}
+
+// A long lived evaluator sees a new literal in every program it is given,
+// the cache only keeps the ones whose functions are still around
+TEST(StackEvaluator, PrototypeCacheIsSwept) {
+  Evaluator::StackEvaluator evaluator;
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  // Programs stay alive so every literal gets a fresh key
+  std::vector<Ast::Program> programs;
+  for (int i = 0; i < 1000; i++) {
+    Lexer::Lexer l("fn(x) { x }(1)");
+    Parser::Parser p(l);
+    auto &program = programs.emplace_back(p.ParseProgram());
+    ASSERT_EQ(evaluator.Eval(&program, env).AsInteger(), 1);
+    Gc::Heap::Current().Collect();
+  }
+  ASSERT_LT(evaluator.CachedPrototypes(), 200);
+}
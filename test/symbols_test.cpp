@@ -0,0 +1,75 @@
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "symbols.hpp"
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(Symbols, EqualNamesShareAnId) {
+  auto a = Symbols::Intern("counter");
+  auto b = Symbols::Intern(std::string("count") + "er");
+  ASSERT_EQ(a, b);
+  ASSERT_NE(a, Symbols::Intern("counters"));
+  ASSERT_EQ(Symbols::Name(a), "counter");
+  // the builtins are interned along with everything else
+  ASSERT_EQ(Symbols::Name(Symbols::Intern("len")), "len");
+}
+
+TEST(Symbols, ThreadsAgree) {
+  constexpr std::size_t threadCount = 8;
+  std::vector<std::vector<Symbols::Symbol>> got(threadCount);
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t t = 0; t < threadCount; t++) {
+      threads.emplace_back([&got, t] {
+        for (int i = 0; i < 500; i++) {
+          got[t].push_back(Symbols::Intern("threaded" + std::to_string(i)));
+        }
+      });
+    }
+  }
+  for (std::size_t t = 1; t < threadCount; t++) {
+    ASSERT_EQ(got[t], got[0]);
+  }
+  ASSERT_EQ(Symbols::Name(got[0][42]), "threaded42");
+}
+
+TEST(Symbols, OnlyIdentifiersAreInterned) {
+  Lexer::Lexer l("let total = fn(x) { x + \"x\" };");
+  for (auto tok = l.NextToken(); tok.Type != Token::EOF_; tok = l.NextToken()) {
+    if (tok.Type == Token::IDENT) {
+      ASSERT_EQ(tok.Name, Symbols::Intern(tok.Literal));
+    } else {
+      ASSERT_EQ(tok.Name, Symbols::NoSymbol) << tok.Literal;
+    }
+  }
+}
+
+TEST(Symbols, NamesOutliveThePrograms) {
+  Symbols::Symbol name{};
+  {
+    Lexer::Lexer l("let ephemeral = 1;");
+    Parser::Parser p(l);
+    auto program = p.ParseProgram();
+    auto *let = Ast::Cast<Ast::LetStatement>(program.m_statements[0].get());
+    name = let->m_name->m_symbol;
+  }
+  ASSERT_EQ(Symbols::Name(name), "ephemeral");
+}
+
+TEST(Symbols, EnvironmentsAreKeyedBySymbol) {
+  auto env = Gc::Pin(Object::New<Object::Environment>());
+  auto name = Symbols::Intern("bound");
+  env->Set(name, Object::Value::Int(7));
+  auto inner = Gc::Pin(Object::New<Object::Environment>(env.get()));
+  auto found = inner->Get(name);
+  ASSERT_TRUE(found.ok);
+  ASSERT_EQ(found.obj.AsInteger(), 7);
+  ASSERT_FALSE(inner->Get(Symbols::Intern("unbound")).ok);
+}
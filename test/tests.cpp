@@ -1,6 +1,10 @@
 #include "lexer.hpp"
 #include "token.hpp"
 #include <gtest/gtest.h>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
 #include <parser.hpp>
 
 TEST(TestNextToken, Works) {
@@ -142,3 +146,213 @@ TEST(TestNextToken, Works) {
     i++;
   }
 }
+
+TEST(TestNextToken, LiteralsPointIntoTheSource) {
+  std::string input =
+    "let x = 12345; \"plain\" \"esc\\n\" 99999999999999999999";
+  Lexer::Lexer l(input);
+  std::string_view text = l.Source()->Text;
+  auto inText = [&](std::string_view literal) {
+    return literal.data() >= text.data() &&
+           literal.data() + literal.size() <= text.data() + text.size();
+  };
+
+  Token::Token tok = l.NextToken();
+  ASSERT_TRUE(inText(tok.Literal));
+  ASSERT_TRUE(inText(l.NextToken().Literal));
+  ASSERT_TRUE(inText(l.NextToken().Literal));
+
+  tok = l.NextToken();
+  ASSERT_EQ(tok.Type, Token::INT);
+  ASSERT_EQ(tok.Int, 12345);
+  ASSERT_TRUE(inText(tok.Literal));
+  l.NextToken();
+
+  tok = l.NextToken();
+  ASSERT_EQ(tok.Literal, "plain");
+  ASSERT_TRUE(inText(tok.Literal));
+
+  // escapes are processed into storage of their own
+  tok = l.NextToken();
+  ASSERT_EQ(tok.Literal, "esc\n");
+  ASSERT_FALSE(inText(tok.Literal));
+  ASSERT_EQ(l.Source()->Decoded.size(), 1);
+
+  // too big for a long
+  tok = l.NextToken();
+  ASSERT_EQ(tok.Type, Token::INT);
+  ASSERT_EQ(tok.Int, -1);
+}
+
+TEST(TestNextToken, ProgramKeepsTheSourceAlive) {
+  Ast::Program program;
+  {
+    Lexer::Lexer l("let greeting = \"hi\\tthere\"; greeting + 1;");
+    Parser::Parser p(l);
+    program = p.ParseProgram();
+  }
+  ASSERT_EQ(program.String(), "let greeting = hi\tthere;(greeting + 1)");
+
+  Lexer::Lexer l("12345678901234567890123");
+  Parser::Parser p(l);
+  p.ParseProgram();
+  ASSERT_EQ(p.Errors().size(), 1);
+  ASSERT_EQ(p.Errors()[0],
+            "could not parse 12345678901234567890123 as integer");
+}
+
+// Runs of every length around the 16 and 32 bytes the lexer scans at a
+// time, starting at every offset into a block
+TEST(TestNextToken, RunsAcrossBlocks) {
+  for (std::size_t offset = 0; offset < 33; offset++) {
+    for (std::size_t length = 1; length < 70; length++) {
+      std::string ident(length, 'x');
+      ident[length - 1] = length % 2 == 0 ? 'Z' : '_';
+      std::string digits(length, '7');
+      std::string str(length, 's');
+      std::string input = std::string(offset, ' ') + ident + digits + "\t\r\n" +
+                          std::string(length, ' ') + "\"" + str + "\"" + "a";
+      Lexer::Lexer l(input);
+      ASSERT_EQ(l.NextToken().Literal, ident) << input;
+      auto tok = l.NextToken();
+      ASSERT_EQ(tok.Type, Token::INT) << input;
+      ASSERT_EQ(tok.Literal, digits) << input;
+      tok = l.NextToken();
+      ASSERT_EQ(tok.Type, Token::STRING) << input;
+      ASSERT_EQ(tok.Literal, str) << input;
+      ASSERT_EQ(l.NextToken().Literal, "a") << input;
+      ASSERT_EQ(l.NextToken().Type, Token::EOF_) << input;
+    }
+  }
+}
+
+TEST(TestNextToken, KeywordsAndOddBytes) {
+  struct Test {
+    Token::TokenType expectedToken;
+    std::string expectedLiteral;
+  };
+  std::string input = "fn fnx lets iff els retur True _if else return "
+                      "\xc3\xa9 @ a\"open \\\" \\x\\n\\";
+  input.append(std::string(1, '\0') + "!=!");
+  std::vector<Test> tests = {
+    {.expectedToken = Token::FUNCTION, .expectedLiteral = "fn"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "fnx"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "lets"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "iff"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "els"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "retur"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "True"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "_if"},
+    {.expectedToken = Token::ELSE, .expectedLiteral = "else"},
+    {.expectedToken = Token::RETURN, .expectedLiteral = "return"},
+    {.expectedToken = Token::ILLEGAL, .expectedLiteral = "\xc3"},
+    {.expectedToken = Token::ILLEGAL, .expectedLiteral = "\xa9"},
+    {.expectedToken = Token::ILLEGAL, .expectedLiteral = "@"},
+    {.expectedToken = Token::IDENT, .expectedLiteral = "a"},
+    // an unterminated string runs to the first NUL
+    {.expectedToken = Token::STRING, .expectedLiteral = "open \" \\x\n\\"},
+    // lexing goes on after a NUL
+    {.expectedToken = Token::NOT_EQ, .expectedLiteral = "!="},
+    {.expectedToken = Token::BANG, .expectedLiteral = "!"},
+    {.expectedToken = Token::EOF_, .expectedLiteral = ""},
+    {.expectedToken = Token::EOF_, .expectedLiteral = ""},
+  };
+  Lexer::Lexer l(input);
+  for (const auto &tst : tests) {
+    auto tok = l.NextToken();
+    ASSERT_EQ(tok.Type, tst.expectedToken) << tst.expectedLiteral;
+    ASSERT_EQ(tok.Literal, tst.expectedLiteral);
+  }
+}
+
+TEST(TestNextToken, Positions) {
+  std::string input = "let x = 5;\n  \"a\\n\" + x\n\n\"open";
+  Lexer::Lexer l(input);
+  std::vector<std::pair<Token::Offset, Token::Position>> want = {
+    {0, {1, 1}},  {4, {1, 5}},   {6, {1, 7}},   {8, {1, 9}},
+    {9, {1, 10}}, {13, {2, 3}},  {19, {2, 9}},  {21, {2, 11}},
+    {24, {4, 1}}, {29, {4, 6}},
+  };
+  for (auto [offset, position] : want) {
+    auto tok = l.NextToken();
+    ASSERT_EQ(tok.Start, offset) << tok.Literal;
+    auto got = l.Source()->Locate(tok.Start);
+    ASSERT_EQ(got.Line, position.Line) << tok.Literal;
+    ASSERT_EQ(got.Column, position.Column) << tok.Literal;
+  }
+  // the unterminated string ran to the end, where the EOF_ is
+  ASSERT_EQ(input.size(), 29);
+}
+
+static void expectSameTokens(const std::string &input, std::size_t parts) {
+  auto source = std::make_shared<Token::Source>();
+  source->Owned = input;
+  source->Text = source->Owned;
+  auto buffer = Lexer::TokenBuffer::Tokenize(source, parts);
+  Lexer::Lexer l(input);
+  for (std::size_t i = 0; i < buffer.Size(); i++) {
+    auto want = l.NextToken();
+    auto got = buffer.At(i);
+    ASSERT_EQ(got.Type, want.Type) << i << " of " << input.size();
+    ASSERT_EQ(got.Literal, want.Literal) << i << " of " << input.size();
+    ASSERT_EQ(got.Start, want.Start) << i << " of " << input.size();
+    ASSERT_EQ(got.Name, want.Name) << i << " of " << input.size();
+    if (want.Type == Token::INT) {
+      ASSERT_EQ(got.Int, want.Int);
+    }
+  }
+  ASSERT_EQ(buffer.At(buffer.Size() - 1).Type, Token::EOF_);
+  // past the end stays the end
+  ASSERT_EQ(buffer.At(buffer.Size() + 5).Type, Token::EOF_);
+}
+
+TEST(TokenBuffer, CutsAtTopLevelSemicolons) {
+  std::string input;
+  for (int i = 0; i < 200; i++) {
+    input += "let a = fn(x) { x; 1; }(\"s;\\\";\"); [1; 2]; "
+             "99999999999999999999; \"esc\\n\";\n";
+  }
+  auto source = std::make_shared<Token::Source>();
+  source->Text = input;
+  auto buffer = Lexer::TokenBuffer::Tokenize(source, 8);
+  ASSERT_EQ(buffer.Parts(), 8);
+  // each piece decoded its escapes into the one Source
+  ASSERT_EQ(source->Decoded.size(), 400);
+  for (std::size_t parts :
+       std::initializer_list<std::size_t>{1, 2, 3, 8, 64, 10000}) {
+    expectSameTokens(input, parts);
+  }
+  expectSameTokens("", 4);
+  expectSameTokens(";;;;", 4);
+}
+
+// Random bytes heavy on what the cuts have to get right
+TEST(TokenBuffer, MatchesTheLexer) {
+  const std::string alphabet("ab1 ;;;\"\"\\nt(){}[]=!\0", 20);
+  std::uint32_t seed = 12345;
+  for (std::size_t round = 0; round < 300; round++) {
+    std::string input;
+    for (int i = 0; i < 400; i++) {
+      seed = seed * 1103515245 + 12345;
+      input += alphabet[(seed >> 16) % alphabet.size()];
+    }
+    expectSameTokens(input, 1 + round % 16);
+  }
+}
+
+TEST(TokenBuffer, Parses) {
+  std::string input = "let greeting = \"hi\\tthere\"; greeting + 1; "
+                      "if (x) { [1, 2][0] } else { fn(a) { a * 3 } };";
+  Lexer::Lexer l(input);
+  Parser::Parser streamed(l);
+  auto want = streamed.ParseProgram();
+
+  auto source = std::make_shared<Token::Source>();
+  source->Owned = input;
+  source->Text = source->Owned;
+  auto buffer = Lexer::TokenBuffer::Tokenize(source, 3);
+  Parser::Parser p(buffer);
+  auto program = p.ParseProgram();
+  ASSERT_TRUE(p.Errors().empty());
+  ASSERT_EQ(program.String(), want.String());
+}
@@ -0,0 +1,187 @@
+#include "evaluator.hpp"
+#include "object.hpp"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+TEST(Value, IntegersAreInline) {
+  auto value = Object::Value::Int(42);
+  ASSERT_TRUE(value.IsInteger());
+  ASSERT_EQ(value.AsInteger(), 42);
+  ASSERT_EQ(value.Type(), Object::ObjectType::INTEGER_OBJ);
+
+  auto *intObj = dynamic_cast<Object::Integer *>(value.get());
+  ASSERT_NE(intObj, nullptr);
+  ASSERT_EQ(intObj->m_value, 42);
+  ASSERT_EQ(value->Inspect(), "42");
+
+  auto copy = value;
+  ASSERT_EQ(copy.AsInteger(), 42);
+  ASSERT_NE(copy.get(), value.get());
+
+  std::shared_ptr<Object::IObject> boxed = value;
+  ASSERT_EQ(boxed->Type(), Object::ObjectType::INTEGER_OBJ);
+  ASSERT_EQ(boxed->Inspect(), "42");
+}
+
+TEST(Value, BooleansAndNullAreSingletons) {
+  ASSERT_EQ(Object::Value::Bool(true).get(), Evaluator::TRUE.get());
+  ASSERT_EQ(Object::Value::Bool(false).get(), Evaluator::FALSE.get());
+  ASSERT_NE(Evaluator::TRUE.get(), Evaluator::FALSE.get());
+  ASSERT_EQ(Object::Value::Null().Type(), Object::ObjectType::NULL_OBJ);
+
+  // boxing a singleton must not take ownership of it
+  std::shared_ptr<Object::IObject> boxed = Evaluator::TRUE;
+  ASSERT_EQ(boxed.get(), Evaluator::TRUE.get());
+  ASSERT_EQ(boxed.use_count(), 0);
+}
+
+TEST(Value, HeapObjectsAreShared) {
+  auto str = std::make_shared<Object::String>("monkey");
+  Object::Value value = str;
+  ASSERT_EQ(value.get(), str.get());
+  ASSERT_EQ(str.use_count(), 2);
+  {
+    auto copy = value;
+    ASSERT_EQ(str.use_count(), 3);
+  }
+  ASSERT_EQ(str.use_count(), 2);
+
+  Object::Value moved = std::move(value);
+  ASSERT_EQ(str.use_count(), 2);
+  moved = Object::Value::Int(1);
+  ASSERT_EQ(str.use_count(), 1);
+}
+
+TEST(Value, Empty) {
+  Object::Value value;
+  ASSERT_EQ(value, nullptr);
+  ASSERT_FALSE(value);
+  ASSERT_EQ(value.get(), nullptr);
+  ASSERT_EQ(static_cast<std::shared_ptr<Object::IObject>>(value), nullptr);
+}
+
+TEST(String, ConcatenationBuildsARope) {
+  Object::Value small = Object::String::Concat(
+    Object::New<Object::String>("ab"), Object::New<Object::String>("cd"));
+  auto *smallStr = static_cast<Object::String *>(small.get());
+  ASSERT_FALSE(smallStr->IsRope());
+  ASSERT_EQ(smallStr->Flat(), "abcd");
+
+  std::string expected;
+  Object::Value str = Object::New<Object::String>("");
+  for (int i = 0; i < 1000; i++) {
+    auto piece = std::to_string(i);
+    expected += piece;
+    str = Object::String::Concat(str, Object::New<Object::String>(piece));
+  }
+  auto *rope = static_cast<Object::String *>(str.get());
+  ASSERT_TRUE(rope->IsRope());
+  ASSERT_EQ(rope->Length(), expected.size());
+  ASSERT_EQ(rope->Inspect(), expected);
+  ASSERT_FALSE(rope->IsRope());
+  ASSERT_EQ(rope->Length(), expected.size());
+}
+
+TEST(Hash, GrowsPastItsFirstGroups) {
+  Object::Hash hash;
+  for (long int i = 0; i < 1000; i++) {
+    hash.Set(Object::Integer(i).GetHashKey(), Object::Value::Int(i),
+             Object::Value::Int(i * 2));
+  }
+  ASSERT_EQ(hash.Size(), 1000);
+  for (long int i = 0; i < 1000; i++) {
+    const auto *pair =
+      hash.Find(Object::Integer(i).GetHashKey(), Object::Value::Int(i));
+    ASSERT_NE(pair, nullptr) << i;
+    ASSERT_EQ(pair->m_value.AsInteger(), i * 2);
+  }
+  ASSERT_EQ(
+    hash.Find(Object::Integer(1000).GetHashKey(), Object::Value::Int(1000)),
+    nullptr);
+  Object::Value zero = Object::New<Object::String>("0");
+  ASSERT_EQ(hash.Find(*Object::HashKeyOf(zero), zero), nullptr);
+}
+
+TEST(Hash, CollidingStringsStayApart) {
+  Object::Hash hash;
+  Object::Value first = Object::New<Object::String>("first");
+  Object::Value second = Object::New<Object::String>("second");
+  // as if the two strings hashed the same
+  auto shared = *Object::HashKeyOf(first);
+  hash.Set(shared, first, Object::Value::Int(1));
+  hash.Set(shared, second, Object::Value::Int(2));
+  ASSERT_EQ(hash.Size(), 2);
+  ASSERT_EQ(hash.Find(shared, first)->m_value.AsInteger(), 1);
+  ASSERT_EQ(hash.Find(shared, second)->m_value.AsInteger(), 2);
+  // an equal string that isn't the same object is the same key
+  Object::Value again = Object::New<Object::String>("second");
+  hash.Set(shared, again, Object::Value::Int(3));
+  ASSERT_EQ(hash.Size(), 2);
+  ASSERT_EQ(hash.Find(shared, second)->m_value.AsInteger(), 3);
+  ASSERT_EQ(hash.Find(shared, Object::New<Object::String>("third")), nullptr);
+}
+
+TEST(PersistentVector, PushAndIndexAcrossLevels) {
+  Object::PersistentVector vec;
+  const long int count = 40000; // deep enough for a three level trie
+  for (long int i = 0; i < count; i++) {
+    vec = vec.Push(Object::Value::Int(i));
+  }
+  ASSERT_EQ(vec.size(), count);
+  for (long int i = 0; i < count; i++) {
+    ASSERT_EQ(vec[static_cast<size_t>(i)].AsInteger(), i);
+  }
+  long int expected = 0;
+  for (const auto &value : vec) {
+    ASSERT_EQ(value.AsInteger(), expected++);
+  }
+  ASSERT_EQ(expected, count);
+}
+
+TEST(PersistentVector, VersionsDontSeeEachOther) {
+  Object::PersistentVector base;
+  for (long int i = 0; i < 40; i++) {
+    base = base.Push(Object::Value::Int(i));
+  }
+  // both push onto the same version, the second one must not clobber the
+  // slot the first one appended in place
+  auto a = base.Push(Object::Value::Int(100));
+  auto b = base.Push(Object::Value::Int(200));
+  ASSERT_EQ(base.size(), 40);
+  ASSERT_EQ(a.size(), 41);
+  ASSERT_EQ(b.size(), 41);
+  ASSERT_EQ(a[40].AsInteger(), 100);
+  ASSERT_EQ(b[40].AsInteger(), 200);
+  ASSERT_EQ(a[39].AsInteger(), 39);
+  ASSERT_EQ(b[39].AsInteger(), 39);
+}
+
+TEST(PersistentVector, RestSharesAndKeepsTheOriginal) {
+  Object::PersistentVector vec(
+    {Object::Value::Int(1), Object::Value::Int(2), Object::Value::Int(3)});
+  auto rest = vec.Rest();
+  ASSERT_EQ(rest.size(), 2);
+  ASSERT_EQ(rest[0].AsInteger(), 2);
+  auto pushed = rest.Push(Object::Value::Int(4));
+  ASSERT_EQ(pushed.size(), 3);
+  ASSERT_EQ(pushed[2].AsInteger(), 4);
+  ASSERT_EQ(vec.size(), 3);
+  ASSERT_EQ(vec[2].AsInteger(), 3);
+  ASSERT_TRUE(rest.Rest().Rest().empty());
+
+  // walking a large array with rest, across leaf and tail boundaries
+  Object::PersistentVector big;
+  for (long int i = 0; i < 2000; i++) {
+    big = big.Push(Object::Value::Int(i));
+  }
+  long int expected = 0;
+  for (; !big.empty(); big = big.Rest()) {
+    ASSERT_EQ(big[0].AsInteger(), expected);
+    ASSERT_EQ(big[big.size() - 1].AsInteger(), 1999);
+    expected++;
+  }
+  ASSERT_EQ(expected, 2000);
+}
@@ -0,0 +1,349 @@
+#include "ast.hpp"
+#include "common.hpp"
+#include "compiler.hpp"
+#include "evaluator.hpp"
+#include "gc.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+#include <format>
+#include <gtest/gtest.h>
+#include <memory>
+#include <variant>
+using Common::variant;
+
+static std::shared_ptr<Object::IObject> testRun(const std::string &input) {
+  Lexer::Lexer l(input);
+  Parser::Parser p(l);
+  Ast::Program program = p.ParseProgram();
+  Compiler::Compiler compiler;
+  if (!compiler.Compile(&program)) {
+    return Evaluator::Evaluator::newError(compiler.Errors()[0]);
+  }
+  Vm::Vm vm(compiler.GetBytecode());
+  if (auto err = vm.Run()) {
+    return err;
+  }
+  return vm.LastPoppedStackElem();
+}
+
+static void testExpectedObject(const std::string &input,
+                               const variant &expected) {
+  auto result = testRun(input);
+  ASSERT_NE(result, nullptr) << "no result for " << input;
+  if (std::holds_alternative<long int>(expected)) {
+    auto *intObj = dynamic_cast<Object::Integer *>(result.get());
+    ASSERT_NE(intObj, nullptr)
+      << std::format("{}: object is not an Integer, got {}", input,
+                     result->Inspect());
+    ASSERT_EQ(intObj->m_value, std::get<long int>(expected)) << input;
+  } else if (std::holds_alternative<bool>(expected)) {
+    auto *boolObj = dynamic_cast<Object::Boolean *>(result.get());
+    ASSERT_NE(boolObj, nullptr)
+      << std::format("{}: object is not a Boolean, got {}", input,
+                     result->Inspect());
+    ASSERT_EQ(boolObj->m_value, std::get<bool>(expected)) << input;
+  } else if (std::holds_alternative<std::string>(expected)) {
+    ASSERT_EQ(result->Inspect(), std::get<std::string>(expected)) << input;
+  } else {
+    ASSERT_EQ(result->Type(), Object::ObjectType::NULL_OBJ)
+      << std::format("{}: object is not NULL, got {}", input,
+                     result->Inspect());
+  }
+}
+
+struct vmTest {
+  const std::string input;
+  const variant expected;
+};
+
+static void runVmTests(const std::vector<vmTest> &tests) {
+  for (const auto &tst : tests) {
+    testExpectedObject(tst.input, tst.expected);
+  }
+}
+
+TEST(Vm, IntegerArithmetic) {
+  runVmTests({
+    {.input = "1", .expected = 1},
+    {.input = "1 + 2", .expected = 3},
+    {.input = "1 - 2", .expected = -1},
+    {.input = "4 / 2", .expected = 2},
+    {.input = "50 / 2 * 2 + 10 - 5", .expected = 55},
+    {.input = "5 * (2 + 10)", .expected = 60},
+    {.input = "-50 + 100 + -50", .expected = 0},
+    {.input = "(5 + 10 * 2 + 15 / 3) * 2 + -10", .expected = 50},
+  });
+}
+
+TEST(Vm, BooleanExpressions) {
+  runVmTests({
+    {.input = "true", .expected = true},
+    {.input = "1 < 2", .expected = true},
+    {.input = "1 > 2", .expected = false},
+    {.input = "1 != 2", .expected = true},
+    {.input = "true == false", .expected = false},
+    {.input = "(1 < 2) == true", .expected = true},
+    {.input = "!5", .expected = false},
+    {.input = "!!true", .expected = true},
+    {.input = "!(if (false) { 5; })", .expected = std::monostate{}},
+  });
+}
+
+TEST(Vm, Conditionals) {
+  runVmTests({
+    {.input = "if (true) { 10 }", .expected = 10},
+    {.input = "if (true) { 10 } else { 20 }", .expected = 10},
+    {.input = "if (false) { 10 } else { 20 } ", .expected = 20},
+    {.input = "if (1 > 2) { 10 }", .expected = std::monostate{}},
+    {.input = "if ((if (false) { 10 })) { 10 } else { 20 }", .expected = 20},
+    // comparisons of integers jump without pushing a boolean
+    {.input = "if (1 < 2) { 10 } else { 20 }", .expected = 10},
+    {.input = "if (2 == 3) { 10 } else { 20 }", .expected = 20},
+    {.input = "if (\"a\" != \"b\") { 10 } else { 20 }", .expected = 10},
+    {.input = "if (0) { 10 } else { 20 }", .expected = 10},
+  });
+}
+
+TEST(Vm, GlobalLetStatements) {
+  runVmTests({
+    {.input = "let one = 1; one", .expected = 1},
+    {.input = "let one = 1; let two = one + one; one + two", .expected = 3},
+    {.input = "let a = 1; let a = a + 1; a", .expected = 2},
+  });
+}
+
+TEST(Vm, StringsArraysAndIndex) {
+  runVmTests({
+    {.input = "\"mon\" + \"key\" + \"banana\"",
+     .expected = std::string("monkeybanana")},
+    {.input = "[1 + 2, 3 * 4, 5 + 6]", .expected = std::string("[3,12,11]")},
+    {.input = "[1, 2, 3][1]", .expected = 2},
+    {.input = "[[1, 1, 1]][0][0]", .expected = 1},
+    {.input = "[1, 2, 3][99]", .expected = std::monostate{}},
+    {.input = "[1][-1]", .expected = std::monostate{}},
+  });
+}
+
+TEST(Vm, HashLiteralsAndIndex) {
+  runVmTests({
+    {.input = "{}", .expected = std::string("{}")},
+    {.input = "{1: 2, 2: 3}", .expected = std::string("{1: 2, 2: 3}")},
+    {.input = "{1 + 1: 2 * 2, 3 + 3: 4 * 4}",
+     .expected = std::string("{2: 4, 6: 16}")},
+    {.input = "{1: 1, 2: 2}[1]", .expected = 1},
+    {.input = "{1: 1, 2: 2}[2]", .expected = 2},
+    {.input = "{1: 1}[0]", .expected = std::monostate{}},
+    {.input = "{}[0]", .expected = std::monostate{}},
+    {.input = "let k = \"b\"; {\"a\": 1, k: 2}[\"b\"]", .expected = 2},
+    {.input = "{[]: 1}",
+     .expected = std::string("Error: unusable as hash key: ARRAY")},
+  });
+}
+
+TEST(Vm, CallingFunctions) {
+  runVmTests({
+    {.input = "let fivePlusTen = fn() { 5 + 10; }; fivePlusTen();",
+     .expected = 15},
+    {.input = "let earlyExit = fn() { return 99; 100; }; earlyExit();",
+     .expected = 99},
+    {.input = "let noReturn = fn() { }; noReturn();",
+     .expected = std::monostate{}},
+    {.input = "let sum = fn(a, b) { let c = a + b; c; }; sum(1, 2);",
+     .expected = 3},
+    {.input = "let globalNum = 10; let sum = fn(a, b) { let c = a + b; c + "
+              "globalNum; }; let outer = fn() { sum(1, 2) + sum(3, 4) + "
+              "globalNum; }; outer() + globalNum;",
+     .expected = 50},
+    {.input = "fn(x) { x; }(5)", .expected = 5},
+  });
+}
+
+TEST(Vm, Closures) {
+  runVmTests({
+    {.input = "let newClosure = fn(a) { fn() { a; }; }; let closure = "
+              "newClosure(99); closure();",
+     .expected = 99},
+    {.input = "let newAdderOuter = fn(a, b) { let c = a + b; fn(d) { let e "
+              "= d + c; fn(f) { e + f; }; }; }; let newAdderInner = "
+              "newAdderOuter(1, 2); let adder = newAdderInner(3); adder(8);",
+     .expected = 14},
+    {.input = "let countDown = fn(x) { if (x == 0) { return 0; } else { "
+              "countDown(x - 1); } }; let wrapper = fn() { countDown(1); }; "
+              "wrapper();",
+     .expected = 0},
+    {.input = "let wrapper = fn() { let countDown = fn(x) { if (x == 0) { "
+              "return 0; } else { countDown(x - 1); } }; countDown(1); }; "
+              "wrapper();",
+     .expected = 0},
+  });
+}
+
+TEST(Vm, RecursiveFibonacci) {
+  runVmTests({
+    {.input = "let fibonacci = fn(x) { if (x == 0) { return 0; } else { if "
+              "(x == 1) { return 1; } else { fibonacci(x - 1) + fibonacci(x "
+              "- 2); } } }; fibonacci(15);",
+     .expected = 610},
+  });
+}
+
+TEST(Vm, BuiltinFunctions) {
+  runVmTests({
+    {.input = "len(\"four\")", .expected = 4},
+    {.input = "len([1, 2, 3])", .expected = 3},
+    {.input = "first([1, 2, 3])", .expected = 1},
+    {.input = "last([1, 2, 3])", .expected = 3},
+    {.input = "rest([1, 2, 3])", .expected = std::string("[2,3]")},
+    {.input = "push([], 1)", .expected = std::string("[1]")},
+    {.input = "let walk = fn(arr, acc) { if (len(arr) == 0) { acc } else { "
+              "walk(rest(arr), acc + first(arr)) } }; walk([1, 2, 3, 4], 0);",
+     .expected = 10},
+  });
+}
+
+TEST(Vm, Errors) {
+  runVmTests({
+    {.input = "5 + true;",
+     .expected = std::string("Error: type mismatch: INTEGER + BOOLEAN")},
+    {.input = "1 / 0", .expected = std::string("Error: division by zero")},
+    {.input = "-true",
+     .expected = std::string("Error: unknown operator: -BOOLEAN")},
+    {.input = "foobar",
+     .expected = std::string("Error: identifier not found: foobar")},
+    {.input = "1(2)", .expected = std::string("Error: not a function: INTEGER")},
+    {.input = "fn(a) { a; }();",
+     .expected =
+       std::string("Error: wrong number of arguments: want=1, got=0")},
+    {.input = "len(1)",
+     .expected =
+       std::string("Error: argument to 'len' not supported, got INTEGER")},
+    {.input = "let f = fn() { g(); }; let g = fn() { 5 }; f();",
+     .expected = 5},
+    {.input = "let f = fn() { g(); }; f(); let g = fn() { 5 };",
+     .expected = std::string("Error: identifier not found: g")},
+  });
+}
+
+// The stack grows as calls need it, up to the frame limit, and a tail call
+// reuses the frame of the function it is made from.
+TEST(Vm, DeepAndTailCalls) {
+  runVmTests({
+    {.input = "let sum = fn(n) { if (n == 0) { 0 } else { n + sum(n - 1) } }; "
+              "sum(100000)",
+     .expected = 5000050000},
+    {.input = "let b = fn(n, acc) { if (n == 0) { acc } else { b(n - 1, "
+              "push(acc, n)) } }; let s = fn(a, acc) { if (len(a) == 0) { "
+              "acc } else { s(rest(a), acc + first(a)) } }; s(b(700, []), 0)",
+     .expected = 245350},
+  });
+
+  auto run = [](const std::string &input, size_t maxFrames) {
+    Lexer::Lexer l(input);
+    Parser::Parser p(l);
+    Ast::Program program = p.ParseProgram();
+    Compiler::Compiler compiler;
+    EXPECT_TRUE(compiler.Compile(&program)) << input;
+    Vm::Vm vm(compiler.GetBytecode(), maxFrames);
+    if (auto err = vm.Run()) {
+      return err->Inspect();
+    }
+    return vm.LastPoppedStackElem()->Inspect();
+  };
+  ASSERT_EQ(run("let loop = fn(n) { if (n == 0) { 0 } else { loop(n - 1) } };"
+                "loop(100000)",
+                8),
+            "0");
+  ASSERT_EQ(run("let loop = fn(n) { if (n == 0) { 0 } else { "
+                "if (true) { return loop(n - 1); } } }; loop(100000)",
+                8),
+            "0");
+  ASSERT_EQ(run("let sum = fn(n) { if (n == 0) { 0 } else { n + sum(n - 1) } "
+                "}; sum(100)",
+                8),
+            "Error: stack overflow");
+}
+
+// Every program here is taken from evaluator_test.cpp, both engines must agree
+TEST(Vm, MatchesEvaluator) {
+  std::vector<std::string> inputs = {
+    "5 + 5 + 5 + 5 - 10",
+    "(5 + 10 * 2 + 15 / 3) * 2 + -10",
+    "(1 > 2) == false",
+    "!!5",
+    "if (1 > 2) { 10 } else { 20 }",
+    "if (false) { 10 }",
+    "9; return 2 * 5; 9;",
+    "if (10 > 1){if (10 > 1){return 10;}return 1;}",
+    "5 + true; 5;",
+    "true + false;",
+    "5; true - false; 5",
+    "if (10 > 1){ if (10 > 1) { return true + false; } return 1; }",
+    "\"Hello\" - \"world\"",
+    "let a = 5; let b = a; let c = a + b + 5; c;",
+    "let add = fn(x, y) { x + y; }; add(5 + 5, add(5, 5));",
+    "let first = 10; let second = 10; let third = 10; let ourFunction = "
+    "fn(first) { let second = 20; first + second + third; }; "
+    "ourFunction(20) + first + second;",
+    "let newAdder = fn(x) { fn(y) {x + y};}; let addTwo = newAdder(2); "
+    "addTwo(2);",
+    "\"Hello\" + \" \" + \"World!\"",
+    "let build = fn(n, acc) { if (n == 0) { acc } else { build(n - 1, acc + "
+    "\"ab\") } }; let s = build(300, \"x\"); [len(s), s == build(300, \"x\")]",
+    "len(\"one\",\"two\")",
+    "[1, 2 * 2, 3 + 3]",
+    "let myArray = [1, 2, 3]; let i = myArray[0]; myArray[i]",
+    "[1, 2, 3][3]",
+  };
+
+  for (const auto &input : inputs) {
+    Lexer::Lexer l(input);
+    Parser::Parser p(l);
+    Ast::Program program = p.ParseProgram();
+    Evaluator::Evaluator evaluator;
+    auto env = Gc::Pin(Object::New<Object::Environment>());
+    // pinned, running the vm below may collect
+    std::shared_ptr<Object::IObject> expected = evaluator.Eval(&program, env);
+    auto result = testRun(input);
+    ASSERT_NE(expected, nullptr) << input;
+    ASSERT_NE(result, nullptr) << input;
+    ASSERT_EQ(result->Inspect(), expected->Inspect()) << input;
+  }
+}
+
+// Lines of the repl, each compiled against what the ones before defined.
+// Names are bound when the line that uses them runs, not when it compiles.
+TEST(Vm, GlobalsAreBoundLate) {
+  auto state = Compiler::NewState();
+  Vm::Globals globals;
+  auto run = [&](const std::string &input) -> std::string {
+    Lexer::Lexer l(input);
+    Parser::Parser p(l);
+    Ast::Program program = p.ParseProgram();
+    Compiler::Compiler compiler(state);
+    if (!compiler.Compile(&program)) {
+      return compiler.Errors()[0];
+    }
+    state = compiler.GetState();
+    Vm::Vm vm(compiler.GetBytecode(), globals);
+    if (auto err = vm.Run()) {
+      return err->Inspect();
+    }
+    auto result = vm.LastPoppedStackElem();
+    return result != nullptr ? result->Inspect() : "";
+  };
+
+  ASSERT_EQ(run("let g = fn() { later + 1 };"), "");
+  ASSERT_EQ(run("g()"), "Error: identifier not found: later");
+  run("let later = 1;");
+  ASSERT_EQ(run("g()"), "2");
+
+  // a builtin gives way to a global of the same name bound later on
+  run("let f = fn() { 10 };");
+  run(R"(let h = fn() { f() + len("ab") };)");
+  ASSERT_EQ(run("h()"), "12");
+  run("let len = fn(x) { 100 };");
+  ASSERT_EQ(run("h()"), "110");
+}